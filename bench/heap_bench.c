@@ -0,0 +1,534 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ *
+ * @brief Banco de pruebas del heap (src/kmm.c) que se ejecuta en el host.
+ * @details
+ * Este programa se compila con la libc del host (make bench) y reproduce
+ * trazas de asignacion sobre un heap creado con create_heap() dentro de una
+ * region obtenida con mmap(). Para cada traza, cada politica de
+ * asignacion y con o sin fusion diferida (quick-lists) reporta los
+ * percentiles del tiempo por operacion, el tope maximo alcanzado por el heap
+ * y la fragmentacion.
+ *
+ * El heap maneja las direcciones como unsigned int, por lo cual la region
+ * se debe ubicar por debajo de 4 GB. En un host de 64 bits la region se
+ * solicita con MAP_32BIT, y el programa se enlaza sin PIE (BENCH_CFLAGS
+ * incluye -no-pie por defecto) para que sus datos tambien se ubiquen por
+ * debajo de 4 GB.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include <kmm.h>
+
+/** @brief Tamao de la region sobre la cual se crea el heap */
+#define BENCH_ARENA_SIZE (32 * 1024 * 1024)
+
+/** @brief Numero de operaciones por defecto de cada traza */
+#define BENCH_DEFAULT_OPS 200000
+
+/** @brief Numero maximo de regiones asignadas al mismo tiempo */
+#define BENCH_SLOTS 4096
+
+/** @brief Limite de bytes de las quick-lists al reproducir las trazas con
+ * fusion diferida */
+#define BENCH_QUICK_BUDGET 0x4000
+
+/** @brief Tipo de operacion de una traza */
+enum {
+	BENCH_ALLOC,
+	BENCH_FREE
+};
+
+/** @brief Operacion de una traza: asignar o liberar la region de un slot */
+typedef struct bench_op {
+	/** @brief BENCH_ALLOC o BENCH_FREE */
+	int type;
+	/** @brief Slot que almacena la region */
+	int slot;
+	/** @brief Tamao a asignar */
+	unsigned int size;
+}bench_op_t;
+
+/** @brief Traza de asignacion */
+typedef struct bench_trace {
+	/** @brief Nombre de la traza */
+	char * name;
+	/** @brief Operaciones de la traza */
+	bench_op_t * ops;
+	/** @brief Numero de operaciones */
+	int count;
+}bench_trace_t;
+
+/** @brief Estado del generador de numeros aleatorios */
+static unsigned int bench_seed = 1;
+
+/**
+ * @brief Genera un numero pseudoaleatorio (generador congruencial lineal).
+ * @return Numero pseudoaleatorio de 31 bits
+ */
+static unsigned int bench_rand(void) {
+	bench_seed = bench_seed * 1103515245 + 12345;
+	return (bench_seed >> 1) & 0x7FFFFFFF;
+}
+
+/**
+ * @brief Genera un numero pseudoaleatorio dentro de un rango.
+ * @param min Valor minimo
+ * @param max Valor maximo (incluido)
+ * @return Numero en el rango [min, max]
+ */
+static unsigned int bench_range(unsigned int min, unsigned int max) {
+	return min + bench_rand() % (max - min + 1);
+}
+
+/**
+ * @brief Agrega una operacion a una traza.
+ */
+static void add_op(bench_trace_t * trace, int type, int slot,
+		unsigned int size) {
+	trace->ops[trace->count].type = type;
+	trace->ops[trace->count].slot = slot;
+	trace->ops[trace->count].size = size;
+	trace->count++;
+}
+
+/** @brief Estado de los slots mientras se genera una traza */
+static unsigned int live[BENCH_SLOTS];
+
+/** @brief Slots libres mientras se genera una traza */
+static int free_slots[BENCH_SLOTS];
+
+/** @brief Numero de slots libres */
+static int free_slot_count;
+
+/**
+ * @brief Inicializa la lista de slots libres.
+ */
+static void init_slots(void) {
+	int i;
+
+	for (i = 0; i < BENCH_SLOTS; i++) {
+		live[i] = 0;
+		free_slots[i] = BENCH_SLOTS - 1 - i;
+	}
+	free_slot_count = BENCH_SLOTS;
+}
+
+/**
+ * @brief Agrega a una traza la asignacion de una region en un slot libre.
+ * @return Slot asignado, -1 si no existen slots libres.
+ */
+static int trace_alloc(bench_trace_t * trace, unsigned int size) {
+	int slot;
+
+	if (free_slot_count == 0) {
+		return -1;
+	}
+
+	slot = free_slots[--free_slot_count];
+	live[slot] = size;
+	add_op(trace, BENCH_ALLOC, slot, size);
+
+	return slot;
+}
+
+/**
+ * @brief Agrega a una traza la liberacion de la region de un slot.
+ */
+static void trace_free(bench_trace_t * trace, int slot) {
+	live[slot] = 0;
+	free_slots[free_slot_count++] = slot;
+	add_op(trace, BENCH_FREE, slot, 0);
+}
+
+/**
+ * @brief Agrega a una traza la liberacion de todas las regiones que aun se
+ * encuentran asignadas.
+ */
+static void trace_free_all(bench_trace_t * trace) {
+	int i;
+
+	for (i = 0; i < BENCH_SLOTS; i++) {
+		if (live[i] != 0) {
+			trace_free(trace, i);
+		}
+	}
+}
+
+/**
+ * @brief Tamao para la traza uniforme: entre 8 y 1024 bytes.
+ */
+static unsigned int uniform_size(void) {
+	return bench_range(8, 1024);
+}
+
+/**
+ * @brief Tamao para la traza bimodal: 90% objetos pequeos (8 a 64 bytes)
+ * y 10% buffers grandes (2 a 8 KB).
+ */
+static unsigned int bimodal_size(void) {
+	if (bench_range(0, 9) != 0) {
+		return bench_range(8, 64);
+	}
+	return bench_range(2048, 8192);
+}
+
+/**
+ * @brief Genera una traza en estado estable: cada operacion elige al azar
+ * un slot; si esta ocupado su region se libera, y si esta vacio se asigna
+ * una nueva region.
+ * @param trace Traza a generar
+ * @param ops Numero de operaciones
+ * @param size_fn Rutina que genera el tamao de cada region
+ */
+static void gen_steady(bench_trace_t * trace, int ops,
+		unsigned int (*size_fn)(void)) {
+	int slot;
+
+	init_slots();
+
+	while (trace->count < ops) {
+		slot = bench_range(0, BENCH_SLOTS / 2 - 1);
+		if (live[slot] != 0) {
+			live[slot] = 0;
+			add_op(trace, BENCH_FREE, slot, 0);
+		}else {
+			live[slot] = size_fn();
+			add_op(trace, BENCH_ALLOC, slot, live[slot]);
+		}
+	}
+
+	for (slot = 0; slot < BENCH_SLOTS; slot++) {
+		if (live[slot] != 0) {
+			live[slot] = 0;
+			add_op(trace, BENCH_FREE, slot, 0);
+		}
+	}
+}
+
+/**
+ * @brief Genera una traza de rafagas: se asignan varias regiones y luego se
+ * liberan en orden inverso (LIFO) o en el orden de asignacion (FIFO).
+ * @param trace Traza a generar
+ * @param ops Numero de operaciones
+ * @param lifo 1 para liberar en orden inverso, 0 en orden de asignacion
+ */
+static void gen_burst(bench_trace_t * trace, int ops, int lifo) {
+	int slots[BENCH_SLOTS];
+	int burst;
+	int i;
+
+	init_slots();
+
+	while (trace->count < ops) {
+		burst = bench_range(16, 1024);
+		for (i = 0; i < burst; i++) {
+			slots[i] = trace_alloc(trace, uniform_size());
+		}
+		for (i = 0; i < burst; i++) {
+			trace_free(trace, slots[lifo ? burst - 1 - i : i]);
+		}
+	}
+}
+
+/** @brief Numero de instantes en la rueda de vencimientos de la traza con
+ * tiempos de vida aleatorios. Debe ser mayor que el maximo tiempo de vida. */
+#define BENCH_WHEEL_SIZE 65536
+
+/**
+ * @brief Genera una traza con tiempos de vida aleatorios: cada region recibe
+ * al asignarse un tiempo de vida, en su mayoria corto, y se libera cuando
+ * este termina. Los tamaos combinan objetos pequeos y grandes.
+ * @param trace Traza a generar
+ * @param ops Numero de operaciones
+ */
+static void gen_lifetime(bench_trace_t * trace, int ops) {
+	static int wheel[BENCH_WHEEL_SIZE];
+	static int next[BENCH_SLOTS];
+	unsigned int now;
+	unsigned int lifetime;
+	unsigned int when;
+	int slot;
+
+	init_slots();
+
+	for (now = 0; now < BENCH_WHEEL_SIZE; now++) {
+		wheel[now] = -1;
+	}
+
+	for (now = 0; trace->count < ops; now++) {
+		/* Liberar las regiones cuyo tiempo de vida termina en este instante */
+		slot = wheel[now % BENCH_WHEEL_SIZE];
+		wheel[now % BENCH_WHEEL_SIZE] = -1;
+		while (slot >= 0) {
+			trace_free(trace, slot);
+			slot = next[slot];
+		}
+
+		/* Tiempo de vida con distribucion aproximadamente exponencial */
+		lifetime = bench_range(1, 64);
+		while (bench_range(0, 1) == 0 && lifetime < 4096) {
+			lifetime *= 4;
+		}
+
+		slot = trace_alloc(trace, bench_range(0, 3) == 0 ? bimodal_size()
+				: uniform_size());
+		if (slot >= 0) {
+			when = (now + lifetime) % BENCH_WHEEL_SIZE;
+			next[slot] = wheel[when];
+			wheel[when] = slot;
+		}
+	}
+
+	trace_free_all(trace);
+}
+
+/**
+ * @brief Compara dos muestras de tiempo (para qsort).
+ */
+static int compare_samples(const void * a, const void * b) {
+	unsigned int x = *(const unsigned int *)a;
+	unsigned int y = *(const unsigned int *)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * @brief Obtiene el tiempo actual en nanosegundos.
+ */
+static __inline__ unsigned long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Imprime los percentiles de un conjunto de muestras de tiempo.
+ */
+static void print_percentiles(char * label, unsigned int * samples,
+		int count) {
+	if (count == 0) {
+		return;
+	}
+
+	qsort(samples, count, sizeof(unsigned int), compare_samples);
+
+	printf("    %-5s p50 %6u  p90 %6u  p99 %6u  p99.9 %7u  max %8u ns\n",
+			label, samples[count / 2], samples[count * 90 / 100],
+			samples[count * 99 / 100], samples[count * 999 / 1000],
+			samples[count - 1]);
+}
+
+/**
+ * @brief Reproduce una traza sobre un heap nuevo y reporta sus resultados.
+ * @param trace Traza a reproducir
+ * @param arena Region de memoria sobre la cual se crea el heap
+ * @param policy Politica de asignacion del heap
+ * @param budget Limite de bytes de las quick-lists, 0 para fusionar las
+ * regiones al liberarlas
+ * @return 0 si la traza se reprodujo, -1 si el heap no pudo atender una
+ * solicitud.
+ */
+static int run_trace(bench_trace_t * trace, char * arena, int policy,
+		unsigned int budget) {
+	static void * ptrs[BENCH_SLOTS];
+	static unsigned int sizes[BENCH_SLOTS];
+	unsigned int * alloc_ns;
+	unsigned int * free_ns;
+	int allocs;
+	int frees;
+	unsigned long long start;
+	unsigned long long elapsed;
+	unsigned long long total;
+	unsigned int live_bytes;
+	unsigned int peak_live;
+	unsigned int peak_top;
+	unsigned int worst_frag;
+	heap_stats_t stats;
+	bench_op_t * op;
+	heap_t * heap;
+	int i;
+
+	heap = create_heap((unsigned int)arena, BENCH_ARENA_SIZE, policy);
+	heap_defer_coalescing(heap, budget);
+
+	alloc_ns = malloc(trace->count * sizeof(unsigned int));
+	free_ns = malloc(trace->count * sizeof(unsigned int));
+
+	allocs = frees = 0;
+	total = 0;
+	live_bytes = peak_live = 0;
+	peak_top = heap->top;
+	worst_frag = 0;
+
+	for (i = 0; i < trace->count; i++) {
+		op = &trace->ops[i];
+		if (op->type == BENCH_ALLOC) {
+			start = now_ns();
+			ptrs[op->slot] = alloc_from_heap(heap, op->size);
+			elapsed = now_ns() - start;
+			if (ptrs[op->slot] == 0) {
+				printf("  %s: no se pudo asignar %u bytes (operacion %d)\n",
+						trace->name, op->size, i);
+				free(alloc_ns);
+				free(free_ns);
+				return -1;
+			}
+			alloc_ns[allocs++] = (unsigned int)elapsed;
+			sizes[op->slot] = op->size;
+			live_bytes += op->size;
+			if (live_bytes > peak_live) {
+				peak_live = live_bytes;
+			}
+			if (heap->top > peak_top) {
+				peak_top = heap->top;
+			}
+		}else {
+			start = now_ns();
+			free_from_heap(heap, MEMREG_HEADER(ptrs[op->slot]));
+			elapsed = now_ns() - start;
+			free_ns[frees++] = (unsigned int)elapsed;
+			live_bytes -= sizes[op->slot];
+		}
+		total += elapsed;
+
+		/* Fragmentacion externa: porcentaje del espacio libre por debajo
+		 * del tope que no se encuentra en la mayor region libre */
+		if ((i & 1023) == 0) {
+			heap_stats(heap, &stats);
+			if (stats.fragmentation > worst_frag) {
+				worst_frag = stats.fragmentation;
+			}
+		}
+	}
+
+	/* Al final de la traza no deben quedar regiones sin fusionar */
+	heap_flush_quick(heap);
+	heap_stats(heap, &stats);
+
+	printf("  %-9s %-10s %-6s ops %7d  avg %5llu ns  peak top %8u  "
+			"peak live %8u  overhead %3u%%  max frag %3u%%  free at end %s\n",
+			trace->name, (policy == HEAP_BEST_FIT) ? "best-fit" : "first-fit",
+			(budget != 0) ? "quick" : "eager", trace->count,
+			total / trace->count, peak_top - heap->base,
+			peak_live,
+			(unsigned int)(100ULL * (peak_top - heap->base - peak_live) /
+					(peak_top - heap->base)),
+			worst_frag, (stats.free_regions <= 1) ? "ok" : "FRAGMENTED");
+	printf("    splits %u  coalesces %u  expands %u  contracts %u  "
+			"quick flushes %u\n", stats.splits, stats.coalesces,
+			stats.expands, stats.contracts, stats.quick_flushes);
+	print_percentiles("alloc", alloc_ns, allocs);
+	print_percentiles("free", free_ns, frees);
+
+	free(alloc_ns);
+	free(free_ns);
+
+	return 0;
+}
+
+/**
+ * @brief Obtiene la region sobre la cual se crea el heap. malloc() ubica
+ * las regiones grandes por encima de 4 GB en un host de 64 bits, por lo
+ * cual la region se solicita con MAP_32BIT cuando el sistema lo soporta.
+ * @return Region de BENCH_ARENA_SIZE bytes, 0 si no es posible obtenerla.
+ */
+static char * alloc_arena(void) {
+	void * arena;
+	int flags;
+
+	flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_32BIT
+	flags |= MAP_32BIT;
+#endif
+
+	arena = mmap(0, BENCH_ARENA_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+	if (arena == MAP_FAILED) {
+		return 0;
+	}
+
+	return (char *)arena;
+}
+
+/**
+ * @brief Punto de entrada del banco de pruebas.
+ * Uso: heap_bench [operaciones] [semilla]
+ */
+int main(int argc, char * argv[]) {
+	bench_trace_t traces[5];
+	char * arena;
+	unsigned int seed;
+	int ops;
+	int result;
+	int i;
+
+	ops = (argc > 1) ? atoi(argv[1]) : BENCH_DEFAULT_OPS;
+	seed = (argc > 2) ? (unsigned int)atoi(argv[2]) : 1;
+	bench_seed = seed;
+
+	if (ops <= 0) {
+		fprintf(stderr, "uso: %s [operaciones] [semilla]\n", argv[0]);
+		return 1;
+	}
+
+	arena = alloc_arena();
+
+	if (arena == 0 || (unsigned long)arena + BENCH_ARENA_SIZE >
+			(unsigned long)(unsigned int)-1) {
+		fprintf(stderr, "El heap requiere direcciones de 32 bits; compile "
+				"con -no-pie o -m32\n");
+		return 1;
+	}
+
+	traces[0].name = "uniform";
+	traces[1].name = "bimodal";
+	traces[2].name = "lifo";
+	traces[3].name = "fifo";
+	traces[4].name = "lifetime";
+
+	/* Las trazas pueden exceder el numero solicitado de operaciones al
+	 * liberar las regiones que quedan asignadas */
+	for (i = 0; i < 5; i++) {
+		traces[i].ops = malloc((ops + 3 * BENCH_SLOTS) * sizeof(bench_op_t));
+		traces[i].count = 0;
+	}
+
+	gen_steady(&traces[0], ops, uniform_size);
+	gen_steady(&traces[1], ops, bimodal_size);
+	gen_burst(&traces[2], ops, 1);
+	gen_burst(&traces[3], ops, 0);
+	gen_lifetime(&traces[4], ops);
+
+	printf("Heap bench: %d operaciones por traza, semilla %u, arena %u KB\n",
+			ops, seed, BENCH_ARENA_SIZE / 1024);
+
+	result = 0;
+	for (i = 0; i < 5; i++) {
+		if (run_trace(&traces[i], arena, HEAP_FIRST_FIT, 0) < 0 ||
+				run_trace(&traces[i], arena, HEAP_BEST_FIT, 0) < 0 ||
+				run_trace(&traces[i], arena, HEAP_FIRST_FIT,
+						BENCH_QUICK_BUDGET) < 0 ||
+				run_trace(&traces[i], arena, HEAP_BEST_FIT,
+						BENCH_QUICK_BUDGET) < 0) {
+			result = 1;
+		}
+	}
+
+	for (i = 0; i < 5; i++) {
+		free(traces[i].ops);
+	}
+	munmap(arena, BENCH_ARENA_SIZE);
+
+	return result;
+}
@@ -0,0 +1,197 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ *
+ * @brief Prueba de la pila sin bloqueos generica (generic_lfstack.h) que se
+ * ejecuta en el host.
+ * @details
+ * Este programa se compila con la libc del host (make lfstack_test). Primero
+ * verifica el orden LIFO de push, pop y pop_all en un solo hilo. Luego varios
+ * hilos extraen y vuelven a insertar elementos de la misma pila al mismo
+ * tiempo, lo cual produce el patron ABA que el contador de la cabeza debe
+ * detectar; al terminar, cada elemento debe estar en la pila exactamente una
+ * vez.
+ *
+ * La pila usa cmpxchg8b sobre un apuntador de 32 bits y un contador, por lo
+ * cual el programa se compila para 32 bits (LFSTACK_CFLAGS incluye -m32). En
+ * un host de 64 bits se requiere la libc de 32 bits (gcc-multilib).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <generic_lfstack.h>
+
+/** @brief Numero de iteraciones por defecto de cada hilo */
+#define TEST_DEFAULT_OPS 1000000
+
+/** @brief Numero de hilos que usan la pila al mismo tiempo */
+#define TEST_THREADS 4
+
+/** @brief Numero de elementos. Es pequeo para que los hilos extraigan e
+ * inserten los mismos elementos con frecuencia. */
+#define TEST_NODES 8
+
+/** @brief Elemento de prueba */
+typedef struct test_node {
+	/** @brief Numero de veces que el elemento se encontro en la pila */
+	int seen;
+	DEFINE_GENERIC_SLIST_LINKS(test_stack); /*Links genericos */
+}test_node_t;
+
+/** @brief Definicin de las primitivas para gestionar pilas sin bloqueos
+ * de tipo test_node_t*/
+DEFINE_GENERIC_LFSTACK_TYPE(test_node_t, test_stack);
+
+/** @brief Implementacin de las primitivas para gestionar pilas sin
+ * bloqueos de tipo test_node_t*/
+IMPLEMENT_GENERIC_LFSTACK_TYPE(test_node_t, test_stack);
+
+/** @brief Elementos de prueba */
+static test_node_t nodes[TEST_NODES];
+
+/** @brief Pila compartida por los hilos */
+static lfstack_test_stack stack;
+
+/** @brief Numero de iteraciones de cada hilo */
+static int test_ops;
+
+/**
+ * @brief Extrae dos elementos y los vuelve a insertar en orden inverso.
+ * @param arg No se usa
+ * @return 0
+ */
+static void * stress_thread(void * arg) {
+	test_node_t * a;
+	test_node_t * b;
+	int i;
+
+	for (i = 0; i < test_ops; i++) {
+		a = lfstack_pop_test_stack(&stack);
+		b = lfstack_pop_test_stack(&stack);
+		if (a != 0) {
+			lfstack_push_test_stack(&stack, a);
+		}
+		if (b != 0) {
+			lfstack_push_test_stack(&stack, b);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Verifica el orden LIFO de la pila en un solo hilo.
+ * @return 0 si la pila es valida, -1 en caso contrario
+ */
+static int check_lifo(void) {
+	test_node_t * n;
+	unsigned int tag;
+	int i;
+
+	init_lfstack_test_stack(&stack);
+
+	if (lfstack_pop_test_stack(&stack) != 0 ||
+			lfstack_pop_all_test_stack(&stack) != 0) {
+		printf("  la pila vacia retorno un elemento\n");
+		return -1;
+	}
+
+	for (i = 0; i < TEST_NODES; i++) {
+		if (lfstack_push_test_stack(&stack, &nodes[i]) != &nodes[i]) {
+			printf("  push no retorno el elemento insertado\n");
+			return -1;
+		}
+	}
+
+	/* Cada extraccion incrementa el contador de la cabeza */
+	tag = stack.tag;
+	for (i = TEST_NODES - 1; i >= TEST_NODES / 2; i--) {
+		if (lfstack_pop_test_stack(&stack) != &nodes[i]) {
+			printf("  pop no retorno el ultimo elemento insertado\n");
+			return -1;
+		}
+	}
+	if (stack.tag != tag + TEST_NODES - TEST_NODES / 2) {
+		printf("  pop no incremento el contador\n");
+		return -1;
+	}
+
+	/* pop_all retorna los elementos restantes como una lista simple */
+	n = lfstack_pop_all_test_stack(&stack);
+	for (i = TEST_NODES / 2 - 1; i >= 0; i--) {
+		if (n != &nodes[i]) {
+			printf("  pop_all no retorno los elementos en orden\n");
+			return -1;
+		}
+		n = n->snext_test_stack;
+	}
+	if (n != 0 || stack.head != 0) {
+		printf("  pop_all no vacio la pila\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char * argv[]) {
+	pthread_t threads[TEST_THREADS];
+	test_node_t * n;
+	int count;
+	int i;
+
+	test_ops = (argc > 1) ? atoi(argv[1]) : TEST_DEFAULT_OPS;
+
+	if (test_ops <= 0) {
+		fprintf(stderr, "uso: %s [iteraciones]\n", argv[0]);
+		return 1;
+	}
+
+	if (sizeof(void *) != sizeof(unsigned int)) {
+		fprintf(stderr, "La pila requiere direcciones de 32 bits; compile "
+				"con -m32\n");
+		return 1;
+	}
+
+	printf("LF stack test: %d hilos, %d iteraciones por hilo\n",
+			TEST_THREADS, test_ops);
+
+	if (check_lifo() < 0) {
+		printf("Fallo la prueba en un solo hilo\n");
+		return 1;
+	}
+
+	init_lfstack_test_stack(&stack);
+	for (i = 0; i < TEST_NODES; i++) {
+		lfstack_push_test_stack(&stack, &nodes[i]);
+	}
+
+	for (i = 0; i < TEST_THREADS; i++) {
+		pthread_create(&threads[i], 0, stress_thread, 0);
+	}
+	for (i = 0; i < TEST_THREADS; i++) {
+		pthread_join(threads[i], 0);
+	}
+
+	/* Un enlace obsoleto pierde o duplica elementos, o forma un ciclo */
+	count = 0;
+	for (n = lfstack_pop_all_test_stack(&stack); n != 0 &&
+			count <= TEST_NODES; n = n->snext_test_stack) {
+		n->seen++;
+		count++;
+	}
+	for (i = 0; i < TEST_NODES; i++) {
+		if (nodes[i].seen != 1) {
+			printf("Fallo: el elemento %d se encontro %d veces\n", i,
+					nodes[i].seen);
+			return 1;
+		}
+	}
+
+	printf("OK: %d elementos en la pila al terminar\n", count);
+
+	return 0;
+}
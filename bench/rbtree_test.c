@@ -0,0 +1,205 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ *
+ * @brief Prueba del arbol rojo-negro generico (generic_rbtree.h) que se
+ * ejecuta en el host.
+ * @details
+ * Este programa se compila con la libc del host (make rbtree_test) y
+ * realiza una secuencia aleatoria de inserciones y eliminaciones sobre un
+ * arbol con claves repetidas. Despues de cada operacion verifica el arbol
+ * con tree_check(), recorre los elementos en orden con tree_next() y en
+ * orden inverso con tree_prev(), y compara tree_lower_bound() con una
+ * busqueda lineal.
+ *
+ * El color de los nodos se almacena en el apuntador al padre como unsigned
+ * int, por lo cual los nodos se deben ubicar por debajo de 4 GB. Los nodos
+ * son estaticos, y en un host de 64 bits el programa se enlaza sin PIE
+ * (BENCH_CFLAGS incluye -no-pie por defecto).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <generic_rbtree.h>
+
+/** @brief Numero de operaciones por defecto */
+#define TEST_DEFAULT_OPS 20000
+
+/** @brief Numero de nodos disponibles */
+#define TEST_NODES 512
+
+/** @brief Rango de las claves. Es menor que el numero de nodos para que el
+ * arbol tenga claves repetidas. */
+#define TEST_KEYS 200
+
+/** @brief Nodo de prueba */
+typedef struct test_node {
+	/** @brief Clave del nodo */
+	unsigned int key;
+	/** @brief 1 si el nodo se encuentra en el arbol */
+	int inserted;
+	DEFINE_GENERIC_RBTREE_LINKS(test_tree); /*Links genericos */
+}test_node_t;
+
+/** @brief Definicin de las primitivas para gestionar arboles de tipo
+ * test_node_t*/
+DEFINE_GENERIC_RBTREE_TYPE(test_node_t, test_tree);
+
+/** @brief Funcin para comparar dos nodos por su clave */
+int compare_test_tree(test_node_t * a, test_node_t * b) {
+	return (a->key > b->key) - (a->key < b->key);
+}
+
+/** @brief Funcin para comparar un nodo con una clave */
+int compare_key_test_tree(test_node_t * a, void * key) {
+	return (a->key > (unsigned int)key) - (a->key < (unsigned int)key);
+}
+
+/** @brief Implementacin de las primitivas para gestionar arboles de tipo
+ * test_node_t*/
+IMPLEMENT_GENERIC_RBTREE_TYPE(test_node_t, test_tree);
+
+/** @brief Nodos de prueba */
+static test_node_t nodes[TEST_NODES];
+
+/** @brief Estado del generador de numeros aleatorios */
+static unsigned int test_seed = 1;
+
+/**
+ * @brief Genera un numero pseudoaleatorio (generador congruencial lineal).
+ * @return Numero pseudoaleatorio de 31 bits
+ */
+static unsigned int test_rand(void) {
+	test_seed = test_seed * 1103515245 + 12345;
+	return (test_seed >> 1) & 0x7FFFFFFF;
+}
+
+/**
+ * @brief Verifica el arbol despues de una operacion.
+ * @param tree Arbol
+ * @param count Numero de nodos que deben estar en el arbol
+ * @return 0 si el arbol es valido, -1 en caso contrario
+ */
+static int verify_tree(tree_test_tree * tree, int count) {
+	test_node_t * n;
+	test_node_t * last;
+	test_node_t * expected;
+	unsigned int key;
+	int i;
+
+	if (tree_check_test_tree(tree) != count) {
+		printf("  tree_check fallo con %d nodos\n", count);
+		return -1;
+	}
+
+	/* Recorrido en orden */
+	i = 0;
+	last = 0;
+	for (n = tree_min_test_tree(tree); n != 0; n = tree_next_test_tree(n)) {
+		if (!n->inserted || (last != 0 && last->key > n->key)) {
+			printf("  tree_next retorno un nodo fuera de orden\n");
+			return -1;
+		}
+		last = n;
+		i++;
+	}
+	if (i != count || last != tree_max_test_tree(tree)) {
+		printf("  tree_next recorrio %d de %d nodos\n", i, count);
+		return -1;
+	}
+
+	/* Recorrido en orden inverso */
+	i = 0;
+	last = 0;
+	for (n = tree_max_test_tree(tree); n != 0; n = tree_prev_test_tree(n)) {
+		if (!n->inserted || (last != 0 && last->key < n->key)) {
+			printf("  tree_prev retorno un nodo fuera de orden\n");
+			return -1;
+		}
+		last = n;
+		i++;
+	}
+	if (i != count || last != tree_min_test_tree(tree)) {
+		printf("  tree_prev recorrio %d de %d nodos\n", i, count);
+		return -1;
+	}
+
+	/* lower_bound retorna el primero de los nodos con la menor clave que
+	 * no es menor que la buscada */
+	key = test_rand() % (TEST_KEYS + 1);
+	expected = 0;
+	for (i = 0; i < TEST_NODES; i++) {
+		if (nodes[i].inserted && nodes[i].key >= key &&
+				(expected == 0 || nodes[i].key < expected->key)) {
+			expected = &nodes[i];
+		}
+	}
+	n = tree_lower_bound_test_tree(tree, (void *)key);
+	if ((n == 0) != (expected == 0) ||
+			(n != 0 && n->key != expected->key) ||
+			(n != 0 && tree_prev_test_tree(n) != 0 &&
+					tree_prev_test_tree(n)->key >= key)) {
+		printf("  tree_lower_bound fallo con la clave %u\n", key);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char * argv[]) {
+	tree_test_tree tree;
+	test_node_t * n;
+	int ops;
+	int count;
+	int i;
+
+	ops = (argc > 1) ? atoi(argv[1]) : TEST_DEFAULT_OPS;
+	test_seed = (argc > 2) ? (unsigned int)atoi(argv[2]) : 1;
+
+	if (ops <= 0) {
+		fprintf(stderr, "uso: %s [operaciones] [semilla]\n", argv[0]);
+		return 1;
+	}
+
+	if ((unsigned long)&nodes[TEST_NODES] > (unsigned long)(unsigned int)-1) {
+		fprintf(stderr, "El arbol requiere direcciones de 32 bits; compile "
+				"con -no-pie o -m32\n");
+		return 1;
+	}
+
+	printf("RB tree test: %d operaciones, semilla %u\n", ops, test_seed);
+
+	init_tree_test_tree(&tree);
+	count = 0;
+
+	for (i = 0; i < ops; i++) {
+		n = &nodes[test_rand() % TEST_NODES];
+		if (n->inserted) {
+			if (tree_remove_test_tree(&tree, n) != n) {
+				printf("  tree_remove no retorno el nodo eliminado\n");
+				return 1;
+			}
+			n->inserted = 0;
+			count--;
+		}else {
+			n->key = test_rand() % TEST_KEYS;
+			if (tree_insert_test_tree(&tree, n) != n) {
+				printf("  tree_insert no retorno el nodo insertado\n");
+				return 1;
+			}
+			n->inserted = 1;
+			count++;
+		}
+		if (verify_tree(&tree, count) < 0) {
+			printf("Fallo en la operacion %d\n", i);
+			return 1;
+		}
+	}
+
+	printf("OK: %d nodos en el arbol al terminar\n", count);
+
+	return 0;
+}
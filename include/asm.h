@@ -76,4 +76,152 @@ static __inline__ void outw(unsigned short port, unsigned short data){
 	inline_assembly("outw %1,%0" : : "dN" (port), "a" (data));
 }
 
+/**
+ * @brief Lee el registro de control CR0.
+ * @return Valor de CR0
+ */
+static __inline__ unsigned int read_cr0(void) {
+	unsigned int value;
+	inline_assembly("mov %%cr0, %0" : "=r" (value));
+	return value;
+}
+
+/**
+ * @brief Escribe el registro de control CR0.
+ * @param value Nuevo valor de CR0
+ */
+static __inline__ void write_cr0(unsigned int value) {
+	inline_assembly("mov %0, %%cr0" : : "r" (value) : "memory");
+}
+
+/**
+ * @brief Lee el registro de control CR2, que contiene la direccion lineal
+ * que causo el ultimo fallo de pagina.
+ * @return Valor de CR2
+ */
+static __inline__ unsigned int read_cr2(void) {
+	unsigned int value;
+	inline_assembly("mov %%cr2, %0" : "=r" (value));
+	return value;
+}
+
+/**
+ * @brief Lee el registro de control CR3 (directorio de paginas actual).
+ * @return Valor de CR3
+ */
+static __inline__ unsigned int read_cr3(void) {
+	unsigned int value;
+	inline_assembly("mov %%cr3, %0" : "=r" (value));
+	return value;
+}
+
+/**
+ * @brief Escribe el registro de control CR3. Invalida las entradas de la TLB
+ * que no son globales.
+ * @param value Direccion fisica del directorio de paginas
+ */
+static __inline__ void write_cr3(unsigned int value) {
+	inline_assembly("mov %0, %%cr3" : : "r" (value) : "memory");
+}
+
+/**
+ * @brief Lee el registro de control CR4.
+ * @return Valor de CR4
+ */
+static __inline__ unsigned int read_cr4(void) {
+	unsigned int value;
+	inline_assembly("mov %%cr4, %0" : "=r" (value));
+	return value;
+}
+
+/**
+ * @brief Escribe el registro de control CR4.
+ * @param value Nuevo valor de CR4
+ */
+static __inline__ void write_cr4(unsigned int value) {
+	inline_assembly("mov %0, %%cr4" : : "r" (value) : "memory");
+}
+
+/**
+ * @brief Invalida la entrada de la TLB que corresponde a una direccion.
+ * @param addr Direccion lineal
+ */
+static __inline__ void invlpg(unsigned int addr) {
+	inline_assembly("invlpg (%0)" : : "r" (addr) : "memory");
+}
+
+/**
+ * @brief Ejecuta la instruccion cpuid.
+ * @param leaf Funcion solicitada (EAX)
+ * @param regs Arreglo en el cual se almacenan EAX, EBX, ECX y EDX
+ */
+static __inline__ void cpuid(unsigned int leaf, unsigned int regs[4]) {
+	inline_assembly("cpuid"
+			: "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+			: "a" (leaf), "c" (0));
+}
+
+/** @brief Bit IF de EFLAGS: las interrupciones se encuentran habilitadas */
+#define EFLAGS_IF 0x200
+
+/**
+ * @brief Deshabilita las interrupciones, y retorna el valor de EFLAGS antes
+ * de deshabilitarlas. Se usa junto con restore_interrupts() para proteger
+ * una seccion critica que se puede invocar con las interrupciones
+ * habilitadas o deshabilitadas.
+ * @return Valor anterior de EFLAGS
+ */
+static __inline__ unsigned int save_interrupts(void) {
+	unsigned int flags;
+	inline_assembly("pushfl; popl %0; cli" : "=r" (flags) : : "memory");
+	return flags;
+}
+
+/**
+ * @brief Habilita de nuevo las interrupciones, si se encontraban habilitadas
+ * al invocar save_interrupts().
+ * @param flags Valor de EFLAGS retornado por save_interrupts()
+ */
+static __inline__ void restore_interrupts(unsigned int flags) {
+	if (flags & EFLAGS_IF) {
+		inline_assembly("sti" : : : "memory");
+	}
+}
+
+/**
+ * @brief Compara e intercambia atomicamente un valor de 32 bits (lock
+ * cmpxchg).
+ * @param ptr Direccion del valor
+ * @param old Valor esperado
+ * @param value Nuevo valor, se almacena solo si *ptr es igual a old
+ * @return 1 si se almaceno el nuevo valor, 0 en caso contrario.
+ */
+static __inline__ int cmpxchg(volatile unsigned int * ptr, unsigned int old,
+		unsigned int value) {
+	unsigned char ok;
+	inline_assembly("lock; cmpxchgl %3, %1; sete %0"
+			: "=q" (ok), "+m" (*ptr), "+a" (old)
+			: "r" (value)
+			: "memory");
+	return ok;
+}
+
+/**
+ * @brief Compara e intercambia atomicamente un valor de 64 bits (lock
+ * cmpxchg8b). El valor debe estar alineado a 8 bytes.
+ * @param ptr Direccion del valor
+ * @param old Valor esperado
+ * @param value Nuevo valor, se almacena solo si *ptr es igual a old
+ * @return 1 si se almaceno el nuevo valor, 0 en caso contrario.
+ */
+static __inline__ int cmpxchg8b(volatile unsigned long long * ptr,
+		unsigned long long old, unsigned long long value) {
+	unsigned char ok;
+	inline_assembly("lock; cmpxchg8b %1; sete %0"
+			: "=q" (ok), "+m" (*ptr), "+A" (old)
+			: "b" ((unsigned int)value), "c" ((unsigned int)(value >> 32))
+			: "memory");
+	return ok;
+}
+
 #endif /* ASM_H_ */
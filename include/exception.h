@@ -27,4 +27,22 @@ typedef interrupt_handler exception_handler;
  */
 void setup_exceptions(void);
 
+/**
+ * @brief Esta rutina permite definir un nuevo manejador de excepcion
+ * para una de las excepciones de los procesadores x86.
+ * @param index Nmero de la excepcin a la cual se le desea instalar
+ * la rutina de manejo
+ * @param handler Funcin de manejo de la excepcin
+ * @return index si el manejador se instalo, -1 si la excepcion ya tenia
+ * un manejador.
+ */
+int install_exception_handler(unsigned char index, exception_handler handler);
+
+/**
+ * @brief Esta rutina permite quitar un  manejador de excepcion
+ * @param index Nmero de la excepcin a la cual se desea desinstalar
+ * su manejador
+ */
+void uninstall_exception_handler(unsigned char index);
+
 #endif /* EXCEPTION_H_ */
@@ -0,0 +1,124 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ *
+ * @brief Contiene los macros para definir una tabla hash de un tipo
+ * especifico, con el fin de ser instanciada con diferentes tipos de datos.
+ * @details
+ * La tabla es intrusiva: igual que en las listas genericas, el enlace se
+ * almacena dentro de cada elemento (DEFINE_GENERIC_HASH_LINKS), por lo cual
+ * insertar un elemento no requiere asignar memoria. Las colisiones se
+ * resuelven por encadenamiento, y el numero de cadenas es una potencia de 2.
+ *
+ * Para una tabla hash_name se deben implementar las funciones:
+ * - void * key_hash_name(element_type * n): clave del elemento.
+ * - unsigned int hash_key_hash_name(void * key): hash de una clave. El indice
+ *   de la cadena se toma de los bits mas significativos, por lo cual se puede
+ *   usar GENERIC_HASH_MIX.
+ * - int equals_key_hash_name(element_type * n, void * key): 0 si el elemento
+ *   tiene la clave.
+ * Igual que en los arboles genericos, las funciones se nombran por la tabla y
+ * no por el tipo, de forma que un tipo puede estar en varias tablas con
+ * claves diferentes sin chocar con las funciones de las listas.
+ */
+
+#ifndef GENERIC_HASH_TABLE_H_
+#define GENERIC_HASH_TABLE_H_
+
+/** @brief Hash multiplicativo (Fibonacci) de un valor de 32 bits. Los bits
+ * mas significativos del resultado dependen de todos los bits del valor. */
+#define GENERIC_HASH_MIX(value) ((unsigned int)(value) * 2654435761U)
+
+#define DEFINE_GENERIC_HASH_LINKS(hash_name)                                   \
+	void * hnext_##hash_name; /* Referencia al siguiente elemento de la cadena */
+
+/**  @brief Macro para generar el tipo de datos de una tabla hash con
+ * 2^bits cadenas, y los prototipos de las funciones */
+#define DEFINE_GENERIC_HASH_TYPE(element_type, hash_name, bits)                \
+typedef struct typehash_##hash_name {                                          \
+       element_type * buckets[1 << (bits)];                                    \
+       int count;                                                              \
+}hash_##hash_name;                                                             \
+                                                                               \
+void init_hash_##hash_name(hash_##hash_name * h);                              \
+                                                                               \
+element_type * hash_insert_##hash_name(hash_##hash_name * h,                   \
+                          element_type * n);                                   \
+                                                                               \
+element_type * hash_remove_##hash_name(hash_##hash_name * h,                   \
+                          element_type * n);                                   \
+                                                                               \
+element_type * hash_find_##hash_name(hash_##hash_name * h, void * key);
+
+/**  @brief Implementacin de prototipos de las funciones */
+#define IMPLEMENT_GENERIC_HASH_TYPE(element_type, hash_name)                   \
+static __inline__ element_type **                                              \
+       bucket_##hash_name(hash_##hash_name * h, void * key) {                  \
+       /* Numero de bits del indice, constante al compilar */                  \
+       unsigned int bits = __builtin_ctz(sizeof(h->buckets) /                  \
+                          sizeof(h->buckets[0]));                              \
+       if (bits == 0) return &h->buckets[0];                                   \
+       return &h->buckets[hash_key_##hash_name(key) >> (32 - bits)];           \
+}                                                                              \
+                                                                               \
+void init_hash_##hash_name(hash_##hash_name * h) {                             \
+       unsigned int i;                                                         \
+       for (i = 0; i < sizeof(h->buckets) / sizeof(h->buckets[0]); i++) {      \
+           h->buckets[i] = 0;                                                  \
+       }                                                                       \
+       h->count = 0;                                                           \
+}                                                                              \
+                                                                               \
+element_type *                                                                 \
+       hash_insert_##hash_name(hash_##hash_name * h,                           \
+                          element_type * n) {                                  \
+       element_type ** b;                                                      \
+                                                                               \
+       if (h == 0 || n == 0) return 0;                                         \
+                                                                               \
+       b = bucket_##hash_name(h, key_##hash_name(n));                          \
+       n->hnext_##hash_name = *b;                                              \
+       *b = n;                                                                 \
+       h->count++;                                                             \
+                                                                               \
+       return n;                                                               \
+}                                                                              \
+                                                                               \
+element_type *                                                                 \
+       hash_remove_##hash_name(hash_##hash_name * h,                           \
+                          element_type * n) {                                  \
+       element_type ** b;                                                      \
+                                                                               \
+       if (h == 0 || n == 0) return 0;                                         \
+                                                                               \
+       /* Buscar el enlace que apunta al elemento dentro de su cadena */       \
+       b = bucket_##hash_name(h, key_##hash_name(n));                          \
+       while (*b != 0 && *b != n) {                                            \
+           b = (element_type **)&(*b)->hnext_##hash_name;                      \
+       }                                                                       \
+                                                                               \
+       if (*b == 0) return 0;                                                  \
+                                                                               \
+       *b = n->hnext_##hash_name;                                              \
+       n->hnext_##hash_name = 0;                                               \
+       h->count--;                                                             \
+                                                                               \
+       return n;                                                               \
+}                                                                              \
+                                                                               \
+element_type * hash_find_##hash_name(hash_##hash_name * h, void * key) {       \
+       element_type * n;                                                       \
+                                                                               \
+       if (h == 0) return 0;                                                   \
+                                                                               \
+       n = *bucket_##hash_name(h, key);                                        \
+       while (n != 0 && equals_key_##hash_name(n, key) != 0) {                 \
+           n = n->hnext_##hash_name;                                           \
+       }                                                                       \
+                                                                               \
+       return n;                                                               \
+}
+
+#endif /* GENERIC_HASH_TABLE_H_ */
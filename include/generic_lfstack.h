@@ -0,0 +1,114 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ *
+ * @brief Contiene los macros para definir una pila sin bloqueos (LFSTACK)
+ * de un tipo especifico, con el fin de ser instanciada con diferentes tipos
+ * de datos.
+ * @details
+ * La pila usa los enlaces de las listas enlazadas simples
+ * (DEFINE_GENERIC_SLIST_LINKS) y las instrucciones atomicas de asm.h, por lo
+ * cual se puede usar desde un manejador de interrupcion sin deshabilitar las
+ * interrupciones.
+ */
+
+#ifndef GENERIC_LFSTACK_H_
+#define GENERIC_LFSTACK_H_
+
+#include <asm.h>
+#include <generic_linked_list.h>
+
+/**  @brief Macro para generar el tipo de datos de una pila sin bloqueos
+ * (pila de Treiber) y los prototipos de las funciones. Los elementos usan los
+ * enlaces de DEFINE_GENERIC_SLIST_LINKS. La cabeza contiene un contador que
+ * se incrementa en cada extraccion, y se actualiza junto con el apuntador
+ * mediante cmpxchg8b: si un elemento se extrae y se vuelve a insertar
+ * mientras otra CPU o una interrupcion intenta extraerlo, el contador evita
+ * que esta use un enlace obsoleto (problema ABA). */
+#define DEFINE_GENERIC_LFSTACK_TYPE(element_type, list_name)                   \
+typedef union typelfstack_##list_name {                                        \
+       struct {                                                                \
+          element_type * volatile head;                                        \
+          volatile unsigned int tag;                                           \
+       };                                                                      \
+       unsigned long long value;                                               \
+}__attribute__((aligned(8))) lfstack_##list_name;                              \
+                                                                               \
+void init_lfstack_##list_name(lfstack_##list_name * s);                        \
+                                                                               \
+element_type * lfstack_push_##list_name(lfstack_##list_name * s,               \
+                          element_type * n);                                   \
+                                                                               \
+element_type * lfstack_pop_##list_name(lfstack_##list_name * s);               \
+                                                                               \
+element_type * lfstack_pop_all_##list_name(lfstack_##list_name * s);
+
+/**  @brief Implementacin de prototipos de las funciones */
+#define IMPLEMENT_GENERIC_LFSTACK_TYPE(element_type, list_name)                \
+void init_lfstack_##list_name(lfstack_##list_name * s) {                       \
+     s->head = 0;                                                              \
+     s->tag = 0;                                                               \
+}                                                                              \
+                                                                               \
+element_type *                                                                 \
+       lfstack_push_##list_name(lfstack_##list_name * s,                       \
+                          element_type * n) {                                  \
+       element_type * old;                                                     \
+                                                                               \
+       if (s == 0 || n == 0) return 0;                                         \
+                                                                               \
+       /* Insertar no requiere el contador: solo cambia el apuntador */        \
+       do {                                                                    \
+          old = s->head;                                                       \
+          n->snext_##list_name = old;                                          \
+       } while (!cmpxchg((volatile unsigned int *)&s->head,                    \
+                          (unsigned int)old, (unsigned int)n));                \
+                                                                               \
+       return n;                                                               \
+}                                                                              \
+                                                                               \
+element_type *                                                                 \
+       lfstack_pop_##list_name(lfstack_##list_name * s) {                      \
+       lfstack_##list_name old, new;                                           \
+                                                                               \
+       if (s == 0) return 0;                                                   \
+                                                                               \
+       do {                                                                    \
+          /* Leer el contador antes que el apuntador: si cmpxchg8b             \
+           * encuentra el mismo contador, ninguna extraccion ocurrio           \
+           * desde entonces y el enlace leido sigue siendo valido */           \
+          old.tag = s->tag;                                                    \
+          __asm__ __volatile__("" : : : "memory");                             \
+          old.head = s->head;                                                  \
+          if (old.head == 0) return 0;                                         \
+          new.head = old.head->snext_##list_name;                              \
+          new.tag = old.tag + 1;                                               \
+       } while (!cmpxchg8b((volatile unsigned long long *)&s->value,           \
+                          old.value, new.value));                              \
+                                                                               \
+       return old.head;                                                        \
+}                                                                              \
+                                                                               \
+element_type *                                                                 \
+       lfstack_pop_all_##list_name(lfstack_##list_name * s) {                  \
+       lfstack_##list_name old, new;                                           \
+                                                                               \
+       if (s == 0) return 0;                                                   \
+                                                                               \
+       /* Extraer todos los elementos como una lista enlazada simple */        \
+       do {                                                                    \
+          old.tag = s->tag;                                                    \
+          __asm__ __volatile__("" : : : "memory");                             \
+          old.head = s->head;                                                  \
+          if (old.head == 0) return 0;                                         \
+          new.head = 0;                                                        \
+          new.tag = old.tag + 1;                                               \
+       } while (!cmpxchg8b((volatile unsigned long long *)&s->value,           \
+                          old.value, new.value));                              \
+                                                                               \
+       return old.head;                                                        \
+}
+
+#endif /* GENERIC_LFSTACK_H_ */
@@ -5,7 +5,10 @@
  * @copyright GNU Public License. 
  *
  * @brief Contiene el macro para definir una lista de un tipo especifico,
- * con el fin de ser instanciado con diferentes tipos de datos.
+ * con el fin de ser instanciado con diferentes tipos de datos. Tambien
+ * contiene la variante de lista enlazada simple (SLIST), para listas que solo
+ * se usan como pilas. La pila sin bloqueos (LFSTACK) se encuentra en
+ * generic_lfstack.h.
  */
 
 #ifndef GENERIC_LINKED_LIST_H_
@@ -254,7 +257,7 @@ element_type * find_##list_name(list_##list_name * l,  void * value) {         \
                                                                                \
      while (h != 0 && t != 0) {                                                \
          if (equals_##element_type(h, value) == 0) {return h; }                \
-         if (equals_##element_type(h, value) == 0) {return t;}                 \
+         if (equals_##element_type(t, value) == 0) {return t;}                 \
                                                                                \
          if (h == t) {return 0;}                                               \
                                                                                \
@@ -263,4 +266,61 @@ element_type * find_##list_name(list_##list_name * l,  void * value) {         \
      }                                                                         \
      return 0;                                                                 \
 }
+
+#define DEFINE_GENERIC_SLIST_LINKS(list_name)                                  \
+	void * snext_##list_name; /* Referencia al siguiente elemento */
+
+/**  @brief Macro para generar los tipos de datos de una lista enlazada simple
+ * y los prototipos de las funciones. Solo permite insertar y extraer en la
+ * cabeza de la lista (LIFO), con un enlace por elemento. */
+#define DEFINE_GENERIC_SLIST_TYPE(element_type, list_name)                     \
+typedef struct typeslist_##list_name {                                         \
+       element_type *head;                                                     \
+}slist_##list_name;                                                            \
+                                                                               \
+void init_slist_##list_name(slist_##list_name * l);                            \
+                                                                               \
+element_type * slist_push_##list_name(slist_##list_name * l,                   \
+                          element_type * n);                                   \
+                                                                               \
+element_type * slist_pop_##list_name(slist_##list_name * l);                   \
+                                                                               \
+element_type * slist_front_##list_name(slist_##list_name * l);
+
+/**  @brief Implementacin de prototipos de las funciones */
+#define IMPLEMENT_GENERIC_SLIST_TYPE(element_type, list_name)                  \
+void init_slist_##list_name(slist_##list_name * l) {                           \
+     l->head = 0;                                                              \
+}                                                                              \
+                                                                               \
+element_type *                                                                 \
+       slist_push_##list_name(slist_##list_name * l,                           \
+                          element_type * n) {                                  \
+       if (l == 0) return 0;                                                   \
+                                                                               \
+       n->snext_##list_name = l->head;                                         \
+       l->head = n;                                                            \
+                                                                               \
+       return n;                                                               \
+}                                                                              \
+                                                                               \
+element_type *                                                                 \
+       slist_pop_##list_name(slist_##list_name * l) {                          \
+       element_type *ret;                                                      \
+                                                                               \
+       if (l == 0) return 0;                                                   \
+                                                                               \
+       ret = l->head;                                                          \
+       if (ret != 0) {                                                         \
+          l->head = ret->snext_##list_name;                                    \
+       }                                                                       \
+                                                                               \
+       return ret;                                                             \
+}                                                                              \
+                                                                               \
+element_type *                                                                 \
+       slist_front_##list_name(slist_##list_name * l) {                        \
+       if (l == 0) return 0;                                                   \
+       return l->head;                                                         \
+}
 #endif /* GENERIC_LINKED_LIST_H_ */
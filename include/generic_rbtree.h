@@ -0,0 +1,418 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ *
+ * @brief Contiene los macros para definir un arbol rojo-negro de un tipo
+ * especifico, con el fin de ser instanciado con diferentes tipos de datos.
+ * @details
+ * El arbol es intrusivo: igual que en las listas genericas, los enlaces se
+ * almacenan dentro de cada elemento (DEFINE_GENERIC_RBTREE_LINKS), por lo
+ * cual insertar un elemento no requiere asignar memoria. El color del nodo
+ * se almacena en el bit 0 del apuntador al padre, por lo cual los elementos
+ * deben estar alineados al menos a 2 bytes.
+ *
+ * Un mismo tipo puede pertenecer a varios arboles con diferente orden. Para
+ * un arbol tree_name de elementos de tipo element_type se deben implementar
+ * las funciones:
+ * - int compare_tree_name(element_type * a, element_type * b): valor
+ *   negativo si a va antes que b, 0 si son iguales, positivo si a va
+ *   despues que b. Los elementos iguales se insertan despues de los
+ *   existentes.
+ * - int compare_key_tree_name(element_type * n, void * key): igual que la
+ *   anterior, comparando un elemento con una clave. La usa lower_bound.
+ */
+
+#ifndef GENERIC_RBTREE_H_
+#define GENERIC_RBTREE_H_
+
+#define DEFINE_GENERIC_RBTREE_LINKS(tree_name)                                 \
+	void * left_##tree_name; /* Subarbol de elementos menores */           \
+	void * right_##tree_name; /* Subarbol de elementos mayores */          \
+	unsigned int parent_##tree_name; /* Padre, bit 0: 1 = nodo rojo */
+
+/**  @brief Macro para generar el tipo de datos de un arbol y los prototipos
+ * de las funciones */
+#define DEFINE_GENERIC_RBTREE_TYPE(element_type, tree_name)                    \
+typedef struct typetree_##tree_name {                                          \
+       element_type * root;                                                    \
+       int count;                                                              \
+}tree_##tree_name;                                                             \
+                                                                               \
+void init_tree_##tree_name(tree_##tree_name * t);                              \
+                                                                               \
+element_type * tree_insert_##tree_name(tree_##tree_name * t,                   \
+                          element_type * n);                                   \
+                                                                               \
+element_type * tree_remove_##tree_name(tree_##tree_name * t,                   \
+                          element_type * n);                                   \
+                                                                               \
+element_type * tree_lower_bound_##tree_name(tree_##tree_name * t,              \
+                          void * key);                                         \
+                                                                               \
+element_type * tree_min_##tree_name(tree_##tree_name * t);                     \
+                                                                               \
+element_type * tree_max_##tree_name(tree_##tree_name * t);                     \
+                                                                               \
+element_type * tree_next_##tree_name(element_type * n);                        \
+                                                                               \
+element_type * tree_prev_##tree_name(element_type * n);                        \
+                                                                               \
+int tree_check_##tree_name(tree_##tree_name * t);
+
+/**  @brief Implementacin de prototipos de las funciones */
+#define IMPLEMENT_GENERIC_RBTREE_TYPE(element_type, tree_name)                 \
+static __inline__ element_type * rb_parent_##tree_name(element_type * n) {     \
+       return (element_type *)(n->parent_##tree_name & ~1U);                   \
+}                                                                              \
+                                                                               \
+static __inline__ int rb_red_##tree_name(element_type * n) {                   \
+       return n != 0 && (n->parent_##tree_name & 1U);                          \
+}                                                                              \
+                                                                               \
+static __inline__ void rb_set_parent_##tree_name(element_type * n,             \
+                          element_type * p) {                                  \
+       n->parent_##tree_name = (unsigned int)p |                               \
+                          (n->parent_##tree_name & 1U);                        \
+}                                                                              \
+                                                                               \
+static __inline__ void rb_set_red_##tree_name(element_type * n, int red) {     \
+       n->parent_##tree_name = (n->parent_##tree_name & ~1U) |                 \
+                          (red ? 1U : 0U);                                     \
+}                                                                              \
+                                                                               \
+/* Reemplaza el hijo old de parent (o la raiz) por n */                        \
+static __inline__ void rb_replace_##tree_name(tree_##tree_name * t,            \
+                          element_type * parent, element_type * old,           \
+                          element_type * n) {                                  \
+       if (parent == 0) {                                                      \
+          t->root = n;                                                         \
+       }else if (parent->left_##tree_name == old) {                            \
+          parent->left_##tree_name = n;                                        \
+       }else {                                                                 \
+          parent->right_##tree_name = n;                                       \
+       }                                                                       \
+}                                                                              \
+                                                                               \
+static void rb_rotate_left_##tree_name(tree_##tree_name * t,                   \
+                          element_type * x) {                                  \
+       element_type * y = x->right_##tree_name;                                \
+                                                                               \
+       x->right_##tree_name = y->left_##tree_name;                             \
+       if (y->left_##tree_name != 0) {                                         \
+          rb_set_parent_##tree_name(y->left_##tree_name, x);                   \
+       }                                                                       \
+       rb_set_parent_##tree_name(y, rb_parent_##tree_name(x));                 \
+       rb_replace_##tree_name(t, rb_parent_##tree_name(x), x, y);              \
+       y->left_##tree_name = x;                                                \
+       rb_set_parent_##tree_name(x, y);                                        \
+}                                                                              \
+                                                                               \
+static void rb_rotate_right_##tree_name(tree_##tree_name * t,                  \
+                          element_type * x) {                                  \
+       element_type * y = x->left_##tree_name;                                 \
+                                                                               \
+       x->left_##tree_name = y->right_##tree_name;                             \
+       if (y->right_##tree_name != 0) {                                        \
+          rb_set_parent_##tree_name(y->right_##tree_name, x);                  \
+       }                                                                       \
+       rb_set_parent_##tree_name(y, rb_parent_##tree_name(x));                 \
+       rb_replace_##tree_name(t, rb_parent_##tree_name(x), x, y);              \
+       y->right_##tree_name = x;                                               \
+       rb_set_parent_##tree_name(x, y);                                        \
+}                                                                              \
+                                                                               \
+void init_tree_##tree_name(tree_##tree_name * t) {                             \
+       t->root = 0;                                                            \
+       t->count = 0;                                                           \
+}                                                                              \
+                                                                               \
+element_type *                                                                 \
+       tree_insert_##tree_name(tree_##tree_name * t,                           \
+                          element_type * n) {                                  \
+       element_type ** link;                                                   \
+       element_type * p, * g, * u, * inserted;                                 \
+                                                                               \
+       if (t == 0 || n == 0) return 0;                                         \
+                                                                               \
+       /* Insertar como hoja roja */                                           \
+       p = 0;                                                                  \
+       link = &t->root;                                                        \
+       while (*link != 0) {                                                    \
+          p = *link;                                                           \
+          if (compare_##tree_name(n, p) < 0) {                                 \
+             link = (element_type **)&p->left_##tree_name;                     \
+          }else {                                                              \
+             link = (element_type **)&p->right_##tree_name;                    \
+          }                                                                    \
+       }                                                                       \
+       n->left_##tree_name = 0;                                                \
+       n->right_##tree_name = 0;                                               \
+       n->parent_##tree_name = (unsigned int)p | 1U;                           \
+       *link = n;                                                              \
+       t->count++;                                                             \
+       inserted = n;                                                           \
+                                                                               \
+       /* Restablecer las propiedades: un nodo rojo no tiene hijos rojos */    \
+       while ((p = rb_parent_##tree_name(n)) != 0 &&                           \
+                          rb_red_##tree_name(p)) {                             \
+          g = rb_parent_##tree_name(p);                                        \
+          if (p == g->left_##tree_name) {                                      \
+             u = g->right_##tree_name;                                         \
+             if (rb_red_##tree_name(u)) {                                      \
+                rb_set_red_##tree_name(p, 0);                                  \
+                rb_set_red_##tree_name(u, 0);                                  \
+                rb_set_red_##tree_name(g, 1);                                  \
+                n = g;                                                         \
+                continue;                                                      \
+             }                                                                 \
+             if (n == p->right_##tree_name) {                                  \
+                rb_rotate_left_##tree_name(t, p);                              \
+                n = p;                                                         \
+                p = rb_parent_##tree_name(n);                                  \
+             }                                                                 \
+             rb_set_red_##tree_name(p, 0);                                     \
+             rb_set_red_##tree_name(g, 1);                                     \
+             rb_rotate_right_##tree_name(t, g);                                \
+          }else {                                                              \
+             u = g->left_##tree_name;                                          \
+             if (rb_red_##tree_name(u)) {                                      \
+                rb_set_red_##tree_name(p, 0);                                  \
+                rb_set_red_##tree_name(u, 0);                                  \
+                rb_set_red_##tree_name(g, 1);                                  \
+                n = g;                                                         \
+                continue;                                                      \
+             }                                                                 \
+             if (n == p->left_##tree_name) {                                   \
+                rb_rotate_right_##tree_name(t, p);                             \
+                n = p;                                                         \
+                p = rb_parent_##tree_name(n);                                  \
+             }                                                                 \
+             rb_set_red_##tree_name(p, 0);                                     \
+             rb_set_red_##tree_name(g, 1);                                     \
+             rb_rotate_left_##tree_name(t, g);                                 \
+          }                                                                    \
+       }                                                                       \
+       rb_set_red_##tree_name(t->root, 0);                                     \
+                                                                               \
+       return inserted;                                                        \
+}                                                                              \
+                                                                               \
+element_type *                                                                 \
+       tree_remove_##tree_name(tree_##tree_name * t,                           \
+                          element_type * z) {                                  \
+       element_type * y, * x, * p, * w;                                        \
+       int black;                                                              \
+                                                                               \
+       if (t == 0 || z == 0) return 0;                                         \
+                                                                               \
+       /* y es el nodo que se desconecta: z, o su sucesor si z tiene dos       \
+        * hijos. x ocupa la posicion de y, y p es el padre de x. */            \
+       y = z;                                                                  \
+       if (z->left_##tree_name != 0 && z->right_##tree_name != 0) {            \
+          y = z->right_##tree_name;                                            \
+          while (y->left_##tree_name != 0) {                                   \
+             y = y->left_##tree_name;                                          \
+          }                                                                    \
+       }                                                                       \
+       x = (y->left_##tree_name != 0) ? y->left_##tree_name :                  \
+                          y->right_##tree_name;                                \
+       p = rb_parent_##tree_name(y);                                           \
+       black = !rb_red_##tree_name(y);                                         \
+       if (x != 0) {                                                           \
+          rb_set_parent_##tree_name(x, p);                                     \
+       }                                                                       \
+       rb_replace_##tree_name(t, p, y, x);                                     \
+                                                                               \
+       /* El sucesor toma la posicion y el color de z */                       \
+       if (y != z) {                                                           \
+          if (p == z) {                                                        \
+             p = y;                                                            \
+          }                                                                    \
+          y->left_##tree_name = z->left_##tree_name;                           \
+          y->right_##tree_name = z->right_##tree_name;                         \
+          y->parent_##tree_name = z->parent_##tree_name;                       \
+          if (y->left_##tree_name != 0) {                                      \
+             rb_set_parent_##tree_name(y->left_##tree_name, y);                \
+          }                                                                    \
+          if (y->right_##tree_name != 0) {                                     \
+             rb_set_parent_##tree_name(y->right_##tree_name, y);               \
+          }                                                                    \
+          rb_replace_##tree_name(t, rb_parent_##tree_name(z), z, y);           \
+       }                                                                       \
+                                                                               \
+       /* Si se desconecto un nodo negro, x tiene un negro de menos */         \
+       while (black && x != t->root && !rb_red_##tree_name(x)) {               \
+          if (x == p->left_##tree_name) {                                      \
+             w = p->right_##tree_name;                                         \
+             if (rb_red_##tree_name(w)) {                                      \
+                rb_set_red_##tree_name(w, 0);                                  \
+                rb_set_red_##tree_name(p, 1);                                  \
+                rb_rotate_left_##tree_name(t, p);                              \
+                w = p->right_##tree_name;                                      \
+             }                                                                 \
+             if (!rb_red_##tree_name(w->left_##tree_name) &&                   \
+                          !rb_red_##tree_name(w->right_##tree_name)) {         \
+                rb_set_red_##tree_name(w, 1);                                  \
+                x = p;                                                         \
+                p = rb_parent_##tree_name(x);                                  \
+                continue;                                                      \
+             }                                                                 \
+             if (!rb_red_##tree_name(w->right_##tree_name)) {                  \
+                rb_set_red_##tree_name(w->left_##tree_name, 0);                \
+                rb_set_red_##tree_name(w, 1);                                  \
+                rb_rotate_right_##tree_name(t, w);                             \
+                w = p->right_##tree_name;                                      \
+             }                                                                 \
+             rb_set_red_##tree_name(w, rb_red_##tree_name(p));                 \
+             rb_set_red_##tree_name(p, 0);                                     \
+             rb_set_red_##tree_name(w->right_##tree_name, 0);                  \
+             rb_rotate_left_##tree_name(t, p);                                 \
+          }else {                                                              \
+             w = p->left_##tree_name;                                          \
+             if (rb_red_##tree_name(w)) {                                      \
+                rb_set_red_##tree_name(w, 0);                                  \
+                rb_set_red_##tree_name(p, 1);                                  \
+                rb_rotate_right_##tree_name(t, p);                             \
+                w = p->left_##tree_name;                                       \
+             }                                                                 \
+             if (!rb_red_##tree_name(w->left_##tree_name) &&                   \
+                          !rb_red_##tree_name(w->right_##tree_name)) {         \
+                rb_set_red_##tree_name(w, 1);                                  \
+                x = p;                                                         \
+                p = rb_parent_##tree_name(x);                                  \
+                continue;                                                      \
+             }                                                                 \
+             if (!rb_red_##tree_name(w->left_##tree_name)) {                   \
+                rb_set_red_##tree_name(w->right_##tree_name, 0);               \
+                rb_set_red_##tree_name(w, 1);                                  \
+                rb_rotate_left_##tree_name(t, w);                              \
+                w = p->left_##tree_name;                                       \
+             }                                                                 \
+             rb_set_red_##tree_name(w, rb_red_##tree_name(p));                 \
+             rb_set_red_##tree_name(p, 0);                                     \
+             rb_set_red_##tree_name(w->left_##tree_name, 0);                   \
+             rb_rotate_right_##tree_name(t, p);                                \
+          }                                                                    \
+          x = t->root;                                                         \
+       }                                                                       \
+       if (x != 0) {                                                           \
+          rb_set_red_##tree_name(x, 0);                                        \
+       }                                                                       \
+                                                                               \
+       z->left_##tree_name = 0;                                                \
+       z->right_##tree_name = 0;                                               \
+       z->parent_##tree_name = 0;                                              \
+       t->count--;                                                             \
+                                                                               \
+       return z;                                                               \
+}                                                                              \
+                                                                               \
+element_type *                                                                 \
+       tree_lower_bound_##tree_name(tree_##tree_name * t, void * key) {        \
+       element_type * n, * best;                                               \
+                                                                               \
+       if (t == 0) return 0;                                                   \
+                                                                               \
+       /* Primer elemento que no es menor que la clave */                      \
+       best = 0;                                                               \
+       n = t->root;                                                            \
+       while (n != 0) {                                                        \
+          if (compare_key_##tree_name(n, key) >= 0) {                          \
+             best = n;                                                         \
+             n = n->left_##tree_name;                                          \
+          }else {                                                              \
+             n = n->right_##tree_name;                                         \
+          }                                                                    \
+       }                                                                       \
+       return best;                                                            \
+}                                                                              \
+                                                                               \
+element_type * tree_min_##tree_name(tree_##tree_name * t) {                    \
+       element_type * n;                                                       \
+                                                                               \
+       if (t == 0 || t->root == 0) return 0;                                   \
+       for (n = t->root; n->left_##tree_name != 0;                             \
+                          n = n->left_##tree_name);                            \
+       return n;                                                               \
+}                                                                              \
+                                                                               \
+element_type * tree_max_##tree_name(tree_##tree_name * t) {                    \
+       element_type * n;                                                       \
+                                                                               \
+       if (t == 0 || t->root == 0) return 0;                                   \
+       for (n = t->root; n->right_##tree_name != 0;                            \
+                          n = n->right_##tree_name);                           \
+       return n;                                                               \
+}                                                                              \
+                                                                               \
+element_type * tree_next_##tree_name(element_type * n) {                       \
+       element_type * p;                                                       \
+                                                                               \
+       if (n == 0) return 0;                                                   \
+       if (n->right_##tree_name != 0) {                                        \
+          for (n = n->right_##tree_name; n->left_##tree_name != 0;             \
+                          n = n->left_##tree_name);                            \
+          return n;                                                            \
+       }                                                                       \
+       while ((p = rb_parent_##tree_name(n)) != 0 &&                           \
+                          n == p->right_##tree_name) {                         \
+          n = p;                                                               \
+       }                                                                       \
+       return p;                                                               \
+}                                                                              \
+                                                                               \
+element_type * tree_prev_##tree_name(element_type * n) {                       \
+       element_type * p;                                                       \
+                                                                               \
+       if (n == 0) return 0;                                                   \
+       if (n->left_##tree_name != 0) {                                         \
+          for (n = n->left_##tree_name; n->right_##tree_name != 0;             \
+                          n = n->right_##tree_name);                           \
+          return n;                                                            \
+       }                                                                       \
+       while ((p = rb_parent_##tree_name(n)) != 0 &&                           \
+                          n == p->left_##tree_name) {                          \
+          n = p;                                                               \
+       }                                                                       \
+       return p;                                                               \
+}                                                                              \
+                                                                               \
+/* Verifica un subarbol. Retorna su altura negra, -1 si no es valido */        \
+static int rb_check_##tree_name(element_type * n, element_type * parent,       \
+                          int * count, int limit) {                            \
+       int l, r;                                                               \
+                                                                               \
+       if (n == 0) return 1;                                                   \
+       if (++(*count) > limit || rb_parent_##tree_name(n) != parent) {         \
+          return -1;                                                           \
+       }                                                                       \
+       if (rb_red_##tree_name(n) && (rb_red_##tree_name(parent) ||             \
+                          parent == 0)) {                                      \
+          return -1;                                                           \
+       }                                                                       \
+       if ((n->left_##tree_name != 0 &&                                        \
+                          compare_##tree_name(n->left_##tree_name, n) > 0) ||  \
+                          (n->right_##tree_name != 0 &&                        \
+                          compare_##tree_name(n->right_##tree_name, n) < 0)) { \
+          return -1;                                                           \
+       }                                                                       \
+       l = rb_check_##tree_name(n->left_##tree_name, n, count, limit);         \
+       r = rb_check_##tree_name(n->right_##tree_name, n, count, limit);        \
+       if (l < 0 || l != r) return -1;                                         \
+       return l + !rb_red_##tree_name(n);                                      \
+}                                                                              \
+                                                                               \
+int tree_check_##tree_name(tree_##tree_name * t) {                             \
+       int count = 0;                                                          \
+                                                                               \
+       if (t == 0) return -1;                                                  \
+       if (rb_check_##tree_name(t->root, 0, &count, t->count) < 0 ||           \
+                          count != t->count) {                                 \
+          return -1;                                                           \
+       }                                                                       \
+       return count;                                                           \
+}
+
+#endif /* GENERIC_RBTREE_H_ */
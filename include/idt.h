@@ -58,6 +58,10 @@ extern unsigned int isr_table[];
 /** @brief Referencia a la tabla de descriptores de interrupcion */
 extern idt_descriptor idt[];
 
+/** @brief Numero de manejadores de interrupcion en ejecucion (idt.c). Es 0
+ * cuando el procesador no se encuentra atendiendo una interrupcion. */
+extern unsigned int interrupt_nesting;
+
 /** @brief Estructura que define el estado del procesador al recibir una
  * interrupcin o una excepcin.
  * @details Al recibir una interrupcin, el procesador automticamente almacena
@@ -156,4 +160,20 @@ static __inline__ idt_descriptor idt_descriptor_32(unsigned int selector,
  * */
 void setup_idt(void);
 
+/**
+ * @brief Instala un nuevo manejador de interrupcin para un nmero de
+ * interrupcin determinado.
+ * @param index Nmero de interrupcin para la cual se desea instalar el
+ * manejador
+ * @param handler Funcin para el manejo de la interrupcin.
+ */
+void install_interrupt_handler(unsigned char index, interrupt_handler handler);
+
+/**
+ * @brief Desinstala un manejador de interrupcin
+ * @param index Nmero de la interrupcin para la cual se va a desinstalar
+ * el manejador
+ */
+void uninstall_interrupt_handler(unsigned char index);
+
 #endif /* IDT_H_ */
@@ -12,6 +12,7 @@
 #define MM_H_
 
 #include <generic_linked_list.h>
+#include <generic_rbtree.h>
 
 /** @brief Limite inferior de regiones de memoria libres. Por encima de este
  * valor la pila se contrae cuando se divide la region libre que se
@@ -26,18 +27,102 @@
 multiplo de MEMREG_GRANULARITY  */
 #define AVG_ALLOC_SIZE 0x100 
 
+/** @brief Numero de clases de tamao de las listas segregadas de regiones
+ * libres. La clase i contiene las regiones libres cuyo tamao se encuentra en
+ * el rango [MEMREG_GRANULARITY * 2^i, MEMREG_GRANULARITY * 2^(i+1)). */
+#define HEAP_SIZE_CLASSES 10
+
+/** @brief Tamao a partir del cual las regiones libres no pertenecen a una
+ * clase de tamao, y se almacenan en la lista general del heap (4 KB). */
+#define HEAP_CLASS_LIMIT (MEMREG_GRANULARITY << HEAP_SIZE_CLASSES)
+
+/** @brief Politica de asignacion de primer ajuste: las regiones libres se
+ * almacenan en las listas segregadas por clase de tamao y en la lista
+ * general del heap. */
+#define HEAP_FIRST_FIT 0
+
+/** @brief Politica de asignacion de mejor ajuste: las regiones libres se
+ * almacenan en un arbol rojo-negro ordenado por (tamao, direccion), el cual
+ * permite encontrar la region libre mas pequea que satisface una solicitud
+ * en O(log n). */
+#define HEAP_BEST_FIT 1
+
+/** @brief Politica de asignacion usada por setup_heap(). Se puede
+ * seleccionar al compilar, por ejemplo con -DHEAP_DEFAULT_POLICY=HEAP_BEST_FIT */
+#ifndef HEAP_DEFAULT_POLICY
+#define HEAP_DEFAULT_POLICY HEAP_FIRST_FIT
+#endif
+
+/** @brief Tamao minimo de la ultima region libre de un heap para devolver
+ * su espacio mediante la rutina shrink del heap al liberar memoria (64 KB) */
+#define HEAP_TRIM_SIZE 0x10000
+
+/** @brief Numero de quick-lists de un heap. La quick-list i contiene
+ * regiones liberadas cuyo area de datos tiene exactamente
+ * MEMREG_MIN_LIMIT + i * MEMREG_GRANULARITY bytes. Maximo 32, ya que se
+ * usa un mapa de bits de 32 bits. */
+#define HEAP_QUICK_LISTS 32
+
+/** @brief Limite de bytes en las quick-lists usado por create_heap(). 0
+ * indica que las regiones se fusionan al liberarlas. Se puede seleccionar al
+ * compilar, por ejemplo con -DHEAP_DEFAULT_QUICK_BUDGET=0x4000 */
+#ifndef HEAP_DEFAULT_QUICK_BUDGET
+#define HEAP_DEFAULT_QUICK_BUDGET 0
+#endif
+
 /* Estructuras de datos para gestionar la memoria disponible */
 struct memreg_header;
 
-/** @brief Encabezado de una region de memoria */
+/** @brief Indicador de region asignada, almacenado en los bits menos
+ * significativos del tamao de la region */
+#define MEMREG_USED 0x1
+
+/** @brief Indicador de region anterior asignada. Permite fusionar una region
+ * con la region anterior sin que las regiones asignadas tengan pie. */
+#define MEMREG_PREV_USED 0x2
+
+/** @brief Mascara de los indicadores almacenados en el tamao de la region */
+#define MEMREG_FLAGS (MEMREG_GRANULARITY - 1)
+
+/** @brief Indicador de region retenida en una cache (una quick-list del
+ * heap o un magazine de kmalloc). Estas regiones permanecen marcadas como
+ * asignadas, y este indicador permite rechazar su doble liberacion. Los bits
+ * menos significativos del tamao ya se encuentran ocupados, por lo cual se
+ * usa el bit mas significativo: una region no puede tener 2 GB o mas. */
+#define MEMREG_CACHED 0x80000000
+
+/** @brief Encabezado de una region de memoria.
+ * @details
+ * Una region asignada solo contiene la palabra de tamao, seguida del area
+ * de datos. Una region libre contiene ademas los enlaces de la lista o del
+ * arbol de regiones libres al inicio del area de datos, y un pie al final
+ * del area de datos. Por esta razon el area de datos de una region tiene un
+ * tamao minimo de MEMREG_MIN_LIMIT bytes.
+ *
+ * El inicio del area de datos siempre es el encabezado + MEMREG_HEADER_SIZE.
+ */
 typedef struct memreg_header {
-	/** @brief Inicio del rea de datos */
-	unsigned int base;
-	/** @brief Tamao de la region de memoria */
-	unsigned int limit;
-	/** @brief 1 = region asignada, 0 = region libre */
-	int used;
-	DEFINE_GENERIC_LIST_LINKS(memreg_header); /*Links genericos */
+	/** @brief Tamao del area de datos de la region, multiplo de
+	 * MEMREG_GRANULARITY. Los bits menos significativos contienen los
+	 * indicadores MEMREG_USED y MEMREG_PREV_USED */
+	unsigned int size;
+	/* Una region libre se encuentra en una lista o en el arbol de regiones
+	 * libres, de acuerdo con la politica del heap. Estos campos solo son
+	 * validos mientras la region esta libre. */
+	union {
+		struct {
+			DEFINE_GENERIC_LIST_LINKS(memreg_header); /*Links genericos */
+		};
+		/** @brief Nodo del arbol de regiones libres (HEAP_BEST_FIT) */
+		struct {
+			DEFINE_GENERIC_RBTREE_LINKS(memreg_tree); /*Links genericos */
+		};
+		/** @brief Enlace de las quick-lists. La region se encuentra marcada
+		 * como asignada mientras permanece en una quick-list. */
+		struct {
+			DEFINE_GENERIC_SLIST_LINKS(memreg_quick); /*Links genericos */
+		};
+	};
 }memreg_header_t;
 
 /** @brief Definicin de las primitivas para gestionar listas de tipo
@@ -47,10 +132,25 @@ DEFINE_GENERIC_LIST_TYPE(memreg_header_t, memreg_header);
 /**  @brief Funcin para comparar dos regiones de memoria */
 int compare_memreg_header_t(memreg_header_t * , memreg_header_t *);
 
-/** @brief Pie de una region de memoria*/
+/** @brief Definicin de las primitivas para gestionar las quick-lists,
+ * listas enlazadas simples de tipo memreg_header_t */
+DEFINE_GENERIC_SLIST_TYPE(memreg_header_t, memreg_quick);
+
+/** @brief Definicin de las primitivas para gestionar arboles de tipo
+ * memreg_header_t, ordenados por (tamao, direccion) */
+DEFINE_GENERIC_RBTREE_TYPE(memreg_header_t, memreg_tree);
+
+/** @brief Funcin para comparar dos regiones libres en el arbol de regiones
+ * libres */
+int compare_memreg_tree(memreg_header_t *, memreg_header_t *);
+
+/** @brief Funcin para comparar una region libre con un tamao en el arbol
+ * de regiones libres */
+int compare_key_memreg_tree(memreg_header_t *, void *);
+
+/** @brief Pie de una region de memoria libre. Se ubica en los ultimos bytes
+ * del area de datos de la region. */
 typedef struct memreg_footer {
-	/** @brief Inicio del area de datos */
-	unsigned int base;
 	/** @brief Apuntador al encabezado */
 	memreg_header_t * header;
 }memreg_footer_t;
@@ -65,6 +165,18 @@ typedef struct memreg_header_list {
 	int count;
 } memreg_header_list_t;
 
+struct heap;
+
+/** @brief Rutina que extiende el espacio disponible de un heap. Debe
+ * aumentar heap->limit en al menos size bytes, con memoria contigua al final
+ * del heap.
+ * @return 1 si el heap se extendio, 0 en caso contrario. */
+typedef int (*heap_grow_t)(struct heap * heap, unsigned int size);
+
+/** @brief Rutina que libera el espacio de un heap que se encuentra por
+ * encima de heap->top, y actualiza heap->limit. */
+typedef void (*heap_shrink_t)(struct heap * heap);
+
 /** @brief Tipo para la gestin de memoria dinmica
  * Para gestionar la memoria  se requiere conocer la direccin de inicio de la
  * region para asignacion dinamica, su tamao, y las listas de regiones
@@ -73,36 +185,166 @@ typedef struct memreg_header_list {
 typedef struct heap {
 	/** @brief Inicio de la region de memoria para asignacion dinamica */
 	unsigned int base;
-	/** @brief Posicin actual del heap */
+	/** @brief Posicin actual del heap. En esta posicion se encuentra la
+	 * palabra final del heap, un encabezado de tamao 0 marcado como asignado
+	 * cuyo indicador MEMREG_PREV_USED describe la ultima region. */
 	unsigned int top;
 	/** @brief Tamanio maximo de la region de memoria para asignacion dinamica*/
 	unsigned int limit;
-	/** @brief Lista de regiones de memoria libres */
+	/** @brief Lista de regiones de memoria libres de tamao mayor o igual a
+	 * HEAP_CLASS_LIMIT */
 	list_memreg_header * free;
 	/** @brief Lista de regiones de memoria usadas */
 	list_memreg_header * used;
+	/** @brief Listas segregadas de regiones libres, una por clase de tamao */
+	list_memreg_header classes[HEAP_SIZE_CLASSES];
+	/** @brief Mapa de bits de las clases de tamao que tienen regiones
+	 * libres. El bit i es 1 si la lista classes[i] no esta vacia. */
+	unsigned int class_map;
+	/** @brief Numero total de regiones libres en el heap */
+	int free_count;
+	/** @brief Politica de asignacion: HEAP_FIRST_FIT o HEAP_BEST_FIT */
+	int policy;
+	/** @brief Arbol de regiones libres (HEAP_BEST_FIT) */
+	tree_memreg_tree tree;
+	/** @brief Rutina para extender el heap cuando no existe espacio
+	 * suficiente, 0 si el heap tiene un tamao fijo */
+	heap_grow_t grow;
+	/** @brief Rutina para liberar el espacio que queda libre cuando el heap
+	 * se contrae, 0 si el heap tiene un tamao fijo */
+	heap_shrink_t shrink;
+	/** @brief Bytes en el area de datos de las regiones asignadas */
+	unsigned int used_bytes;
+	/** @brief Bytes en el area de datos de las regiones libres */
+	unsigned int free_bytes;
+	/** @brief Numero de asignaciones */
+	unsigned int allocs;
+	/** @brief Numero de liberaciones */
+	unsigned int frees;
+	/** @brief Numero de regiones divididas */
+	unsigned int splits;
+	/** @brief Numero de fusiones de regiones libres adyacentes */
+	unsigned int coalesces;
+	/** @brief Numero de veces que se ha expandido el tope del heap */
+	unsigned int expands;
+	/** @brief Numero de veces que se ha contraido el tope del heap */
+	unsigned int contracts;
+	/** @brief Numero de solicitudes de asignacion que no se pudieron
+	 * atender */
+	unsigned int failures;
+	/** @brief Quick-lists: regiones liberadas que aun no se han fusionado,
+	 * una lista por tamao exacto. Las regiones permanecen marcadas como
+	 * asignadas. */
+	slist_memreg_quick quick[HEAP_QUICK_LISTS];
+	/** @brief Mapa de bits de las quick-lists no vacias */
+	unsigned int quick_map;
+	/** @brief Bytes en el area de datos de las regiones de las
+	 * quick-lists */
+	unsigned int quick_bytes;
+	/** @brief Maximo de bytes en las quick-lists antes de fusionarlas. 0 si
+	 * las regiones se fusionan al liberarlas. */
+	unsigned int quick_budget;
+	/** @brief Numero de veces que se han fusionado las quick-lists */
+	unsigned int quick_flushes;
 }heap_t;
 
+/** @brief Estadisticas de un heap, obtenidas con heap_stats() */
+typedef struct heap_stats {
+	/** @brief Tamao actual del heap (desde la base hasta el tope) */
+	unsigned int size;
+	/** @brief Tamao maximo del heap */
+	unsigned int limit;
+	/** @brief Bytes en el area de datos de las regiones asignadas */
+	unsigned int used_bytes;
+	/** @brief Bytes en el area de datos de las regiones libres */
+	unsigned int free_bytes;
+	/** @brief Numero de regiones libres */
+	unsigned int free_regions;
+	/** @brief Tamao de la mayor region libre */
+	unsigned int largest_free;
+	/** @brief Indice de fragmentacion (0 a 100): porcentaje de los bytes
+	 * libres que no se encuentran en la mayor region libre */
+	unsigned int fragmentation;
+	/** @brief Numero de asignaciones */
+	unsigned int allocs;
+	/** @brief Numero de liberaciones */
+	unsigned int frees;
+	/** @brief Numero de regiones divididas */
+	unsigned int splits;
+	/** @brief Numero de fusiones de regiones libres adyacentes */
+	unsigned int coalesces;
+	/** @brief Numero de veces que se ha expandido el tope del heap */
+	unsigned int expands;
+	/** @brief Numero de veces que se ha contraido el tope del heap */
+	unsigned int contracts;
+	/** @brief Numero de solicitudes de asignacion que no se pudieron
+	 * atender */
+	unsigned int failures;
+	/** @brief Bytes en las quick-lists, pendientes por fusionar */
+	unsigned int quick_bytes;
+	/** @brief Numero de veces que se han fusionado las quick-lists */
+	unsigned int quick_flushes;
+	/** @brief Numero de regiones libres por clase de tamao. La ultima
+	 * posicion cuenta las regiones de tamao mayor o igual a
+	 * HEAP_CLASS_LIMIT. */
+	unsigned int histogram[HEAP_SIZE_CLASSES + 1];
+}heap_stats_t;
+
 
 /* Macros para tamanos */
 
-/** @brief Tamao del encabezado de region */
-#define MEMREG_HEADER_SIZE sizeof(memreg_header_t)
+/** @brief Tamao del encabezado de una region asignada (la palabra de
+ * tamao) */
+#define MEMREG_HEADER_SIZE sizeof(unsigned int)
 
-/** @brief Tamao del pie de la region */
+/** @brief Tamao del pie de una region libre */
 #define MEMREG_FOOTER_SIZE sizeof(memreg_footer_t)
 
+/** @brief Tamao minimo del area de datos de una region: una region libre
+ * debe poder almacenar sus enlaces y su pie. */
+#define MEMREG_MIN_LIMIT (sizeof(memreg_header_t) - MEMREG_HEADER_SIZE \
+		+ MEMREG_FOOTER_SIZE)
+
 /** @brief Tamao minimo de una region de memoria */
-#define MEMREG_MIN_SIZE MEMREG_HEADER_SIZE + MEMREG_GRANULARITY \
-		+ MEMREG_FOOTER_SIZE
+#define MEMREG_MIN_SIZE (MEMREG_HEADER_SIZE + MEMREG_MIN_LIMIT)
 
-/** @brief Tamao de una regin de memoria, incluyendo el encabezado y el
- * pie */
+/** @brief Tamao de una regin de memoria, incluyendo el encabezado */
 #define MEMREG_SIZE(size) \
-	MEMREG_HEADER_SIZE + size + MEMREG_HEADER_SIZE
+	(MEMREG_HEADER_SIZE + (size))
 
-/** @brief Tamao minimo del heap */
-#define HEAP_MIN_SIZE sizeof(heap_t) + MEMREG_MIN_SIZE
+/** @brief Tamao del area de datos de una region, sin los indicadores */
+#define MEMREG_LIMIT(header) \
+	((header)->size & ~(MEMREG_FLAGS | MEMREG_CACHED))
+
+/** @brief Inicio del area de datos de una region */
+#define MEMREG_DATA(header) ((unsigned int)(header) + MEMREG_HEADER_SIZE)
+
+/** @brief Encabezado de la region que contiene un area de datos */
+#define MEMREG_HEADER(ptr) \
+	((memreg_header_t *)((unsigned int)(ptr) - MEMREG_HEADER_SIZE))
+
+/** @brief Pie de una region libre */
+#define MEMREG_FOOTER(header) ((memreg_footer_t *)(MEMREG_DATA(header) + \
+		MEMREG_LIMIT(header) - MEMREG_FOOTER_SIZE))
+
+/** @brief Encabezado de la region que se encuentra inmediatamente despues */
+#define MEMREG_NEXT(header) \
+	((memreg_header_t *)(MEMREG_DATA(header) + MEMREG_LIMIT(header)))
+
+/** @brief Mayor tamao de area de datos que se almacena en las
+ * quick-lists */
+#define HEAP_QUICK_MAX_SIZE \
+	(MEMREG_MIN_LIMIT + (HEAP_QUICK_LISTS - 1) * MEMREG_GRANULARITY)
+
+/** @brief Quick-list que corresponde a un tamao de area de datos entre
+ * MEMREG_MIN_LIMIT y HEAP_QUICK_MAX_SIZE */
+#define HEAP_QUICK_INDEX(limit) \
+	(((limit) - MEMREG_MIN_LIMIT) / MEMREG_GRANULARITY)
+
+/** @brief Tamao minimo del heap: la estructura heap_t, las listas de
+ * regiones, una region minima y la palabra final del heap */
+#define HEAP_MIN_SIZE (sizeof(heap_t) + 2 * sizeof(list_memreg_header) + \
+		MEMREG_MIN_SIZE + MEMREG_HEADER_SIZE)
 
 /**
  * @brief Esta rutina se encarga de inicializar el area de memoria
@@ -122,12 +364,15 @@ heap_t * setup_heap(void * ptr, unsigned int limit);
  * de memoria creadas anteriormente.
  * @param base Direccin lineal de inicio del heap
  * @param limit Tamao de la regin de memoria para asignacin dinmica.
+ * @param policy Politica de asignacion: HEAP_FIRST_FIT o HEAP_BEST_FIT
  * @return Apuntador al nuevo heap
  */
-heap_t *  create_heap(unsigned int base, unsigned int limit);
+heap_t *  create_heap(unsigned int base, unsigned int limit, int policy);
 
 /**
  * @brief Funcin privada para expandir el heap en un tamao especificado.
+ * Si no existe espacio suficiente y el heap tiene una rutina grow, primero
+ * se extiende el espacio disponible del heap.
  * @param heap Heap que se desea expandir
  * @param limit  Tamanio a expandir.
  * @return Puntero al encabezado de la nueva region de memoria, 0 si no es
@@ -138,8 +383,12 @@ memreg_header_t * expand_heap(heap_t * heap, unsigned int limit);
 
 /**
  * @brief Solicita la asignacion de memoria dentro de un heap.
- * Primero se busca dentro de las regiones libres, una que tenga
- * un tamao cercano al buscado. Si no existe una region, expande el heap.
+ * Con la politica HEAP_BEST_FIT se busca en el arbol de regiones libres la
+ * region mas pequea de tamao mayor o igual al buscado. Con HEAP_FIRST_FIT
+ * primero se busca en las listas segregadas la primera clase de tamao no
+ * vacia cuyas regiones tienen un tamao mayor o igual al buscado. Si no
+ * existe, se busca dentro de la lista general de regiones libres una que
+ * tenga un tamao cercano al buscado. Si no existe una region, expande el heap.
  * Si existe suficiente espacio adicional al buscado dentro de la region, esta
  * region se divide en dos: una region asignada, que se retorna, y una
  * region libre con el espacio sobrante.
@@ -150,6 +399,19 @@ memreg_header_t * expand_heap(heap_t * heap, unsigned int limit);
  */
 void * alloc_from_heap(heap_t * heap, unsigned int size);
 
+/**
+ * @brief Solicita la asignacion de memoria alineada dentro de un heap. El
+ * relleno necesario para alinear el area de datos se separa como una region
+ * libre, y la region se puede liberar con free_from_heap().
+ * @param heap Heap del cual se desea obtener el espacio
+ * @param size Cantidad de memoria a asignar
+ * @param align Alineacion requerida, potencia de 2
+ * @return Apuntador a la region de memoria asignada, alineado a align. 0 si
+ * no se puede asignar memoria.
+ */
+void * alloc_aligned_from_heap(heap_t * heap, unsigned int size,
+		unsigned int align);
+
 /**
  * @brief Libera una region de memoria dentro de un heap.
  * @param heap Heap de la cual se desea liberar la regin
@@ -157,6 +419,38 @@ void * alloc_from_heap(heap_t * heap, unsigned int size);
  */
 void free_from_heap(heap_t * heap, memreg_header_t *header);
 
+/**
+ * @brief Configura la fusion diferida de un heap. Con un limite mayor que 0,
+ * free_from_heap() almacena las regiones pequeas en las quick-lists sin
+ * fusionarlas, y alloc_from_heap() las reutiliza cuando se solicita el mismo
+ * tamao. Las quick-lists se fusionan en bloque cuando una asignacion no
+ * encuentra una region libre, o cuando superan el limite de bytes.
+ * @param heap Heap
+ * @param budget Maximo de bytes en las quick-lists, 0 para fusionar las
+ * regiones al liberarlas. Las quick-lists actuales se fusionan.
+ */
+void heap_defer_coalescing(heap_t * heap, unsigned int budget);
+
+/**
+ * @brief Libera y fusiona todas las regiones de las quick-lists de un heap.
+ * @param heap Heap
+ */
+void heap_flush_quick(heap_t * heap);
+
+/**
+ * @brief Cambia el tamao de una region asignada sin moverla. Para reducir
+ * la region, el espacio sobrante al final se libera como una nueva region.
+ * Para aumentarla, la region se fusiona con la region siguiente si esta se
+ * encuentra libre y tiene el espacio suficiente, o se expande el tope del
+ * heap si la region es la ultima.
+ * @param heap Heap al cual pertenece la region
+ * @param ptr Apuntador al area de datos de la region
+ * @param size Nuevo tamao requerido
+ * @return 1 si la region tiene el nuevo tamao, 0 si no es posible cambiar
+ * el tamao sin mover la region.
+ */
+int resize_in_heap(heap_t * heap, void * ptr, unsigned int size);
+
 /**
  * @brief Determina si una region de memoria dada es valida dentro de un
  * heap.
@@ -166,6 +460,27 @@ void free_from_heap(heap_t * heap, memreg_header_t *header);
  */
 int memreg_is_valid(heap_t * heap, memreg_header_t *header);
 
+/**
+ * @brief Verifica la consistencia de un heap: recorre todas las regiones
+ * desde la base hasta el tope, verifica sus encabezados y pies, que no
+ * existan regiones libres adyacentes sin fusionar, y que las regiones libres
+ * del recorrido coincidan con las listas (o el arbol) de regiones libres, y
+ * que las quick-lists contengan regiones validas.
+ * @param heap Heap a verificar
+ * @return Numero de errores encontrados, 0 si el heap es consistente. Cada
+ * error se reporta con printf.
+ */
+int heap_check(heap_t * heap);
+
+/**
+ * @brief Obtiene las estadisticas de un heap. Los contadores se mantienen
+ * durante la operacion del heap; el tamao de la mayor region libre y el
+ * histograma se calculan recorriendo las regiones libres.
+ * @param heap Heap
+ * @param stats Estructura en la cual se almacenan las estadisticas
+ */
+void heap_stats(heap_t * heap, struct heap_stats * stats);
+
 /**
  * @brief Imprime la informacion de una region de memoria
  * @param header Apuntador al encabezado de la regin de memoria
@@ -0,0 +1,222 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ *
+ * @brief Contiene las definiciones del subsistema de paginacion de IA-32.
+ * @details
+ * La paginacion se habilita en setup_paging(), luego de configurar la
+ * memoria fisica. El kernel se mapea por identidad (direccion lineal =
+ * direccion fisica) desde la direccion 0 hasta el final de la memoria
+ * disponible, usando paginas de 4 MB (PSE) si el procesador las soporta,
+ * para reducir el numero de entradas de la TLB que ocupa el kernel.
+ *
+ * El directorio de paginas y las tablas de paginas son unidades de memoria
+ * obtenidas con allocate_unit(). Como se encuentran dentro de la region
+ * mapeada por identidad, el kernel las accede con su direccion fisica.
+ *
+ * Fuera del mapeo por identidad se pueden reservar regiones de direcciones
+ * lineales que se asignan bajo demanda (reserve_demand_region()): ninguna
+ * pagina de la region ocupa memoria hasta que se accede por primera vez.
+ * En ese momento el manejador de la excepcion 14 (Page Fault) asigna una
+ * unidad, la inicializa en cero y la mapea. Si el primer acceso es una
+ * lectura, se mapea en modo de solo lectura una pagina de ceros compartida,
+ * y la unidad solo se asigna cuando se escribe la pagina.
+ *
+ * clone_directory() copia un espacio de direcciones sin copiar sus paginas:
+ * las paginas de usuario se comparten en modo de solo lectura con el
+ * indicador PAGE_COW, y se copian cuando alguno de los directorios las
+ * escribe (copy-on-write).
+ */
+
+#ifndef PAGING_H_
+#define PAGING_H_
+
+/** @brief Tamao de una pagina (igual al tamao de una unidad de memoria) */
+#define PAGE_SIZE 4096
+
+/** @brief Tamao de una pagina grande (PSE) */
+#define PAGE_LARGE_SIZE 0x400000
+
+/** @brief Numero de entradas de un directorio o de una tabla de paginas */
+#define PAGE_ENTRIES 1024
+
+/** @brief La pagina se encuentra presente en memoria */
+#define PAGE_PRESENT 0x1
+/** @brief La pagina se puede escribir */
+#define PAGE_WRITABLE 0x2
+/** @brief La pagina se puede acceder desde el nivel de privilegio 3 */
+#define PAGE_USER 0x4
+/** @brief Escritura directa (write-through) */
+#define PAGE_WRITE_THROUGH 0x8
+/** @brief La pagina no se almacena en cache */
+#define PAGE_CACHE_DISABLE 0x10
+/** @brief La pagina ha sido accedida */
+#define PAGE_ACCESSED 0x20
+/** @brief La pagina ha sido escrita */
+#define PAGE_DIRTY 0x40
+/** @brief La entrada del directorio describe una pagina de 4 MB */
+#define PAGE_LARGE 0x80
+/** @brief La entrada de la TLB no se invalida al cambiar CR3 */
+#define PAGE_GLOBAL 0x100
+
+/** @brief Pagina compartida que se copia al escribirla (copy-on-write).
+ * Usa uno de los bits disponibles para el sistema operativo. */
+#define PAGE_COW 0x200
+
+/** @brief Mascara de los indicadores de una entrada */
+#define PAGE_FLAGS 0xFFF
+
+/** @brief Mascara de la direccion fisica de una entrada */
+#define PAGE_FRAME (~PAGE_FLAGS)
+
+/** @brief Valor retornado por virt_to_phys() para una direccion que no se
+ * encuentra mapeada */
+#define PAGE_NOT_MAPPED 0xFFFFFFFF
+
+/** @brief Indice de la entrada del directorio que corresponde a una
+ * direccion lineal */
+#define PDE_INDEX(addr) ((unsigned int)(addr) >> 22)
+
+/** @brief Indice de la entrada de la tabla de paginas que corresponde a una
+ * direccion lineal */
+#define PTE_INDEX(addr) (((unsigned int)(addr) >> 12) & (PAGE_ENTRIES - 1))
+
+/** @brief Bit PG de CR0: habilita la paginacion */
+#define CR0_PG 0x80000000
+/** @brief Bit WP de CR0: el kernel respeta las paginas de solo lectura */
+#define CR0_WP 0x00010000
+/** @brief Bit PSE de CR4: habilita las paginas de 4 MB */
+#define CR4_PSE 0x00000010
+/** @brief Bit PGE de CR4: habilita las paginas globales */
+#define CR4_PGE 0x00000080
+
+/** @brief Numero maximo de regiones asignadas bajo demanda */
+#define DEMAND_REGIONS 8
+
+/** @brief Bit P del codigo de error de un Page Fault: la pagina se
+ * encontraba presente (violacion de proteccion) */
+#define PAGE_FAULT_PRESENT 0x1
+/** @brief Bit W/R del codigo de error de un Page Fault: el acceso fue una
+ * escritura */
+#define PAGE_FAULT_WRITE 0x2
+/** @brief Bit U/S del codigo de error de un Page Fault: el acceso se
+ * realizo desde el nivel de privilegio 3 */
+#define PAGE_FAULT_USER 0x4
+
+/** @brief Entrada de un directorio de paginas */
+typedef unsigned int pde_t;
+
+/** @brief Entrada de una tabla de paginas */
+typedef unsigned int pte_t;
+
+/** @brief Directorio de paginas. Ocupa exactamente una unidad de memoria. */
+typedef struct page_directory {
+	/** @brief Entradas del directorio */
+	pde_t entries[PAGE_ENTRIES];
+}page_directory_t;
+
+/** @brief Region de direcciones lineales del kernel cuyas paginas se
+ * asignan bajo demanda */
+typedef struct demand_region {
+	/** @brief Direccion de inicio de la region, alineada a PAGE_SIZE */
+	unsigned int start;
+	/** @brief Direccion siguiente al fin de la region */
+	unsigned int end;
+	/** @brief Indicadores de las paginas de la region */
+	unsigned int flags;
+	/** @brief Numero de unidades asignadas a paginas de la region. La
+	 * pagina de ceros no se cuenta. */
+	unsigned int committed;
+}demand_region_t;
+
+/** @brief Directorio de paginas del kernel */
+extern page_directory_t * kernel_directory;
+
+/**
+ * @brief Crea el directorio de paginas del kernel, mapea por identidad la
+ * memoria fisica y habilita la paginacion. Se debe invocar luego de
+ * setup_memory().
+ */
+void setup_paging(void);
+
+/**
+ * @brief Mapea una pagina de 4 KB. Si la tabla de paginas no existe, se
+ * asigna una unidad para ella; si la direccion se encuentra dentro de una
+ * pagina de 4 MB, esta se divide en una tabla de paginas de 4 KB.
+ * @param dir Directorio de paginas
+ * @param virt Direccion lineal, alineada a PAGE_SIZE
+ * @param phys Direccion fisica, alineada a PAGE_SIZE
+ * @param flags Indicadores de la pagina (PAGE_WRITABLE, PAGE_USER, ...).
+ * PAGE_PRESENT se agrega siempre.
+ * @return 0 si la pagina se mapeo, -1 si no existe memoria para la tabla de
+ * paginas.
+ */
+int map_page(page_directory_t * dir, unsigned int virt, unsigned int phys,
+		unsigned int flags);
+
+/**
+ * @brief Elimina el mapeo de una pagina de 4 KB. Si la direccion se
+ * encuentra dentro de una pagina de 4 MB, esta se divide primero.
+ * @param dir Directorio de paginas
+ * @param virt Direccion lineal
+ * @return Direccion fisica que estaba mapeada, PAGE_NOT_MAPPED si la
+ * pagina no estaba mapeada o no fue posible dividir la pagina de 4 MB.
+ */
+unsigned int unmap_page(page_directory_t * dir, unsigned int virt);
+
+/**
+ * @brief Traduce una direccion lineal a la direccion fisica a la cual se
+ * encuentra mapeada.
+ * @param dir Directorio de paginas
+ * @param virt Direccion lineal
+ * @return Direccion fisica, PAGE_NOT_MAPPED si la direccion no se
+ * encuentra mapeada.
+ */
+unsigned int virt_to_phys(page_directory_t * dir, unsigned int virt);
+
+/**
+ * @brief Reserva en el directorio del kernel una region de direcciones
+ * lineales cuyas paginas se asignan al accederlas por primera vez.
+ * @param start Direccion de inicio, alineada a PAGE_SIZE
+ * @param length Tamao de la region, multiplo de PAGE_SIZE
+ * @param flags Indicadores de las paginas (PAGE_WRITABLE, ...)
+ * @return 0 si la region se reservo, -1 si la paginacion no se encuentra
+ * habilitada, no existe espacio para la region o parte de ella ya se
+ * encuentra mapeada.
+ */
+int reserve_demand_region(unsigned int start, unsigned int length,
+		unsigned int flags);
+
+/**
+ * @brief Elimina el mapeo de las paginas asignadas dentro de un rango de
+ * una region bajo demanda y devuelve sus unidades al asignador. Las
+ * paginas se volveran a asignar si se accede de nuevo a ellas.
+ * @param start Direccion de inicio del rango, alineada a PAGE_SIZE
+ * @param length Tamao del rango
+ * @return Numero de paginas liberadas.
+ */
+unsigned int release_demand_pages(unsigned int start, unsigned int length);
+
+/**
+ * @brief Crea una copia de un directorio de paginas. Las entradas del
+ * kernel (sin PAGE_USER) se comparten, por lo cual la copia usa las mismas
+ * tablas de paginas del kernel. Las paginas de usuario se comparten en modo
+ * copy-on-write: ambas copias las mapean en modo de solo lectura, y la
+ * primera escritura de cada copia obtiene su propia unidad.
+ * @param dir Directorio a copiar
+ * @return Nuevo directorio, 0 si no existe memoria.
+ */
+page_directory_t * clone_directory(page_directory_t * dir);
+
+/**
+ * @brief Libera un directorio de paginas creado con clone_directory(): sus
+ * tablas de paginas de usuario y las unidades que ya no comparte con otro
+ * directorio. Las tablas del kernel no se modifican.
+ * @param dir Directorio a liberar. No puede ser el directorio actual ni el
+ * directorio del kernel.
+ */
+void free_directory(page_directory_t * dir);
+
+#endif /* PAGING_H_ */
@@ -10,6 +10,9 @@
 #ifndef PHYSMEM_H_
 #define PHYSMEM_H_
 
+#include <generic_linked_list.h>
+#include <generic_hash_table.h>
+
  /** @brief Tamao de la unidad de asignacin de memoria  */
 #define MEMORY_UNIT_SIZE 4096
 
@@ -18,41 +21,236 @@
 
 /** @brief Funcin que redondea una direccin de memoria a la direccin
  *  ms cercana por debajo que sea mltiplo de MEMORY_UNIT_SIZE */
-static __inline__ unsigned int round_down_to_memory_unit(addr) {
-	if (addr < 0) { return 0; }
-
-	volatile remainder = addr % MEMORY_UNIT_SIZE;
-
-    return addr - remainder;
+static __inline__ unsigned int round_down_to_memory_unit(unsigned int addr) {
+	return addr & ~(MEMORY_UNIT_SIZE - 1);
 }
 
 /** @brief Funcin que redondea una direccin de memoria a la direccin
  *  ms cercana por encima que sea mltiplo de MEMORY_UNIT_SIZE */
-static __inline__ unsigned int round_up_to_memory_unit(addr) {
+static __inline__ unsigned int round_up_to_memory_unit(unsigned int addr) {
+	return (addr + MEMORY_UNIT_SIZE - 1) & ~(MEMORY_UNIT_SIZE - 1);
+}
 
-	if (addr < 0) { return 0; }
+/** @brief Direccion lineal del HEAP del kernel. Se encuentra fuera del
+ * mapeo por identidad de la memoria fisica. */
+#define KERNEL_HEAP_VIRTUAL_BASE 0xD0000000
 
-	volatile remainder = addr % MEMORY_UNIT_SIZE;
+/** @brief Tamanio en bytes del rango de direcciones reservado para el HEAP
+ * del kernel, 256 MB. Las paginas del heap se asignan al accederlas por
+ * primera vez, por lo cual el rango no ocupa memoria hasta que se usa. */
+#define KERNEL_HEAP_VIRTUAL_SIZE 0x10000000
 
-	if (remainder > 0) {
-		return addr + MEMORY_UNIT_SIZE - remainder;
-	}
+/** @brief Tamao minimo en bytes en el cual se intenta extender el heap del
+ * kernel, 64 KB. Tambien es el tamao inicial de los heaps adicionales. */
+#define KERNEL_HEAP_GROW_SIZE 0x10000
 
-	return addr;
+/** @brief Numero maximo de heaps del kernel. Cuando las unidades contiguas
+ * al final de los heaps existentes se encuentran asignadas, kmalloc crea un
+ * heap adicional en otra region de unidades. */
+#define KERNEL_HEAPS 16
 
-}
+/** @brief Tamao a partir del cual kmalloc asigna unidades de memoria
+ * propias en lugar de usar el heap del kernel, 2 KB */
+#define KMALLOC_LARGE_SIZE 0x800
+
+/** @brief Numero de bits del indice de la tabla hash de regiones de
+ * unidades asignadas por kmalloc */
+#define KMALLOC_HASH_BITS 6
+
+/** @brief Descriptor de una region de unidades asignada por kmalloc. Los
+ * descriptores se almacenan en una tabla hash indexada por la direccion de
+ * la region, por lo cual la region no requiere encabezado. */
+typedef struct kmalloc_region {
+	/** @brief Direccion de inicio de la region */
+	unsigned int base;
+	/** @brief Tamao de la region en bytes */
+	unsigned int length;
+	DEFINE_GENERIC_HASH_LINKS(kmalloc_region); /*Links genericos */
+}kmalloc_region_t;
+
+/** @brief Definicin de las primitivas para gestionar tablas hash de tipo
+ * kmalloc_region_t*/
+DEFINE_GENERIC_HASH_TYPE(kmalloc_region_t, kmalloc_region, KMALLOC_HASH_BITS);
+
+/** @brief Numero de CPUs para las cuales kmalloc mantiene caches locales */
+#define KERNEL_CPUS 1
+
+/** @brief Si es 1, kmalloc mantiene por cada CPU pilas (magazines) de
+ * bloques pequeos ya asignados dentro del heap, que se llenan y se vacian
+ * por lotes. Las asignaciones y liberaciones frecuentes solo acceden a la
+ * memoria local de la CPU. Se deshabilita con -DKMALLOC_MAGAZINES=0. */
+#ifndef KMALLOC_MAGAZINES
+#define KMALLOC_MAGAZINES 1
+#endif
+
+/** @brief Numero de clases de tamao de los magazines. La clase i contiene
+ * bloques de al menos 2^(i + KMALLOC_MAGAZINE_SHIFT) bytes. */
+#define KMALLOC_MAGAZINE_CLASSES 6
+
+/** @brief Logaritmo en base 2 del tamao de la menor clase */
+#define KMALLOC_MAGAZINE_SHIFT 4
+
+/** @brief Tamao de la mayor clase. Las solicitudes de mayor tamao no
+ * utilizan los magazines. */
+#define KMALLOC_MAGAZINE_MAX_SIZE \
+	(1 << (KMALLOC_MAGAZINE_SHIFT + KMALLOC_MAGAZINE_CLASSES - 1))
+
+/** @brief Capacidad de un magazine */
+#define KMALLOC_MAGAZINE_SIZE 32
+
+/** @brief Numero de bloques que se obtienen del heap o se devuelven al heap
+ * en cada operacion de llenado o vaciado de un magazine */
+#define KMALLOC_MAGAZINE_BATCH 16
+
+/** @brief Pila de bloques libres de una clase de tamao */
+typedef struct kmalloc_magazine {
+	/** @brief Numero de bloques en la pila */
+	unsigned int count;
+	/** @brief Bloques. El ultimo bloque liberado se encuentra en la cima. */
+	void * blocks[KMALLOC_MAGAZINE_SIZE];
+}kmalloc_magazine_t;
+
+/** @brief Magazines de una CPU. Cada CPU tiene su propia linea de cache. */
+typedef struct kmalloc_cpu_cache {
+	/** @brief Un magazine por clase de tamao */
+	kmalloc_magazine_t magazines[KMALLOC_MAGAZINE_CLASSES];
+}__attribute__((aligned(64))) kmalloc_cpu_cache_t;
+
+/** @brief Si es 1, kmalloc registra la direccion de retorno de quien
+ * solicita cada region, y kmem_dump_leaks() reporta los bytes asignados por
+ * cada sitio. Se habilita al compilar con -DKMALLOC_TRACK_CALLERS=1. */
+#ifndef KMALLOC_TRACK_CALLERS
+#define KMALLOC_TRACK_CALLERS 0
+#endif
+
+#if KMALLOC_TRACK_CALLERS
+
+/** @brief Numero de bits del indice de la tabla de regiones rastreadas */
+#define KMALLOC_TRACK_BITS 12
+
+/** @brief Numero de entradas de la tabla de regiones rastreadas. Las regiones
+ * asignadas cuando la tabla esta llena no se rastrean. */
+#define KMALLOC_TRACK_ENTRIES (1 << KMALLOC_TRACK_BITS)
+
+/** @brief Numero maximo de sitios distintos que agrupa kmem_dump_leaks() */
+#define KMALLOC_TRACK_SITES 128
+
+/** @brief Entrada de la tabla de regiones rastreadas */
+typedef struct kmalloc_track {
+	/** @brief Region asignada, 0 si la entrada esta libre */
+	void * ptr;
+	/** @brief Tamao solicitado */
+	unsigned int size;
+	/** @brief Direccion de retorno de quien solicito la region */
+	void * caller;
+}kmalloc_track_t;
+
+/** @brief Bytes asignados por un sitio, calculados por kmem_dump_leaks() */
+typedef struct kmalloc_site {
+	/** @brief Direccion de retorno del sitio */
+	void * caller;
+	/** @brief Bytes asignados */
+	unsigned int bytes;
+	/** @brief Numero de regiones asignadas */
+	unsigned int count;
+}kmalloc_site_t;
+
+#endif
+
+/** @brief Si es 1, kmalloc rodea los datos de cada region con zonas de
+ * proteccion que se verifican en kfree() y krealloc(), para detectar
+ * escrituras fuera de la region y liberaciones repetidas. Se habilita al
+ * compilar con -DKMALLOC_REDZONE=1. En este modo las regiones grandes no
+ * quedan alineadas a una unidad; kmalloc_aligned() conserva la alineacion. */
+#ifndef KMALLOC_REDZONE
+#define KMALLOC_REDZONE 0
+#endif
+
+#if KMALLOC_REDZONE
+
+/** @brief Valor base del canario que precede los datos de una region */
+#define KMALLOC_REDZONE_MAGIC 0xC0DEFACE
+
+/** @brief Valor del canario de una region liberada */
+#define KMALLOC_REDZONE_FREED 0xDEADC0DE
+
+/** @brief Valor de cada byte de la zona de proteccion posterior */
+#define KMALLOC_REDZONE_BYTE 0xFD
+
+/** @brief Tamao de la zona de proteccion posterior a los datos */
+#define KMALLOC_REDZONE_TAIL 4
+
+/** @brief Zona de proteccion que precede los datos de una region */
+typedef struct kmalloc_redzone {
+	/** @brief Desplazamiento de los datos desde el inicio del bloque */
+	unsigned int lead;
+	/** @brief Tamao solicitado */
+	unsigned int size;
+	/** @brief KMALLOC_REDZONE_MAGIC ^ lead ^ size, o KMALLOC_REDZONE_FREED
+	 * si la region fue liberada */
+	unsigned int canary;
+}kmalloc_redzone_t;
 
-/** @brief Tamanio en bytes del HEAP del kernel, 1 MB */
-#define KERNEL_HEAP_SIZE 0x100000
+/** @brief Desplazamiento de los datos dentro del bloque en kmalloc() */
+#define KMALLOC_REDZONE_LEAD sizeof(kmalloc_redzone_t)
+
+#endif
+
+/** @brief Estrategia de asignacion de unidades: buddy system con listas de
+ * bloques libres por orden */
+#define PHYSMEM_BUDDY 1
+
+/** @brief Estrategia de asignacion de unidades: mapa de bits con un nivel de
+ * resumen (un bit por cada palabra de 32 unidades) */
+#define PHYSMEM_BITMAP 2
+
+/** @brief Estrategia de asignacion de unidades usada por el kernel. Se puede
+ * seleccionar al compilar, por ejemplo con -DPHYSMEM_ALLOCATOR=PHYSMEM_BITMAP */
+#ifndef PHYSMEM_ALLOCATOR
+#define PHYSMEM_ALLOCATOR PHYSMEM_BUDDY
+#endif
+
+#if PHYSMEM_ALLOCATOR == PHYSMEM_BUDDY
+
+/** @brief Numero de ordenes del buddy system. Un bloque de orden k contiene
+ * 2^k unidades contiguas, alineadas a 2^k unidades. Con 21 ordenes el bloque
+ * mas grande es de 4 GB. */
+#define BUDDY_ORDERS 21
+
+/** @brief Nodo de la lista de bloques libres del buddy system. Se almacena
+ * dentro de la primera unidad del bloque libre, por lo cual no requiere
+ * memoria adicional. */
+typedef struct buddy_block {
+	DEFINE_GENERIC_LIST_LINKS(buddy_block); /*Links genericos */
+}buddy_block_t;
+
+/** @brief Definicin de las primitivas para gestionar listas de tipo
+ * buddy_block_t*/
+DEFINE_GENERIC_LIST_TYPE(buddy_block_t, buddy_block);
+
+#endif
 
 /**
- * @brief Solicita asignacion de memoria dentro del heap.
+ * @brief Solicita asignacion de memoria dentro del heap. Las solicitudes de
+ * mas de KMALLOC_LARGE_SIZE bytes reciben una region de unidades propia,
+ * alineada a una unidad.
  * @param size Tamao requerido
  * @return Puntero a la base de la region de memoria asignada, 0 si
  *  		 no es posible asignar memoria.
  */
 void * kmalloc(unsigned int size);
 
+/**
+ * @brief Solicita asignacion de memoria alineada. El relleno necesario para
+ * alinear la region no se desperdicia, y la region se libera con kfree().
+ * krealloc() puede mover la region sin conservar la alineacion.
+ * @param size Tamao requerido
+ * @param align Alineacion requerida, potencia de 2
+ * @return Puntero a la region asignada, alineado a align. 0 si no es posible
+ * asignar memoria o si align no es potencia de 2.
+ */
+void * kmalloc_aligned(unsigned int size, unsigned int align);
+
 
 
 /**
@@ -61,6 +259,42 @@ void * kmalloc(unsigned int size);
  */
 void  kfree(void * ptr);
 
+/**
+ * @brief Devuelve al heap todos los bloques de los magazines de kmalloc, y
+ * fusiona las quick-lists de los heaps del kernel. Se debe invocar cuando
+ * se requiere recuperar memoria.
+ */
+void kmalloc_drain(void);
+
+/**
+ * @brief Verifica la consistencia de todos los heaps del kernel con
+ * heap_check().
+ * @return Numero de errores encontrados, 0 si los heaps son consistentes.
+ */
+int kmalloc_check(void);
+
+#if KMALLOC_TRACK_CALLERS
+/**
+ * @brief Imprime los sitios que tienen mas bytes asignados con kmalloc,
+ * agrupando las regiones rastreadas por direccion de retorno.
+ * @param top Numero de sitios a imprimir
+ */
+void kmem_dump_leaks(int top);
+#else
+#define kmem_dump_leaks(top)
+#endif
+
+/**
+ * @brief Cambia el tamao de una region de memoria asignada con kmalloc.
+ * Primero se intenta cambiar el tamao sin mover la region, y solo si esto
+ * no es posible se asigna una nueva region y se copian los datos.
+ * @param ptr Puntero a la region, 0 para asignar una nueva region
+ * @param size Nuevo tamao requerido. Si es 0, la region se libera.
+ * @return Puntero a la region con el nuevo tamao, 0 si no es posible
+ * asignar memoria. En este caso la region original no se modifica.
+ */
+void * krealloc(void * ptr, unsigned int size);
+
 /**
  * @brief Esta rutina inicializa el mapa de bits de memoria,
  * a partir de la informacion obtenida del GRUB.
@@ -68,26 +302,55 @@ void  kfree(void * ptr);
 void setup_memory(void);
 
 /**
- @brief Busca una unidad libre dentro del mapa de bits de memoria.
- * @return Direccin de inicio de la unidad en memoria.
+ * @brief Crea el heap del kernel en el rango de direcciones
+ * KERNEL_HEAP_VIRTUAL_BASE, cuyas paginas se asignan bajo demanda. Se debe
+ * invocar luego de setup_paging(). Si el rango no se puede reservar,
+ * kmalloc crea heaps en regiones de unidades a medida que los requiere.
+ */
+void setup_kernel_heap(void);
+
+/**
+ @brief Obtiene una unidad libre de la lista de bloques de orden 0 del buddy
+ * system. Si esta lista se encuentra vacia, divide el bloque libre mas pequeo
+ * de un orden superior.
+ * @return Direccin de inicio de la unidad en memoria, 0 si no existen
+ * unidades disponibles.
  */
 char * allocate_unit(void);
 
-/** @brief Busca una regin de memoria contigua libre dentro del mapa de bits
- * de memoria.
+/** @brief Busca una regin de memoria contigua libre. Con el buddy system se
+ * asigna un bloque del menor orden que contiene el numero de unidades
+ * solicitado, y las unidades sobrantes al final del bloque se devuelven a las
+ * listas de bloques libres. Con el mapa de bits se buscan palabras completas
+ * de unidades disponibles.
  * @param length Tamao de la regin de memoria a asignar.
- * @return Direccin de inicio de la regin en memoria.
+ * @return Direccin de inicio de la regin en memoria, 0 si no existe una
+ * regin contigua del tamao solicitado.
  */
 char * allocate_unit_region(unsigned int length);
 
 /**
- * @brief Permite liberar una unidad de memoria.
+ * @brief Asigna una regin de memoria especifica, si todas sus unidades se
+ * encuentran libres.
+ * @param addr Direccin de inicio de la regin, alineada a una unidad
+ * @param length Tamao de la regin de memoria a asignar.
+ * @return Direccin de inicio de la regin, 0 si alguna de sus unidades no
+ * se encuentra libre.
+ */
+char * claim_unit_region(char * addr, unsigned int length);
+
+/**
+ * @brief Permite liberar una unidad de memoria. Con el buddy system la unidad
+ * se fusiona con su bloque compaero mientras este se encuentre libre.
  * @param addr Direccin de memoria dentro del rea a liberar.
  */
 void free_unit(char *addr);
 
 /**
- * @brief Permite liberar una regin de memoria.
+ * @brief Permite liberar una regin de memoria. Con el buddy system la regin
+ * se descompone en los bloques alineados mas grandes posibles, y con el mapa
+ * de bits se marcan palabras completas, por lo cual el costo no depende
+ * linealmente del numero de unidades.
  * @param start_addr Direccin de memoria del inicio de la regin a liberar
  * @param length Tamao de la regin a liberar
  */
@@ -0,0 +1,127 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ *
+ * @brief Contiene las definiciones de los caches de objetos (slab allocator).
+ * @details
+ * Un cache de objetos gestiona objetos de un tamao fijo. Los objetos se
+ * ubican dentro de slabs, cada uno de los cuales ocupa una unidad de memoria
+ * obtenida con allocate_unit(). Al inicio de la unidad se encuentra el
+ * encabezado del slab, seguido de los objetos.
+ *
+ * Los objetos libres de un slab forman una lista enlazada simple dentro del
+ * mismo slab: el apuntador al siguiente objeto libre se almacena dentro del
+ * objeto libre. Por esta razon los objetos no requieren encabezados, y la
+ * asignacion y liberacion de un objeto es O(1).
+ *
+ * El slab al cual pertenece un objeto se obtiene redondeando la direccion
+ * del objeto a la unidad de memoria que lo contiene.
+ */
+
+#ifndef SLAB_H_
+#define SLAB_H_
+
+#include <generic_linked_list.h>
+
+/** @brief Tamao maximo de un objeto dentro de un cache. Los objetos de mayor
+ * tamao se deben solicitar con kmalloc. */
+#define KMEM_CACHE_MAX_SIZE 512
+
+/** @brief Longitud maxima del nombre de un cache, incluyendo el nulo */
+#define KMEM_CACHE_NAME_LENGTH 16
+
+/** @brief Numero de slabs vacios que conserva un cache. Cuando un slab queda
+ * vacio y el cache ya tiene este numero de slabs vacios, su unidad de memoria
+ * se libera. */
+#define KMEM_CACHE_EMPTY_SLABS 1
+
+/** @brief Tipo para las rutinas que inicializan los objetos de un cache */
+typedef void (*kmem_ctor)(void *);
+
+struct kmem_cache;
+
+/** @brief Encabezado de un slab. Se ubica al inicio de la unidad de memoria
+ * que contiene los objetos del slab. */
+typedef struct slab {
+	/** @brief Cache al cual pertenece el slab */
+	struct kmem_cache * cache;
+	/** @brief Primer objeto libre dentro del slab, 0 si el slab esta lleno */
+	void * free;
+	/** @brief Numero de objetos asignados dentro del slab */
+	unsigned int inuse;
+	DEFINE_GENERIC_LIST_LINKS(slab); /*Links genericos */
+}slab_t;
+
+/** @brief Definicin de las primitivas para gestionar listas de tipo
+ * slab_t*/
+DEFINE_GENERIC_LIST_TYPE(slab_t, slab);
+
+/** @brief Cache de objetos de un tamao fijo */
+typedef struct kmem_cache {
+	/** @brief Nombre del cache */
+	char name[KMEM_CACHE_NAME_LENGTH];
+	/** @brief Tamao de cada objeto dentro del slab, incluyendo el relleno
+	 * necesario para la alineacion */
+	unsigned int size;
+	/** @brief Tamao solicitado para los objetos */
+	unsigned int object_size;
+	/** @brief Alineacion de los objetos */
+	unsigned int align;
+	/** @brief Desplazamiento dentro de un objeto libre en el cual se almacena
+	 * el apuntador al siguiente objeto libre. Es 0 si el cache no tiene
+	 * constructor; en caso contrario se ubica luego del objeto, para no
+	 * destruir el estado inicializado por el constructor. */
+	unsigned int free_offset;
+	/** @brief Desplazamiento del primer objeto dentro del slab */
+	unsigned int offset;
+	/** @brief Numero de objetos en cada slab */
+	unsigned int objects;
+	/** @brief Rutina que inicializa cada objeto al crear un slab */
+	kmem_ctor ctor;
+	/** @brief Slabs con objetos asignados y objetos libres */
+	list_slab partial;
+	/** @brief Slabs sin objetos libres */
+	list_slab full;
+	/** @brief Slabs sin objetos asignados */
+	list_slab empty;
+}kmem_cache_t;
+
+/**
+ * @brief Crea un cache de objetos.
+ * @param name Nombre del cache
+ * @param size Tamao de los objetos, maximo KMEM_CACHE_MAX_SIZE
+ * @param align Alineacion de los objetos (potencia de 2), 0 para usar la
+ * alineacion minima (tamao de un apuntador)
+ * @param ctor Rutina que inicializa cada objeto cuando se crea un slab, 0 si
+ * los objetos no requieren inicializacion. Los objetos se deben liberar en el
+ * estado inicializado.
+ * @return Apuntador al cache creado, 0 si no es posible crear el cache.
+ */
+kmem_cache_t * kmem_cache_create(char * name, unsigned int size,
+		unsigned int align, kmem_ctor ctor);
+
+/**
+ * @brief Asigna un objeto de un cache.
+ * @param cache Cache del cual se asigna el objeto
+ * @return Apuntador al objeto, 0 si no es posible asignar memoria.
+ */
+void * kmem_cache_alloc(kmem_cache_t * cache);
+
+/**
+ * @brief Libera un objeto de un cache.
+ * @param cache Cache al cual pertenece el objeto
+ * @param obj Apuntador al objeto a liberar
+ */
+void kmem_cache_free(kmem_cache_t * cache, void * obj);
+
+/**
+ * @brief Destruye un cache de objetos. El cache no debe tener objetos
+ * asignados; todas sus unidades de memoria se liberan.
+ * @param cache Cache a destruir
+ * @return 0 si el cache se destruyo, -1 si aun tiene objetos asignados.
+ */
+int kmem_cache_destroy(kmem_cache_t * cache);
+
+#endif /* SLAB_H_ */
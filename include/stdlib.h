@@ -48,5 +48,24 @@ char * itoa(unsigned int n, char *buf, int base);
  */
 int atoi(char * buf, int base);
 
+/**
+ * @brief Copia un bloque de memoria. Los bloques no se deben solapar.
+ * @param dest Direccion de destino
+ * @param src Direccion de origen
+ * @param n Numero de bytes a copiar
+ * @return Direccion de destino
+ */
+void * memcpy(void * dest, const void * src, unsigned int n);
+
+/**
+ * @brief Llena un bloque de memoria con un valor.
+ * @param dest Direccion del bloque
+ * @param c Valor con el cual se llena el bloque (se toma el byte menos
+ * significativo)
+ * @param n Numero de bytes a llenar
+ * @return Direccion del bloque
+ */
+void * memset(void * dest, int c, unsigned int n);
+
 
 #endif /* STDLIB_H_ */
@@ -0,0 +1,187 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ *
+ * @brief Contiene las definiciones de las tareas del kernel y del
+ * planificador.
+ * @details
+ * Cada tarea tiene un bloque de control (task_t) y una pila del kernel
+ * obtenida del asignador de unidades. El contexto de una tarea es el marco
+ * de interrupcion (interrupt_state) que las rutinas de isr.S almacenan en
+ * su pila: para cambiar de tarea, el planificador guarda current_esp en el
+ * bloque de control de la tarea actual y carga en current_esp el contexto
+ * de la siguiente, de forma que return_from_interrupt continua la
+ * ejecucion de la nueva tarea.
+ *
+ * La planificacion es expropiativa por prioridades: existe una cola FIFO de
+ * tareas listas por cada uno de los TASK_PRIORITIES niveles, y un mapa de
+ * bits indica cuales colas no se encuentran vacias. La siguiente tarea se
+ * toma de la cola de mayor prioridad, que se obtiene con bsr sobre el mapa
+ * de bits, por lo cual la seleccion es O(1) sin importar el numero de
+ * tareas. Dentro de un mismo nivel la planificacion es round-robin: el
+ * manejador del tick del timer (timer.c) cambia de tarea cada TASK_QUANTUM
+ * ticks. Una tarea tambien puede ceder el procesador con task_yield().
+ *
+ * La prioridad de una tarea varia alrededor de su prioridad base: baja un
+ * nivel cada vez que la tarea consume su quantum completo (tareas que usan
+ * intensivamente el procesador), y sube TASK_PRIORITY_BONUS niveles sobre
+ * la base cuando la tarea se despierta con task_wakeup() (tareas
+ * interactivas o que atienden una IRQ). Una tarea despertada con mayor
+ * prioridad que la actual la expropia de inmediato. Cada TASK_AGING_TICKS
+ * ticks las tareas que bajaron de su prioridad base la recuperan, con lo
+ * cual una tarea de menor prioridad base que otra que usa intensivamente el
+ * procesador tambien se ejecuta.
+ */
+
+#ifndef TASK_H_
+#define TASK_H_
+
+#include <idt.h>
+#include <generic_linked_list.h>
+#include <paging.h>
+
+/** @brief Tamao de la pila del kernel de cada tarea, 16 KB */
+#define TASK_STACK_SIZE 0x4000
+
+/** @brief Longitud maxima del nombre de una tarea, incluyendo el 0 final */
+#define TASK_NAME_LENGTH 16
+
+/** @brief Numero de ticks del timer que una tarea se ejecuta antes de ser
+ * expropiada */
+#define TASK_QUANTUM 2
+
+/** @brief Vector de interrupcion usado por task_yield() para invocar al
+ * planificador. Es el primer vector libre despues de las IRQ. */
+#define TASK_YIELD_INTERRUPT 48
+
+/** @brief Numero de niveles de prioridad. Cada nivel ocupa un bit del mapa
+ * de colas no vacias. */
+#define TASK_PRIORITIES 32
+
+/** @brief Prioridad base de las tareas creadas con create_task(). Los
+ * valores mayores tienen mayor prioridad. */
+#define TASK_PRIORITY_DEFAULT 16
+
+/** @brief Numero maximo de niveles que la prioridad de una tarea puede
+ * subir o bajar respecto a su prioridad base */
+#define TASK_PRIORITY_BONUS 4
+
+/** @brief Numero de ticks del timer entre dos restauraciones de la
+ * prioridad base de las tareas que se encuentran por debajo de ella */
+#define TASK_AGING_TICKS 100
+
+/** @brief La tarea se encuentra en la cola de tareas listas */
+#define TASK_READY 0
+/** @brief La tarea se encuentra en ejecucion */
+#define TASK_RUNNING 1
+/** @brief La tarea termino. Sus recursos se liberan luego. */
+#define TASK_FINISHED 2
+/** @brief La tarea espera a ser despertada con task_wakeup() */
+#define TASK_BLOCKED 3
+
+/** @brief Tipo de la rutina que ejecuta una tarea */
+typedef void (*task_entry)(void *);
+
+/** @brief Bloque de control de una tarea (TCB) */
+typedef struct task {
+	/** @brief Identificador de la tarea */
+	unsigned int id;
+	/** @brief Nombre de la tarea */
+	char name[TASK_NAME_LENGTH];
+	/** @brief Estado: TASK_READY, TASK_RUNNING, TASK_BLOCKED o
+	 * TASK_FINISHED */
+	int state;
+	/** @brief Prioridad actual, usada para seleccionar la cola */
+	int priority;
+	/** @brief Prioridad base, alrededor de la cual varia la prioridad */
+	int base_priority;
+	/** @brief 1 si la tarea fue despertada cuando no se encontraba
+	 * bloqueada: el siguiente task_block() retorna de inmediato */
+	int wakeup_pending;
+	/** @brief Marco de interrupcion almacenado en la pila de la tarea la
+	 * ultima vez que dejo de ejecutarse */
+	interrupt_state * context;
+	/** @brief Pila del kernel de la tarea, 0 para la tarea inicial */
+	char * stack;
+	/** @brief Directorio de paginas de la tarea */
+	page_directory_t * directory;
+	/** @brief Numero de ticks del timer durante los cuales se ha ejecutado */
+	unsigned int ticks;
+	/** @brief Numero de veces que ha sido seleccionada por el planificador */
+	unsigned int switches;
+	DEFINE_GENERIC_LIST_LINKS(task); /*Links genericos */
+}task_t;
+
+/** @brief Definicin de las primitivas para gestionar listas de tipo
+ * task_t*/
+DEFINE_GENERIC_LIST_TYPE(task_t, task);
+
+/** @brief Tarea en ejecucion */
+extern task_t * current_task;
+
+/** @brief Numero de ticks del timer desde que se inicializaron las tareas */
+extern unsigned int scheduler_ticks;
+
+/**
+ * @brief Inicializa el subsistema de tareas. El codigo que invoca esta
+ * rutina se convierte en la tarea inicial ("main"). Tambien crea la tarea
+ * ociosa e instala los manejadores del tick del timer y de task_yield().
+ * Se debe invocar luego de setup_timer().
+ */
+void setup_tasks(void);
+
+/**
+ * @brief Crea una tarea con prioridad TASK_PRIORITY_DEFAULT y la inserta al
+ * final de la cola de su prioridad.
+ * @param name Nombre de la tarea
+ * @param entry Rutina que ejecuta la tarea. Cuando retorna, la tarea
+ * termina.
+ * @param arg Parametro que recibe la rutina
+ * @return Bloque de control de la tarea, 0 si no existe memoria.
+ */
+task_t * create_task(char * name, task_entry entry, void * arg);
+
+/**
+ * @brief Establece la prioridad base de una tarea. Su prioridad actual se
+ * reinicia a la prioridad base.
+ * @param task Tarea
+ * @param priority Prioridad, entre 0 y TASK_PRIORITIES - 1
+ */
+void task_set_priority(task_t * task, int priority);
+
+/**
+ * @brief Cede el procesador a la siguiente tarea lista de igual o mayor
+ * prioridad.
+ */
+void task_yield(void);
+
+/**
+ * @brief Bloquea la tarea actual hasta que otra tarea o un manejador de
+ * interrupcion la despierte con task_wakeup(). Si la tarea ya fue
+ * despertada, retorna de inmediato.
+ */
+void task_block(void);
+
+/**
+ * @brief Despierta una tarea bloqueada y eleva su prioridad. Se puede
+ * invocar desde un manejador de interrupcion: si la tarea despertada tiene
+ * mayor prioridad que la actual, se ejecuta al retornar de la interrupcion.
+ * @param task Tarea a despertar
+ */
+void task_wakeup(task_t * task);
+
+/**
+ * @brief Termina la tarea actual. Esta rutina no retorna.
+ */
+void task_exit(void);
+
+/**
+ * @brief Selecciona la siguiente tarea a ejecutar. Se invoca desde un
+ * manejador de interrupcion: almacena el contexto de la tarea actual y
+ * establece current_esp al contexto de la nueva tarea.
+ */
+void schedule(void);
+
+#endif /* TASK_H_ */
@@ -0,0 +1,188 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ *
+ * @brief Contiene las definiciones del timer del sistema (PIT 8254) y de
+ * los temporizadores del kernel.
+ * @details
+ * El canal 0 del PIT se programa en setup_timer() para generar la IRQ0
+ * timer_hz veces por segundo. Cada IRQ0 notifica al manejador del tick
+ * instalado con install_tick_handler() (el planificador), y luego incrementa
+ * el contador monotono timer_ticks y ejecuta los temporizadores que
+ * expiran.
+ *
+ * Los temporizadores pendientes se almacenan en una rueda jerarquica: la
+ * rueda raiz tiene una ranura por cada uno de los siguientes
+ * TIMER_ROOT_SLOTS ticks, y cada uno de los TIMER_LEVELS niveles siguientes
+ * tiene TIMER_LEVEL_SLOTS ranuras que cubren rangos cada vez mayores. Un
+ * temporizador se inserta en la ranura que corresponde a su tiempo de
+ * expiracion, y cuando la rueda de un nivel completa una vuelta, la
+ * siguiente ranura del nivel superior se redistribuye en los niveles
+ * inferiores. Insertar, cancelar y expirar un temporizador es O(1) sin
+ * importar el numero de temporizadores pendientes.
+ *
+ * Cuando el procesador no tiene tareas listas, timer_enter_idle() programa
+ * el PIT en modo one-shot hasta el siguiente temporizador, de forma que el
+ * procesador no recibe una IRQ0 en cada tick. Como el contador del PIT es
+ * de 16 bits, un one-shot dura maximo PIT_MAX_COUNT ciclos (55 ms), y al
+ * terminar se programa el siguiente.
+ */
+
+#ifndef TIMER_H_
+#define TIMER_H_
+
+#include <generic_linked_list.h>
+
+/** @brief Frecuencia de la IRQ0 usada por el kernel, en Hz. Se puede
+ * seleccionar al compilar, por ejemplo con -DTIMER_HZ=1000 */
+#ifndef TIMER_HZ
+#define TIMER_HZ 100
+#endif
+
+/** @brief Frecuencia de la seal de reloj del PIT, en Hz */
+#define PIT_FREQUENCY 1193182
+
+/** @brief Puerto de datos del canal 0 del PIT */
+#define PIT_CHANNEL0_PORT 0x40
+
+/** @brief Puerto de comandos del PIT */
+#define PIT_COMMAND_PORT 0x43
+
+/** @brief Comando del PIT: canal 0, byte bajo y alto, modo 0 (interrupcion
+ * al terminar la cuenta) */
+#define PIT_MODE_ONESHOT 0x30
+
+/** @brief Comando del PIT: canal 0, byte bajo y alto, modo 2 (generador de
+ * frecuencia) */
+#define PIT_MODE_PERIODIC 0x34
+
+/** @brief Comando del PIT: almacenar (latch) la cuenta actual del canal 0 */
+#define PIT_LATCH 0x00
+
+/** @brief Cuenta maxima del PIT */
+#define PIT_MAX_COUNT 0xFFFF
+
+/** @brief Cuenta minima restante del PIT para reprogramarlo. Con una cuenta
+ * menor, la IRQ0 ya ocurrio o esta por ocurrir. */
+#define PIT_ONESHOT_MARGIN 32
+
+/** @brief Numero de bits del indice de la rueda raiz */
+#define TIMER_ROOT_BITS 8
+
+/** @brief Numero de ranuras de la rueda raiz */
+#define TIMER_ROOT_SLOTS (1 << TIMER_ROOT_BITS)
+
+/** @brief Numero de bits del indice de los niveles superiores */
+#define TIMER_LEVEL_BITS 6
+
+/** @brief Numero de ranuras de cada nivel superior */
+#define TIMER_LEVEL_SLOTS (1 << TIMER_LEVEL_BITS)
+
+/** @brief Numero de niveles superiores. Junto con la rueda raiz cubren los
+ * 32 bits de timer_ticks. */
+#define TIMER_LEVELS 4
+
+/** @brief Numero maximo de ticks de un temporizador */
+#define TIMER_MAX_TICKS 0x7FFFFFFF
+
+/** @brief Rutina que se ejecuta al expirar un temporizador. Se invoca desde
+ * el manejador de la IRQ0, con las interrupciones deshabilitadas. */
+typedef void (*timer_callback)(void *);
+
+/** @brief Rutina que recibe el numero de ticks transcurridos en cada IRQ0.
+ * Es mayor que 1 al terminar un one-shot. */
+typedef void (*timer_tick_handler)(unsigned int);
+
+/** @brief Temporizador del kernel. La memoria del temporizador pertenece a
+ * quien lo usa, y no se debe liberar mientras se encuentre pendiente. */
+typedef struct timer {
+	/** @brief Tick en el cual expira */
+	unsigned int expires;
+	/** @brief Rutina que se ejecuta al expirar */
+	timer_callback callback;
+	/** @brief Parametro de la rutina */
+	void * arg;
+	/** @brief Ranura de la rueda en la cual se encuentra, 0 si el
+	 * temporizador no esta pendiente */
+	struct typelist_timer * list;
+	DEFINE_GENERIC_LIST_LINKS(timer); /*Links genericos */
+}timer_t;
+
+/** @brief Definicin de las primitivas para gestionar listas de tipo
+ * timer_t*/
+DEFINE_GENERIC_LIST_TYPE(timer_t, timer);
+
+/** @brief Numero de ticks desde que se programo el PIT, acreditados por la
+ * IRQ0. Durante un one-shot no cuenta los ticks transcurridos desde la ultima
+ * IRQ0; timer_now() retorna el tick actual. */
+extern unsigned int timer_ticks;
+
+/** @brief Frecuencia de los ticks, en Hz */
+extern unsigned int timer_hz;
+
+/**
+ * @brief Programa el canal 0 del PIT e instala el manejador de la IRQ0.
+ * @param hz Frecuencia de los ticks, entre 19 Hz y PIT_FREQUENCY. Los
+ * valores por fuera del rango se ajustan.
+ */
+void setup_timer(unsigned int hz);
+
+/**
+ * @brief Inicializa un temporizador que no se encuentra pendiente.
+ * @param timer Temporizador
+ */
+void init_timer(timer_t * timer);
+
+/**
+ * @brief Programa un temporizador. Si ya se encontraba pendiente, se
+ * reprograma.
+ * @param timer Temporizador, inicializado con init_timer()
+ * @param ticks Numero de ticks hasta la expiracion, entre 1 y
+ * TIMER_MAX_TICKS. Los valores por fuera del rango se ajustan.
+ * @param callback Rutina que se ejecuta al expirar
+ * @param arg Parametro de la rutina
+ * @return 0 si el temporizador se programo, -1 si los parametros no son
+ * validos.
+ */
+int timer_add(timer_t * timer, unsigned int ticks, timer_callback callback,
+		void * arg);
+
+/**
+ * @brief Obtiene el numero de ticks desde que se programo el PIT, incluidos
+ * los que aun no ha acreditado un one-shot en curso.
+ * @return Numero de ticks
+ */
+unsigned int timer_now(void);
+
+/**
+ * @brief Cancela un temporizador pendiente.
+ * @param timer Temporizador
+ * @return 0 si el temporizador se cancelo, -1 si no se encontraba
+ * pendiente.
+ */
+int timer_cancel(timer_t * timer);
+
+/**
+ * @brief Instala la rutina que se invoca en cada IRQ0, antes de ejecutar
+ * los temporizadores que expiran.
+ * @param handler Rutina, 0 para desinstalarla
+ */
+void install_tick_handler(timer_tick_handler handler);
+
+/**
+ * @brief Programa el PIT en modo one-shot hasta el siguiente temporizador
+ * (o la cuenta maxima del PIT). Se invoca cuando el procesador no tiene
+ * tareas listas, antes de detenerlo con hlt.
+ */
+void timer_enter_idle(void);
+
+/**
+ * @brief Acorta el one-shot en curso para que termine en el siguiente
+ * tick, luego del cual el PIT vuelve al modo periodico. Se invoca cuando
+ * una tarea se encuentra lista.
+ */
+void timer_exit_idle(void);
+
+#endif /* TIMER_H_ */
@@ -26,6 +26,10 @@ idt_ptr idt_pointer;
  * en este arreglo. */
 interrupt_handler interrupt_handlers[MAX_IDT_ENTRIES];
 
+/** @brief Numero de manejadores de interrupcion en ejecucion. Es mayor que
+ * 1 si una excepcion ocurre dentro de otro manejador. */
+unsigned int interrupt_nesting;
+
 /**
  * @brief Esta rutina permite determinar si dos selectores
  * se encuentran en el mismo nivel de privilegios.
@@ -152,7 +156,9 @@ void interrupt_dispatcher() {
 
 	/* Si la rutina existe, ejecutarla y pasarle como parametro los registros.*/
 	if (handler != NULL_INTERRUPT_HANDLER) {
+		interrupt_nesting++;
 		handler(state);
+		interrupt_nesting--;
 	} else {
 		/* En caso contrario, informar que ocurrio una interrupcion
 		 * que no tiene un manejador asociado.*/
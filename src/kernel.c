@@ -25,11 +25,118 @@
 #include <stdlib.h>
 #include <idt.h>
 #include <physmem.h>
+#include <kmm.h>
+#include <paging.h>
+#include <task.h>
+#include <timer.h>
+#include <asm.h>
 
 /** @brief Variable global del kernel que almacena la localizacion de la
  * estructura multiboot */
 unsigned int multiboot_info_location;
 
+/** @brief Numero de bloques que asigna check_heap_trim(). Ocupan el doble de
+ * HEAP_TRIM_SIZE, para que su liberacion contraiga el heap. */
+#define TRIM_CHECK_BLOCKS (2 * HEAP_TRIM_SIZE / KMALLOC_LARGE_SIZE)
+
+/**
+ * @brief Verifica que el heap del kernel libera las paginas de su final:
+ * asigna bloques que ocupan mas de HEAP_TRIM_SIZE bytes y los libera en
+ * orden inverso, con lo cual la region libre al final del heap crece hasta
+ * que el heap se contrae. La pagina del ultimo bloque debe quedar sin mapear.
+ */
+static void check_heap_trim(void) {
+	char * blocks[TRIM_CHECK_BLOCKS];
+	unsigned int page;
+	int i;
+
+	for (i = 0; i < TRIM_CHECK_BLOCKS; i++) {
+		blocks[i] = (char*)kmalloc(KMALLOC_LARGE_SIZE);
+		if (blocks[i] == 0) {
+			printf("Heap trim check: kmalloc failed\n");
+			while (--i >= 0) {
+				kfree(blocks[i]);
+			}
+			return;
+		}
+		memset(blocks[i], i, KMALLOC_LARGE_SIZE);
+	}
+
+	page = (unsigned int)blocks[TRIM_CHECK_BLOCKS - 1];
+
+	for (i = TRIM_CHECK_BLOCKS - 1; i >= 0; i--) {
+		kfree(blocks[i]);
+	}
+
+	if (virt_to_phys(kernel_directory, page) != PAGE_NOT_MAPPED) {
+		printf("Heap trim check failed: page 0x%x is still mapped\n", page);
+	}else {
+		printf("Heap trim check passed\n");
+	}
+}
+
+/**
+ * @brief Tarea de prueba: asigna y libera memoria del heap del kernel
+ * mientras el planificador la alterna con las demas tareas.
+ * @param arg Numero de iteraciones
+ */
+static void worker(void * arg) {
+	unsigned int iterations;
+	unsigned int flags;
+	unsigned int i;
+	char * ptr;
+
+	iterations = (unsigned int)arg;
+
+	for (i = 0; i < iterations; i++) {
+		ptr = (char*)kmalloc(16 + (i % 64) * 32);
+		if (ptr != 0) {
+			memset(ptr, i, 16);
+			kfree(ptr);
+		}
+	}
+
+	/* La consola no es reentrante */
+	flags = save_interrupts();
+	printf("Task %s finished: %u iterations, %u ticks, %u switches\n",
+			current_task->name, iterations, current_task->ticks,
+			current_task->switches);
+	restore_interrupts(flags);
+}
+
+/** @brief Temporizador que despierta a la tarea reporter */
+static timer_t reporter_timer;
+
+/**
+ * @brief Rutina del temporizador: despierta la tarea que lo programo.
+ * @param arg Tarea a despertar
+ */
+static void reporter_expired(void * arg) {
+	task_wakeup((task_t *)arg);
+}
+
+/**
+ * @brief Tarea de prueba: se bloquea un segundo en cada iteracion, mientras
+ * las demas tareas usan el procesador.
+ * @param arg Numero de iteraciones
+ */
+static void reporter(void * arg) {
+	unsigned int flags;
+	unsigned int i;
+
+	init_timer(&reporter_timer);
+
+	for (i = 0; i < (unsigned int)arg; i++) {
+		timer_add(&reporter_timer, timer_hz, reporter_expired, current_task);
+		task_block();
+
+		flags = save_interrupts();
+		printf("Reporter: %u ticks, priority %d\n", timer_now(),
+				current_task->priority);
+		restore_interrupts(flags);
+	}
+}
+
 /**
  * @brief Funcin principal del kernel. Esta rutina recibe el control del
  * codigo en ensamblador de start.S.
@@ -65,6 +172,18 @@ void cmain(unsigned int magic, void * multiboot_info) {
 	/* Configurar el mapa de bits de memoria del kernel */
 	setup_memory();
 
+	/* Mapear el kernel por identidad y habilitar la paginacion */
+	setup_paging();
+
+	/* Crear el heap del kernel, cuyas paginas se asignan bajo demanda */
+	setup_kernel_heap();
+
+	/* Programar el PIT */
+	setup_timer(TIMER_HZ);
+
+	/* Convertir cmain en la tarea inicial e instalar el planificador */
+	setup_tasks();
+
 	printf("Kernel started\n");
 
 	/* Probar la gestion de unidades de memoria */
@@ -83,8 +202,20 @@ void cmain(unsigned int magic, void * multiboot_info) {
 
 	printf("Last allocated address: %x, %u\n",addr, addr);
 
+	/* Probar la contraccion del heap del kernel */
+	check_heap_trim();
+
+	/* Probar la planificacion por prioridades con tareas concurrentes */
+	create_task("worker1", worker, (void*)200000);
+	task_set_priority(create_task("worker2", worker, (void*)100000),
+			TASK_PRIORITY_DEFAULT - 2);
+	create_task("reporter", reporter, (void*)5);
+
 	inline_assembly("sti");
 
 	printf("Kernel finished\n");
 
+	/* Terminar la tarea inicial en lugar de retornar al ciclo de start.S,
+	 * que la mantendria lista e impediria ejecutar la tarea ociosa */
+	task_exit();
 }
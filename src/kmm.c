@@ -8,21 +8,171 @@
  */
 
 #include <kmm.h>
+#include <stdio.h>
 
 /** @brief Funcin para comparar dos regiones de memoria */
 int compare_memreg_header_t(memreg_header_t * a, memreg_header_t *b) {
-    return b->limit - a->limit;
+    return MEMREG_LIMIT(b) - MEMREG_LIMIT(a);
 }
 
 /** @brief Funcin para comparar una regin de memoria con un escalar */
 int equals_memreg_header_t(memreg_header_t * a, void *b) {
-    return (unsigned int)b - (unsigned int)a->base;
+    return (unsigned int)b - MEMREG_DATA(a);
 }
 
 /** @brief Implementacin de las primitivas para gestionar listas de tipo
  * memreg_header_t*/
 IMPLEMENT_GENERIC_LIST_TYPE(memreg_header_t, memreg_header);
 
+/** @brief Implementacin de las primitivas para gestionar las quick-lists */
+IMPLEMENT_GENERIC_SLIST_TYPE(memreg_header_t, memreg_quick);
+
+/**
+ * @brief Calcula la clase de tamao a la cual pertenece una region libre.
+ * @param limit Tamao de la region
+ * @return Clase de tamao, HEAP_SIZE_CLASSES si la region pertenece a la
+ * lista general de regiones libres.
+ */
+static __inline__ int memreg_class(unsigned int limit) {
+	if (limit >= HEAP_CLASS_LIMIT) {
+		return HEAP_SIZE_CLASSES;
+	}
+	/* Posicion del bit mas significativo (bsr) relativa a la granularidad */
+	return __builtin_clz(MEMREG_GRANULARITY) - __builtin_clz(limit);
+}
+
+/**
+ * @brief Compara dos regiones libres por (tamao, direccion). Este es el
+ * orden del arbol de regiones libres de la politica HEAP_BEST_FIT.
+ * @return Valor negativo si a es menor que b, 0 si son la misma region,
+ * valor positivo si a es mayor que b.
+ */
+int compare_memreg_tree(memreg_header_t * a, memreg_header_t * b) {
+	if (MEMREG_LIMIT(a) != MEMREG_LIMIT(b)) {
+		return (MEMREG_LIMIT(a) < MEMREG_LIMIT(b)) ? -1 : 1;
+	}
+	if (a != b) {
+		return ((unsigned int)a < (unsigned int)b) ? -1 : 1;
+	}
+	return 0;
+}
+
+/**
+ * @brief Compara el tamao de una region libre con un tamao solicitado.
+ * Permite buscar con lower_bound la region mas pequea de tamao mayor o
+ * igual al solicitado, y entre las regiones de ese tamao la de menor
+ * direccion.
+ * @return Valor negativo si la region es menor que el tamao, 0 si es
+ * igual, valor positivo si es mayor.
+ */
+int compare_key_memreg_tree(memreg_header_t * a, void * size) {
+	if (MEMREG_LIMIT(a) != (unsigned int)size) {
+		return (MEMREG_LIMIT(a) < (unsigned int)size) ? -1 : 1;
+	}
+	return 0;
+}
+
+/** @brief Implementacin de las primitivas para gestionar arboles de tipo
+ * memreg_header_t*/
+IMPLEMENT_GENERIC_RBTREE_TYPE(memreg_header_t, memreg_tree);
+
+/**
+ * @brief Inserta una region en el arbol de regiones libres, o en la lista
+ * de regiones libres que le corresponde de acuerdo con su tamao.
+ * @param heap Heap al cual pertenece la region
+ * @param header Encabezado de la region libre
+ */
+static void insert_free_memreg(heap_t * heap, memreg_header_t * header) {
+	int class;
+
+	heap->free_count++;
+	heap->free_bytes += MEMREG_LIMIT(header);
+
+	if (heap->policy == HEAP_BEST_FIT) {
+		tree_insert_memreg_tree(&heap->tree, header);
+		return;
+	}
+
+	class = memreg_class(MEMREG_LIMIT(header));
+
+	if (class < HEAP_SIZE_CLASSES) {
+		push_front_memreg_header(&heap->classes[class], header);
+		heap->class_map |= 1 << class;
+	}else {
+		push_front_memreg_header(heap->free, header);
+	}
+}
+
+/**
+ * @brief Extrae una region del arbol o de la lista de regiones libres en la
+ * cual se encuentra. Se debe invocar antes de modificar el tamao de la
+ * region.
+ * @param heap Heap al cual pertenece la region
+ * @param header Encabezado de la region libre
+ */
+static void remove_free_memreg(heap_t * heap, memreg_header_t * header) {
+	int class;
+
+	heap->free_count--;
+	heap->free_bytes -= MEMREG_LIMIT(header);
+
+	if (heap->policy == HEAP_BEST_FIT) {
+		tree_remove_memreg_tree(&heap->tree, header);
+		return;
+	}
+
+	class = memreg_class(MEMREG_LIMIT(header));
+
+	if (class < HEAP_SIZE_CLASSES) {
+		remove_memreg_header(&heap->classes[class], header);
+		if (heap->classes[class].head == 0) {
+			heap->class_map &= ~(1 << class);
+		}
+	}else {
+		remove_memreg_header(heap->free, header);
+	}
+}
+
+/**
+ * @brief Busca una region libre de tamao mayor o igual al solicitado.
+ * Con la politica HEAP_BEST_FIT se busca en el arbol de regiones libres.
+ * Con HEAP_FIRST_FIT primero se busca en la menor clase de tamao no vacia en la cual todas
+ * las regiones tienen el tamao suficiente (O(1) mediante bsf sobre
+ * class_map). Si no existe, se recorre la lista general.
+ * @param heap Heap en el cual se busca la region
+ * @param size Tamao solicitado
+ * @return Encabezado de la region encontrada, 0 si no existe.
+ */
+static memreg_header_t * find_free_memreg(heap_t * heap, unsigned int size) {
+	memreg_header_t * candidate;
+	unsigned int classes;
+	int class;
+
+	if (heap->policy == HEAP_BEST_FIT) {
+		return tree_lower_bound_memreg_tree(&heap->tree, (void *)size);
+	}
+
+	/* Menor clase cuyo tamao minimo es mayor o igual a size */
+	class = memreg_class(size);
+	if (class < HEAP_SIZE_CLASSES && (MEMREG_GRANULARITY << class) < size) {
+		class++;
+	}
+
+	if (class < HEAP_SIZE_CLASSES) {
+		classes = heap->class_map & ~((1 << class) - 1);
+		if (classes != 0) {
+			return heap->classes[__builtin_ctz(classes)].head;
+		}
+	}
+
+	candidate = heap->free->head;
+	while (candidate != 0 && MEMREG_LIMIT(candidate) < size ) {
+		candidate = candidate->next_memreg_header;
+	}
+
+	return candidate;
+}
+
 /**
  * @brief Esta rutina se encarga de inicializar el area de memoria
  * para asignacion dinamica, y las estructuras de datos requeridas para su
@@ -42,7 +192,7 @@ heap_t * setup_heap(void * ptr, unsigned int limit) {
 
 	base = (unsigned int)ptr;
 	
-	heap = create_heap(base, limit);
+	heap = create_heap(base, limit, HEAP_DEFAULT_POLICY);
 
 	return heap;
 }
@@ -54,9 +204,10 @@ heap_t * setup_heap(void * ptr, unsigned int limit) {
  * de memoria creadas anteriormente.
  * @param base Direccin lineal de inicio del heap
  * @param limit Tamao de la regin de memoria para asignacin dinmica.
+ * @param policy Politica de asignacion: HEAP_FIRST_FIT o HEAP_BEST_FIT
  * @return Apuntador al nuevo heap
  */
-heap_t *  create_heap(unsigned int base, unsigned int limit) {
+heap_t *  create_heap(unsigned int base, unsigned int limit, int policy) {
 
 	/** @note Esta rutina asume que la region de memoria especificada es
 	 * vlida, y que no est sobreescribiendo otro heap.
@@ -110,19 +261,85 @@ heap_t *  create_heap(unsigned int base, unsigned int limit) {
 
 	/* Establecer los parametros iniciales del heap */
 
-	/* Inicio del espacio disponible */
-	heap->base = base + offset;
-	heap->limit = limit - offset; /* Tamanio a asignar */
+	/* Inicio del espacio disponible, alineado a MEMREG_GRANULARITY */
+	heap->base = (base + offset + MEMREG_FLAGS) & ~MEMREG_FLAGS;
+	/* Tamanio a asignar. Se reserva el espacio de la palabra final */
+	heap->limit = (base + limit - heap->base - MEMREG_HEADER_SIZE)
+			& ~MEMREG_FLAGS;
 	heap->top = heap->base; /* Inicializar el tope del heap */
 
+	/* Palabra final del heap: la primera region no tiene una region
+	 * anterior con la cual se pueda fusionar */
+	((memreg_header_t *)heap->top)->size = MEMREG_USED | MEMREG_PREV_USED;
+
 	init_list_memreg_header(heap->free); /* Inicializar la lista de libres */
  //init_list_memreg_header(heap->used); /* Inicializar la lista de usadas */
 
+	/* Inicializar las listas segregadas por clase de tamao */
+	for (i = 0; i < HEAP_SIZE_CLASSES; i++) {
+		init_list_memreg_header(&heap->classes[i]);
+	}
+	heap->class_map = 0;
+	heap->free_count = 0;
+
+	/* Inicializar el arbol de regiones libres */
+	heap->policy = policy;
+	init_tree_memreg_tree(&heap->tree);
+
+	/* Por defecto el heap tiene un tamao fijo */
+	heap->grow = 0;
+	heap->shrink = 0;
+
+	/* Inicializar las estadisticas */
+	heap->used_bytes = 0;
+	heap->free_bytes = 0;
+	heap->allocs = 0;
+	heap->frees = 0;
+	heap->splits = 0;
+	heap->coalesces = 0;
+	heap->expands = 0;
+	heap->contracts = 0;
+	heap->failures = 0;
+
+	/* Inicializar las quick-lists */
+	for (i = 0; i < HEAP_QUICK_LISTS; i++) {
+		init_slist_memreg_quick(&heap->quick[i]);
+	}
+	heap->quick_map = 0;
+	heap->quick_bytes = 0;
+	heap->quick_budget = HEAP_DEFAULT_QUICK_BUDGET;
+	heap->quick_flushes = 0;
+
 	return heap;
 }
 
+/**
+ * @brief Escribe la palabra final del heap en la posicion actual del tope.
+ * @param heap Heap
+ * @param prev_used MEMREG_PREV_USED si la ultima region esta asignada, 0 si
+ * esta libre
+ */
+static __inline__ void set_heap_end(heap_t * heap, unsigned int prev_used) {
+	((memreg_header_t *)heap->top)->size = MEMREG_USED | prev_used;
+}
+
+/**
+ * @brief Marca una region como libre: escribe su pie y borra el indicador
+ * MEMREG_PREV_USED de la region siguiente.
+ * @param header Encabezado de la region
+ */
+static __inline__ void mark_free_memreg(memreg_header_t * header) {
+	header->size &= ~MEMREG_USED;
+	MEMREG_FOOTER(header)->header = header;
+	MEMREG_NEXT(header)->size &= ~MEMREG_PREV_USED;
+}
+
 /**
  * @brief Funcin privada para expandir el heap en un tamao especificado.
+ * Si no existe espacio suficiente y el heap tiene una rutina grow, primero
+ * se extiende el espacio disponible del heap.
+ * Si la ultima region del heap se encuentra libre, solo se solicita el
+ * espacio que le hace falta y la nueva region se fusiona con ella.
  * @param heap Heap que se desea expandir
  * @param limit  Tamanio a expandir.
  * @return Puntero al encabezado de la nueva region de memoria, 0 si no es
@@ -132,9 +349,11 @@ heap_t *  create_heap(unsigned int base, unsigned int limit) {
 memreg_header_t * expand_heap(heap_t * heap, unsigned int limit) {
 
 	memreg_header_t * header;
-	memreg_footer_t * footer;
+	memreg_header_t * last;
+	memreg_footer_t * last_footer;
 
 	unsigned int space_available;
+	unsigned int requested;
 
 	if (heap == 0) {
 		//printf("Heap not created yet!\n");
@@ -142,14 +361,39 @@ memreg_header_t * expand_heap(heap_t * heap, unsigned int limit) {
 	}
 
 	/* Verificar el tamano minimo asignado */
-	if (limit < MEMREG_GRANULARITY) {
-		limit = MEMREG_GRANULARITY;
+	limit = (limit + MEMREG_FLAGS) & ~MEMREG_FLAGS;
+	if (limit < MEMREG_MIN_LIMIT) {
+		limit = MEMREG_MIN_LIMIT;
+	}
+
+	header = (memreg_header_t * )(heap->top);
+
+	/* Si la ultima region esta libre, la nueva region se fusiona con ella,
+	 * por lo cual solo se requiere el espacio faltante */
+	last = 0;
+	requested = limit;
+	if (heap->top > heap->base && !(header->size & MEMREG_PREV_USED)) {
+		last_footer = (memreg_footer_t *)(heap->top - MEMREG_FOOTER_SIZE);
+		last = last_footer->header;
+		if (MEMREG_LIMIT(last) + MEMREG_HEADER_SIZE + MEMREG_MIN_LIMIT
+				>= limit) {
+			requested = MEMREG_MIN_LIMIT;
+		}else {
+			requested = limit - MEMREG_LIMIT(last) - MEMREG_HEADER_SIZE;
+		}
 	}
 
 	space_available = heap->base + heap->limit - heap->top;
 
+	/* Extender el heap si no existe espacio suficiente */
+	if (space_available < MEMREG_HEADER_SIZE + requested && heap->grow != 0
+			&& heap->grow(heap, MEMREG_HEADER_SIZE + requested
+					- space_available)) {
+		space_available = heap->base + heap->limit - heap->top;
+	}
+
 	/* Verificar si existe suficiente espacio para la region solicitada */
-	if (space_available < MEMREG_HEADER_SIZE + limit + MEMREG_FOOTER_SIZE) {
+	if (space_available < MEMREG_HEADER_SIZE + requested) {
 		/*
 		printf("No space available. Requested: %d available: %d\n",
 					limit,
@@ -159,34 +403,75 @@ memreg_header_t * expand_heap(heap_t * heap, unsigned int limit) {
 		return 0;
 	}
 
-	/* Crear la nueva region de memoria e insertarla en
-	 * la lista de regiones disponibles */
-	header = (memreg_header_t * )(heap->top);
-	header->base = (unsigned int)header + MEMREG_HEADER_SIZE;
-	header->limit = limit;
-	header->used = 0;
-	header->next_memreg_header = 0;
-	header->prev_memreg_header = 0;
-
-	footer = (memreg_footer_t *)(header->base + header->limit);
-	footer->base = header->base;
-	footer->header = header;
+	/* Crear la nueva region de memoria, conservando el indicador de la
+	 * region anterior que se encontraba en la palabra final */
+	header->size = requested | (header->size & MEMREG_PREV_USED);
 
 	/* Expandir el heap */
-	//printf("Top of heap expanded from %u", heap->top);
-	heap->top  = (unsigned int)footer+ MEMREG_FOOTER_SIZE;
-	//printf(" to %u\n", heap->top);
-
+	heap->top = (unsigned int)MEMREG_NEXT(header);
+	set_heap_end(heap, 0);
+	MEMREG_FOOTER(header)->header = header;
+	heap->expands++;
+
+	/* Fusionar con la ultima region libre */
+	if (last != 0) {
+		remove_free_memreg(heap, last);
+		last->size += MEMREG_SIZE(requested);
+		MEMREG_FOOTER(last)->header = last;
+		header = last;
+		heap->coalesces++;
+	}
 
 	/* Insertar la region en la lista de regiones disponibles */
-	push_front_memreg_header(heap->free, header);
+	insert_free_memreg(heap, header);
+	return header;
+}
+
+/**
+ * @brief Inserta una region asignada en la quick-list de su tamao. La
+ * region continua marcada como asignada, por lo cual no se fusiona con las
+ * regiones adyacentes.
+ * @param heap Heap al cual pertenece la region
+ * @param header Encabezado de la region, de tamao menor o igual a
+ * HEAP_QUICK_MAX_SIZE
+ */
+static __inline__ void push_quick_memreg(heap_t * heap,
+		memreg_header_t * header) {
+	int i;
+
+	i = HEAP_QUICK_INDEX(MEMREG_LIMIT(header));
+	header->size |= MEMREG_CACHED;
+	slist_push_memreg_quick(&heap->quick[i], header);
+	heap->quick_map |= 1 << i;
+	heap->quick_bytes += MEMREG_LIMIT(header);
+}
+
+/**
+ * @brief Extrae la primera region de una quick-list.
+ * @param heap Heap
+ * @param i Quick-list, no vacia
+ * @return Encabezado de la region, marcada como asignada
+ */
+static __inline__ memreg_header_t * pop_quick_memreg(heap_t * heap, int i) {
+	memreg_header_t * header;
+
+	header = slist_pop_memreg_quick(&heap->quick[i]);
+	header->size &= ~MEMREG_CACHED;
+	if (heap->quick[i].head == 0) {
+		heap->quick_map &= ~(1 << i);
+	}
+	heap->quick_bytes -= MEMREG_LIMIT(header);
+
 	return header;
 }
 
 /**
  * @brief Solicita la asignacion de memoria dentro de un heap.
- * Primero se busca dentro de las regiones libres, una que tenga
- * un tamao cercano al buscado. Si no existe una region, expande el heap.
+ * Si el heap usa fusion diferida, primero se busca una region del mismo
+ * tamao en las quick-lists.
+ * Luego se busca dentro de las regiones libres, una que tenga
+ * un tamao cercano al buscado. Si no existe una region, se fusionan las
+ * quick-lists y se busca de nuevo; si aun no existe, expande el heap.
  * Si existe suficiente espacio adicional al buscado dentro de la region, esta
  * region se divide en dos: una region asignada, que se retorna, y una
  * region libre con el espacio sobrante.
@@ -199,37 +484,48 @@ void * alloc_from_heap(heap_t * heap, unsigned int size) {
 
 	/* Region candidata a asignar */
 	memreg_header_t * candidate = 0;
-	
-	/* Apuntador al pie original de la region candidata */
-	memreg_footer_t * candidate_footer;
 
 	/* Tamanio original de la region de memoria candidata a asignar */
 	unsigned int candidate_limit;
 
-	/* Apuntadores al nuevo encabezado y pie, si se requiere partir
+	/* Apuntador al nuevo encabezado, si se requiere partir
 	 * una region de memoria libre */
-
-	/* Apuntador al nuevo encabezado */
 	memreg_header_t * new_header;
-	/* Apuntador al nuevo pie */
-	memreg_footer_t * new_footer;
-
-	unsigned int requested_size = 0;
 
 	/* Verificar que el tamao solicitado sea mayor o igual que el minimo
-	 * tamao que se puede asignar */
+	 * tamao que se puede asignar. Una region asignada debe tener espacio
+	 * para sus enlaces y su pie cuando se libere. */
 
-	if (size < MEMREG_GRANULARITY) {
-		size = MEMREG_GRANULARITY;
+	if (size > heap->limit) {
+		heap->failures++;
+		return 0;
+	}
+
+	size = (size + MEMREG_FLAGS) & ~MEMREG_FLAGS;
+	if (size < MEMREG_MIN_LIMIT) {
+		size = MEMREG_MIN_LIMIT;
+	}
+
+	/* Reutilizar una region del mismo tamao que se encuentre en las
+	 * quick-lists. La region ya esta marcada como asignada. */
+	if (size <= HEAP_QUICK_MAX_SIZE &&
+			heap->quick[HEAP_QUICK_INDEX(size)].head != 0) {
+		candidate = pop_quick_memreg(heap, HEAP_QUICK_INDEX(size));
+		heap->allocs++;
+		heap->used_bytes += size;
+		return (void *)MEMREG_DATA(candidate);
 	}
 
 	/* Ahora buscar una region marcada como libre, que tenga
 	 * un tamano mayor o igual a la cantidad  solicitada.
 	 */
 
-	candidate = heap->free->head;
-	while (candidate != 0 && candidate->limit < size ) {
-		candidate = candidate->next_memreg_header;
+	candidate = find_free_memreg(heap, size);
+
+	/* Antes de expandir el heap, fusionar las regiones de las quick-lists */
+	if (candidate == 0 && heap->quick_map != 0) {
+		heap_flush_quick(heap);
+		candidate = find_free_memreg(heap, size);
 	}
 
 	/* No existe una region candidata, tratar de expandir  el heap */
@@ -242,325 +538,726 @@ void * alloc_from_heap(heap_t * heap, unsigned int size) {
 	/* No existe region candidata luego de expandir el heap? */
 	if (candidate == 0) {
 		//printf("Unable to expand the heap in %d bytes!\n", size);
+		heap->failures++;
 		return 0; /* No se puede asignar memoria! */
 	}
 
 	/* La region candidata se encuentra en la lista de regiones disponibles,
 	 * primero extraerla de la lista */
-	remove_memreg_header(heap->free, candidate);
-
-	//printf("Candidate region for allocating %u bytes: ", size);
-	//print_memory_region(candidate);
+	remove_free_memreg(heap, candidate);
 
-	/* Marcar la region como usada */
-	candidate->used = 1;
+	candidate_limit = MEMREG_LIMIT(candidate);
 
 	/* La region candidata se debe partir? */
-	if (candidate->limit - size >=
-		MEMREG_FOOTER_SIZE + MEMREG_MIN_SIZE) {
-
-		/*
-		printf("Attempting to split existing memory region [%u]\n",
-				(unsigned int)candidate);
-		*/
+	if (candidate_limit - size >= MEMREG_MIN_SIZE) {
 
-		/* Almacenar el tamao original de la region candidata */
-		candidate_limit = candidate->limit;
-
-		/* Recuperar el pie original, para actualizarlo mas adelante */
-		candidate_footer = (memreg_footer_t *)(candidate->base +
-								candidate_limit);
-
-		/* Y actualizar el nuevo tamao de la region candidata */
-		candidate->limit = size;
-
-		/* Validacion: Verificar si el footer original es valido. */
-
-		if (candidate_footer->header != candidate
-				|| candidate_footer->base != candidate->base) {
-			//printf("Error reading old footer!\n");
-			return 0;
-		}
-
-		/* Crear el nuevo footer para la region de memoria asignada,
-		 * usando el tamano solicitado */
-		new_footer = (memreg_footer_t *)(candidate->base +  size);
-		new_footer->base = candidate->base;
-		new_footer->header = candidate;
-
-		//printf("New footer at %u\n", new_footer);
-
-
-		/*
-		 printf("Splitting region ending at %u. Top=%u. Is this the last region?\n",
-				(unsigned int)candidate_footer +
-				MEMREG_FOOTER_SIZE, heap->top);
-		*/
+		/* Actualizar el tamao de la region candidata y marcarla como
+		 * usada */
+		candidate->size = size | MEMREG_USED |
+				(candidate->size & MEMREG_PREV_USED);
 
 		/* Crear el nuevo header, para la region de memoria restante.
-		 * Este header se ubica inmediatamente despues de new_footer */
-		new_header = (memreg_header_t * )(candidate->base + size +
-				MEMREG_FOOTER_SIZE);
-		new_header->base = (unsigned int)new_header + MEMREG_HEADER_SIZE;
-		/* El tamao de esta region libre luego de asignar size :
-	     * tamao original - size - sizeof(new_footer) - sizeof(new_header) */
-		new_header->limit = candidate_limit - size - MEMREG_FOOTER_SIZE
-							- MEMREG_HEADER_SIZE;
-
-		new_header->used = 0;
-		new_header->next_memreg_header = 0;
-		new_header->prev_memreg_header = 0;
-
-	/* Validacion : verificar si los calculos para el limite son correctos.
-	 * El pie original de la region deberia estar ubicado en
-	 * new_header->base + new_header->limit, es decir justo al final de la
-	 * nueva region de memoria */
-		if (new_header->base + new_header->limit !=
-				(unsigned int)candidate_footer) {
-			//printf("ERROR! original footer is out of place!. Whatever...");
-		}
-
-
-		/* Actualizar el footer original para que apunte al nuevo header */
-		candidate_footer->header = new_header;
-					candidate_footer->base = new_header->base;
+		 * Este header se ubica inmediatamente despues del area de datos
+		 * de la region asignada */
+		new_header = MEMREG_NEXT(candidate);
+		new_header->size = (candidate_limit - size - MEMREG_HEADER_SIZE)
+				| MEMREG_PREV_USED;
+		MEMREG_FOOTER(new_header)->header = new_header;
+		heap->splits++;
 
 		/* Validacion: Si la region candidata no es la ultima region
 		   definida en el heap, agregar el espacio restante luego
 		   de dividirla como una nueva region disponible dentro del heap */
-		if (heap->top != (unsigned int)candidate_footer + MEMREG_FOOTER_SIZE){
-			//printf("No!\n");
+		if (heap->top != (unsigned int)MEMREG_NEXT(new_header)){
 			/* Insertar la region en la lista de regiones disponibles */
-			push_front_memreg_header(heap->free, new_header);
+			insert_free_memreg(heap, new_header);
 		}else {
-			//printf("YES!");
 			/* La region candidata era la ultima en el heap, Verificar si
 			 * es necesario contraer.
 			 * Solo se contrae el heap cuando el numero de regiones marcadas
 			 * como libres es mayor a FREE_MEMREGS_LIMIT
 			 *  */
-			/* Ya existen suficientes regiones disponibles? */
-			//printf("Have to contract the heap?\n");
-			if (heap->free->count > FREE_MEMREGS_LIMIT) {
-				//printf("Yes!\n");
+			if (heap->free_count > FREE_MEMREGS_LIMIT) {
 				/* Liberar esta region, contrayendo el heap */
-				//printf("Contracting the heap from %u ", heap->top);
-				heap->top = (unsigned int)new_footer + MEMREG_FOOTER_SIZE;
-
-				/*Borrar el header que se creo */
-				new_header->base = 0;
-				new_header->limit = 0;
-				new_header->used = 0;
-
-				/* Borrar el footer original*/
-				candidate_footer->header = 0;
-				candidate_footer->base = 0;
-				//printf("to %u\n", heap->top);
+				heap->top = (unsigned int)new_header;
+				set_heap_end(heap, MEMREG_PREV_USED);
+				heap->contracts++;
+				if (heap->shrink != 0) {
+					heap->shrink(heap);
+				}
 			}else { //Agregar la region restante a la lista de disponibles
 				/* Insertar la region en la lista de regiones disponibles */
-				push_front_memreg_header(heap->free, new_header);
+				insert_free_memreg(heap, new_header);
 			}
 		}
+	}else {
+		/* Se asigna toda la region */
+		candidate->size |= MEMREG_USED;
+		MEMREG_NEXT(candidate)->size |= MEMREG_PREV_USED;
 	}
 
-	/* Insertar la region asignada en la lista de regiones usadas */
-	//push_front_memreg_header(heap->used, candidate);
+	heap->allocs++;
+	heap->used_bytes += MEMREG_LIMIT(candidate);
 
-	return (void *)(candidate->base);
+	return (void *)MEMREG_DATA(candidate);
 
 }
 
 /**
- * @brief Libera una region de memoria dentro de un heap.
- * @param heap Heap de la cual se desea liberar la regin
- * @param header Apuntador al encabezado de la region de memoria a liberar
+ * @brief Funcin privada que marca como libre una region asignada, la
+ * fusiona con las regiones libres adyacentes y la inserta en las regiones
+ * libres, o contrae el heap si es la ultima region. No actualiza los
+ * contadores de liberaciones ni de bytes asignados.
+ * @param heap Heap al cual pertenece la region
+ * @param header Encabezado de la region asignada
  */
-void free_from_heap(heap_t * heap, memreg_header_t *header) {
+static void release_memreg(heap_t * heap, memreg_header_t *header) {
 
 	memreg_header_t * tmp_header;
 	memreg_footer_t * tmp_footer;
-	memreg_footer_t * footer;
 
-	int joined_left;
+	/* Marcar la region como libre */
+	mark_free_memreg(header);
 
-	unsigned int header_address;
+	/* Verificar si esta region se puede fusionar con una region libre
+	 * que se encuentre inmediatamente antes. El indicador MEMREG_PREV_USED
+	 * evita leer el pie de una region asignada, que no existe. */
+	if (!(header->size & MEMREG_PREV_USED)) {
 
-	if (!memreg_is_valid(heap, header)) {
+		/* Apuntar al footer de la region anterior */
+		tmp_footer = (memreg_footer_t *)((unsigned int)header -
+				MEMREG_FOOTER_SIZE);
+		tmp_header = tmp_footer->header;
+
+		/* Extraer la region anterior de su lista, ya que su tamao
+		 * (y por lo tanto su clase) va a cambiar */
+		remove_free_memreg(heap, tmp_header);
+
+		/* Adicionar esta region a la region anterior */
+		tmp_header->size += MEMREG_SIZE(MEMREG_LIMIT(header));
+		MEMREG_FOOTER(tmp_header)->header = tmp_header;
+
+		/* Finalmente apuntar header a la region anterior*/
+		header = tmp_header;
+		heap->coalesces++;
+	}
+
+	/* Verificar si la region se puede fusionar con una region libre
+	 * que se encuentre inmediatamente despues. La palabra final del heap
+	 * siempre se encuentra marcada como asignada. */
+	tmp_header = MEMREG_NEXT(header);
+
+	if (!(tmp_header->size & MEMREG_USED)) {
+		/* Quitar la siguiente region de la lista de regiones libres */
+		remove_free_memreg(heap, tmp_header);
+
+		/* Fusionar con la region siguiente */
+		header->size += MEMREG_SIZE(MEMREG_LIMIT(tmp_header));
+		MEMREG_FOOTER(header)->header = header;
+		heap->coalesces++;
+	}
+
+	/* Si la region es la ultima del heap y es suficientemente grande,
+	 * contraer el heap y devolver el espacio. */
+	if (heap->shrink != 0 && MEMREG_LIMIT(header) >= HEAP_TRIM_SIZE &&
+			(unsigned int)MEMREG_NEXT(header) == heap->top) {
+		heap->top = (unsigned int)header;
+		set_heap_end(heap, header->size & MEMREG_PREV_USED);
+		heap->contracts++;
+		heap->shrink(heap);
 		return;
 	}
 
-	header_address = (unsigned int)header;
+	/* Agregar la region (posiblemente fusionada) a la lista de regiones
+	 * libres que corresponde a su tamao final */
+	insert_free_memreg(heap, header);
+}
+
+/**
+ * @brief Libera una region de memoria dentro de un heap.
+ * @param heap Heap de la cual se desea liberar la regin
+ * @param header Apuntador al encabezado de la region de memoria a liberar
+ */
+void free_from_heap(heap_t * heap, memreg_header_t *header) {
+
+	if (!memreg_is_valid(heap, header)) {
+		printf("free_from_heap: invalid region 0x%x in heap 0x%x\n", header,
+				heap);
+		return;
+	}
 
-	footer = (memreg_footer_t *)(header->base + header->limit);
-	if (footer == 0 || footer->header != header
-			|| footer->base != header->base) {
-		/*printf("Error! Coult not find region footer at %u!\n",
-				header->base + header->limit);*/
+	/* Las regiones de las quick-lists y de los magazines permanecen
+	 * marcadas como asignadas */
+	if (!(header->size & MEMREG_USED) || (header->size & MEMREG_CACHED)) {
+		printf("free_from_heap: region 0x%x is already free\n", header);
 		return;
 	}
+
 	//printf( "Removing region: \n");
 	//print_memory_region(header);
 
-	//remove_memreg_header(heap->used, header);
+	heap->frees++;
+	heap->used_bytes -= MEMREG_LIMIT(header);
 
-	header->used = 0;
+	/* Fusion diferida: almacenar la region en su quick-list, o fusionar
+	 * todas las quick-lists si se supera el limite de bytes */
+	if (heap->quick_budget != 0 &&
+			MEMREG_LIMIT(header) <= HEAP_QUICK_MAX_SIZE) {
+		if (heap->quick_bytes + MEMREG_LIMIT(header) <= heap->quick_budget) {
+			push_quick_memreg(heap, header);
+			return;
+		}
+		heap_flush_quick(heap);
+	}
 
+	release_memreg(heap, header);
+}
 
-	/* Verificar si esta region se puede fusionar con una region libre
-		* que se encuentre inmediatamente antes */
+/**
+ * @brief Libera y fusiona todas las regiones de las quick-lists de un heap.
+ * @param heap Heap
+ */
+void heap_flush_quick(heap_t * heap) {
+	int i;
 
-	joined_left = 0;
-	if ((unsigned int)header > heap->base) { //Si no es la primera
+	if (heap->quick_map == 0) {
+		return;
+	}
 
-		/* Apuntar al footer de la region anterior */
-		tmp_footer = (memreg_footer_t *)(header_address - MEMREG_FOOTER_SIZE);
-
-		if (tmp_footer  != 0 &&
-			tmp_footer->base != 0 &&
-			tmp_footer->header != 0) {
-			/* Apuntar al header anterior y validar */
-			tmp_header = (memreg_header_t *)(tmp_footer->base
-											- MEMREG_HEADER_SIZE);
-			/* Verificar si la region anterior existe y esta libre*/
-			if (tmp_footer->header == tmp_header && tmp_header->used == 0) {
-				/* Adicionar esta region a la region anterior */
-				tmp_header->limit += MEMREG_FOOTER_SIZE +
-									 MEMREG_HEADER_SIZE +
-									 header->limit;
-
-
-				/* Actualizar footer, ahora apunta a tmp_header */
-				footer->header = tmp_header;
-				footer->base = tmp_header->base;
-
-				/* Borrar datos de tmp_footer */
-				tmp_footer->header = 0;
-				tmp_footer->base = 0;
-
-				/* Borrar datos de header */
-				header->base = 0;
-				header->limit = 0;
-				header->used = 0;
-
-				/* Finalmente apuntar header a la region anterior*/
-				header = tmp_header;
-
-				/* Recordar que la region se fusiono con la anterior */
-				joined_left = 1;
-			}
+	while (heap->quick_map != 0) {
+		i = __builtin_ctz(heap->quick_map);
+		while (heap->quick[i].head != 0) {
+			release_memreg(heap, pop_quick_memreg(heap, i));
 		}
 	}
 
-	/* Verificar si la region se puede fusionar con una region libre
-	* que se encuentre inmediatamente despues */
-	if ((unsigned int)footer + MEMREG_FOOTER_SIZE < heap->top) {
-		/* Apuntar al header de la region siguiente */
-		tmp_header = (memreg_header_t *) ((unsigned int)footer +
-										  MEMREG_FOOTER_SIZE);
+	heap->quick_flushes++;
+}
 
-		/* Existe una region valida y esta libre ? */
-		if (memreg_is_valid(heap, tmp_header) && tmp_header->used == 0) {
+/**
+ * @brief Configura la fusion diferida de un heap. Con un limite mayor que 0,
+ * free_from_heap() almacena las regiones pequeas en las quick-lists sin
+ * fusionarlas, y alloc_from_heap() las reutiliza cuando se solicita el mismo
+ * tamao. Las quick-lists se fusionan en bloque cuando una asignacion no
+ * encuentra una region libre, o cuando superan el limite de bytes.
+ * @param heap Heap
+ * @param budget Maximo de bytes en las quick-lists, 0 para fusionar las
+ * regiones al liberarlas. Las quick-lists actuales se fusionan.
+ */
+void heap_defer_coalescing(heap_t * heap, unsigned int budget) {
+	heap_flush_quick(heap);
+	heap->quick_budget = budget;
+}
 
+/**
+ * @brief Libera el espacio sobrante al final de una region asignada. Si el
+ * espacio sobrante permite crear una region, esta se crea como asignada y
+ * se libera con release_memreg(), que la fusiona con la region siguiente si
+ * se encuentra libre.
+ * @param heap Heap al cual pertenece la region
+ * @param header Encabezado de la region asignada
+ * @param size Nuevo tamao del area de datos, alineado a MEMREG_GRANULARITY
+ */
+static void split_memreg_tail(heap_t * heap, memreg_header_t * header,
+		unsigned int size) {
+	memreg_header_t * tail;
+	unsigned int limit;
 
-			/* Quitar la siguiente region de la lista de regiones libres */
-			remove_memreg_header(heap->free, tmp_header);
+	limit = MEMREG_LIMIT(header);
 
-			/* Hallar el pie de la region siguiente */
-			tmp_footer = (memreg_footer_t *)(tmp_header->base +
-											tmp_header->limit);
+	if (limit - size < MEMREG_MIN_SIZE) {
+		return;
+	}
 
-			/* Fusionar con la region siguiente */
-			header->limit += MEMREG_FOOTER_SIZE +
-							 MEMREG_HEADER_SIZE +
-							 tmp_header->limit;
+	header->size = size | (header->size & MEMREG_FLAGS);
 
-			/* Actualizar tmp_footer, ahora apunta a header  */
-			tmp_footer->header = header;
-			tmp_footer->base = header->base;
+	tail = MEMREG_NEXT(header);
+	tail->size = (limit - size - MEMREG_HEADER_SIZE) | MEMREG_USED |
+			MEMREG_PREV_USED;
 
+	heap->used_bytes -= limit - size;
+	heap->splits++;
 
-			/*Borrar datos de footer */
-			footer->header = 0;
-			footer->base = 0;
+	release_memreg(heap, tail);
+}
 
-			/* Borrar datos de tmp_header */
-			tmp_header->base = 0;
-			tmp_header->limit = 0;
-			tmp_header->used = 0;
+/**
+ * @brief Solicita la asignacion de memoria alineada dentro de un heap. Se
+ * asigna una region con el espacio suficiente para alinear el area de
+ * datos; el relleno al inicio se separa como una region libre, y el espacio
+ * sobrante al final se libera, por lo cual la alineacion no desperdicia
+ * memoria.
+ * @param heap Heap del cual se desea obtener el espacio
+ * @param size Cantidad de memoria a asignar
+ * @param align Alineacion requerida, potencia de 2
+ * @return Apuntador a la region de memoria asignada, alineado a align. 0 si
+ * no se puede asignar memoria.
+ */
+void * alloc_aligned_from_heap(heap_t * heap, unsigned int size,
+		unsigned int align) {
+	memreg_header_t * header;
+	memreg_header_t * aligned;
+	unsigned int data;
+	unsigned int aligned_data;
+	unsigned int limit;
 
-			/* Si la siguiente region era la ultima, contraer el heap */
+	if ((align & (align - 1)) != 0) {
+		return 0;
+	}
 
-			if (heap->top == (unsigned int)footer + MEMREG_FOOTER_SIZE) {
-				//printf("%u was the last memory region!\n", footer);
-				heap->top = (unsigned int)tmp_footer + MEMREG_FOOTER_SIZE;
-			}
+	if (align <= MEMREG_GRANULARITY) {
+		return alloc_from_heap(heap, size);
+	}
+
+	if (size > heap->limit || align > heap->limit) {
+		return 0;
+	}
+
+	size = (size + MEMREG_FLAGS) & ~MEMREG_FLAGS;
+	if (size < MEMREG_MIN_LIMIT) {
+		size = MEMREG_MIN_LIMIT;
+	}
+
+	/* El relleno al inicio debe ser 0 o tener el tamao de una region */
+	data = (unsigned int)alloc_from_heap(heap, size + MEMREG_MIN_SIZE +
+			align - MEMREG_GRANULARITY);
+
+	if (data == 0) {
+		return 0;
+	}
+
+	header = MEMREG_HEADER(data);
+
+	if ((data & (align - 1)) == 0) {
+		split_memreg_tail(heap, header, size);
+		return (void *)data;
+	}
+
+	aligned_data = (data + MEMREG_MIN_SIZE + align - 1) & ~(align - 1);
+	aligned = MEMREG_HEADER(aligned_data);
+	limit = MEMREG_LIMIT(header);
+
+	/* Crear la region alineada con el espacio restante, y convertir el
+	 * relleno en una region asignada que se libera a continuacion */
+	aligned->size = (data + limit - aligned_data) | MEMREG_USED |
+			MEMREG_PREV_USED;
+	header->size = (aligned_data - data - MEMREG_HEADER_SIZE) |
+			(header->size & MEMREG_FLAGS);
+
+	heap->used_bytes -= aligned_data - data;
+	heap->splits++;
+
+	release_memreg(heap, header);
+
+	split_memreg_tail(heap, aligned, size);
+
+	return (void *)aligned_data;
+}
+
+/**
+ * @brief Cambia el tamao de una region asignada sin moverla. Para reducir
+ * la region, el espacio sobrante al final se libera como una nueva region.
+ * Para aumentarla, la region se fusiona con la region siguiente si esta se
+ * encuentra libre y tiene el espacio suficiente, o se expande el tope del
+ * heap si la region es la ultima.
+ * @param heap Heap al cual pertenece la region
+ * @param ptr Apuntador al area de datos de la region
+ * @param size Nuevo tamao requerido
+ * @return 1 si la region tiene el nuevo tamao, 0 si no es posible cambiar
+ * el tamao sin mover la region.
+ */
+int resize_in_heap(heap_t * heap, void * ptr, unsigned int size) {
+	memreg_header_t * header;
+	memreg_header_t * next;
+	unsigned int limit;
+	unsigned int space_available;
+
+	header = MEMREG_HEADER(ptr);
+
+	if (!memreg_is_valid(heap, header) || !(header->size & MEMREG_USED) ||
+			(header->size & MEMREG_CACHED) || size > heap->limit) {
+		return 0;
+	}
+
+	size = (size + MEMREG_FLAGS) & ~MEMREG_FLAGS;
+	if (size < MEMREG_MIN_LIMIT) {
+		size = MEMREG_MIN_LIMIT;
+	}
+
+	limit = MEMREG_LIMIT(header);
+
+	/* Reducir la region */
+	if (size <= limit) {
+		split_memreg_tail(heap, header, size);
+		return 1;
+	}
+
+	next = MEMREG_NEXT(header);
+
+	/* La region es la ultima del heap: expandir el tope */
+	if ((unsigned int)next == heap->top) {
+		space_available = heap->base + heap->limit - heap->top;
+		if (space_available < size - limit && heap->grow != 0 &&
+				heap->grow(heap, size - limit - space_available)) {
+			space_available = heap->base + heap->limit - heap->top;
 		}
+		if (space_available < size - limit) {
+			return 0;
+		}
+		header->size += size - limit;
+		heap->top = (unsigned int)MEMREG_NEXT(header);
+		set_heap_end(heap, MEMREG_PREV_USED);
+		heap->used_bytes += size - limit;
+		heap->expands++;
+		return 1;
 	}
 
-	/* Si la region no se fusiono con sus region anterior, agregarla a la
-	 * lista de regiones libres */
-	if (joined_left == 0) {
-		push_front_memreg_header(heap->free, header);
+	/* Fusionar con la region siguiente, si esta libre y es suficiente */
+	if ((next->size & MEMREG_USED) ||
+			limit + MEMREG_SIZE(MEMREG_LIMIT(next)) < size) {
+		return 0;
 	}
+
+	remove_free_memreg(heap, next);
+
+	header->size += MEMREG_SIZE(MEMREG_LIMIT(next));
+	MEMREG_NEXT(header)->size |= MEMREG_PREV_USED;
+	heap->used_bytes += MEMREG_SIZE(MEMREG_LIMIT(next));
+	heap->coalesces++;
+
+	split_memreg_tail(heap, header, size);
+
+	return 1;
 }
 
 /**
  * @brief Determina si una region de memoria dada es valida dentro de un
- * heap.
+ * heap. Una region libre debe tener un pie que apunte a su encabezado, y la
+ * region siguiente debe reflejar en su indicador MEMREG_PREV_USED el estado
+ * de la region.
  * @param heap Apuntador al heap en el cual se encuentra la region
  * @param header Apuntador al encabezado de la region a validar
  * @return: 1 = region valida, 0 = region no valida
  */
 int memreg_is_valid(heap_t * heap, memreg_header_t *header) {
 
-	memreg_footer_t *footer;
+	memreg_header_t *next;
 	unsigned int header_address;
 
-
-
-	if (heap == 0 || header ==0 || header->limit == 0) {return 0;}
+	if (heap == 0 || header ==0) {return 0;}
 
 	header_address = (unsigned int)header;
 
 	if (header_address < heap->base ||
-		header_address > (heap->top - MEMREG_FOOTER_SIZE - MEMREG_GRANULARITY)){
+		header_address > heap->top - MEMREG_MIN_SIZE ||
+		(header_address & MEMREG_FLAGS) != 0){
 		return 0; /* Header no valido! */
 	}
 
-	footer = (memreg_footer_t *)(header->base + header->limit);
+	if (MEMREG_LIMIT(header) < MEMREG_MIN_LIMIT ||
+		MEMREG_LIMIT(header) > heap->top - MEMREG_DATA(header)) {
+		return 0;
+	}
+
+	next = MEMREG_NEXT(header);
+
+	if (header->size & MEMREG_USED) {
+		return (next->size & MEMREG_PREV_USED) != 0;
+	}
 
-	return (header->base == (unsigned int)header + MEMREG_HEADER_SIZE &&
-			footer != 0 &&
-			footer->header == header &&
-			footer->base == header->base);
+	return ((next->size & MEMREG_PREV_USED) == 0 &&
+			MEMREG_FOOTER(header)->header == header);
 
 }
 
 /**
- * @brief Imprime la informacion de una region de memoria
- * @param header Apuntador al encabezado de la regin de memoria
+ * @brief Verifica una region que se encuentra en las estructuras de regiones
+ * libres: debe estar dentro del heap, estar marcada como libre y tener un
+ * pie que apunte a su encabezado.
+ * @param heap Heap
+ * @param header Region
+ * @return 1 si la region es valida, 0 en caso contrario.
  */
-void print_memory_region(memreg_header_t * header) {
-	memreg_footer_t * footer;
+static int check_free_memreg(heap_t * heap, memreg_header_t * header) {
+	if ((unsigned int)header < heap->base || (unsigned int)header >= heap->top
+			|| ((unsigned int)header & MEMREG_FLAGS) != 0 ||
+			MEMREG_LIMIT(header) > heap->top - MEMREG_DATA(header)) {
+		printf("heap_check: free region 0x%x is outside the heap\n", header);
+		return 0;
+	}
 
-	/* Primero verificar si la region es valida */
-	footer = (memreg_footer_t *)(header->base + header->limit);
+	if ((header->size & MEMREG_USED) ||
+			MEMREG_FOOTER(header)->header != header) {
+		printf("heap_check: free region 0x%x is not marked free\n", header);
+		return 0;
+	}
+
+	return 1;
+}
 
-	if (footer->header != header || footer->base != header->base) {
-		//printf("Region at [%u] not valid!\n");
+/**
+ * @brief Verifica el arbol de regiones libres: las propiedades del arbol
+ * rojo-negro, y cada region en orden.
+ * @param heap Heap
+ * @param count Numero de regiones encontradas
+ * @return Numero de errores encontrados
+ */
+static int check_memreg_tree(heap_t * heap, unsigned int * count) {
+	memreg_header_t * it;
+
+	/* Un arbol con ciclos tendria mas nodos que regiones libres */
+	if (heap->tree.count != heap->free_count ||
+			tree_check_memreg_tree(&heap->tree) < 0) {
+		printf("heap_check: free tree is not a valid red-black tree\n");
+		return 1;
+	}
+
+	for (it = tree_min_memreg_tree(&heap->tree); it != 0;
+			it = tree_next_memreg_tree(it)) {
+		(*count)++;
+		if (!check_free_memreg(heap, it)) {
+			return 1;
+		}
 	}
 
+	return 0;
+}
+
+/**
+ * @brief Verifica la consistencia de un heap. Se recorren todas las regiones
+ * desde la base hasta el tope mediante las etiquetas de frontera,
+ * verificando el encabezado y el pie de cada region, que no existan dos
+ * regiones libres adyacentes y la palabra final. Luego se recorren las
+ * listas (o el arbol) de regiones libres y las quick-lists, y se comparan
+ * con el recorrido y con los contadores del heap.
+ * @param heap Heap a verificar
+ * @return Numero de errores encontrados, 0 si el heap es consistente. Cada
+ * error se reporta con printf.
+ */
+int heap_check(heap_t * heap) {
+	memreg_header_t * header;
+	memreg_header_t * it;
+	unsigned int prev_used;
+	unsigned int free_regions;
+	unsigned int free_bytes;
+	unsigned int used_bytes;
+	unsigned int quick_bytes;
+	unsigned int listed;
+	int errors;
+	int i;
+
+	errors = 0;
+	free_regions = 0;
+	free_bytes = 0;
+	used_bytes = 0;
+	prev_used = MEMREG_PREV_USED;
+
+	header = (memreg_header_t *)heap->base;
+
+	while ((unsigned int)header < heap->top) {
+		if (MEMREG_LIMIT(header) < MEMREG_MIN_LIMIT ||
+				MEMREG_LIMIT(header) > heap->top - MEMREG_DATA(header)) {
+			printf("heap_check: region 0x%x has invalid size %u\n", header,
+					MEMREG_LIMIT(header));
+			/* Sin un tamao valido no es posible continuar el recorrido */
+			return errors + 1;
+		}
+
+		if ((header->size & MEMREG_PREV_USED) != prev_used) {
+			printf("heap_check: region 0x%x has a wrong previous flag\n",
+					header);
+			errors++;
+		}
+
+		if (header->size & MEMREG_USED) {
+			used_bytes += MEMREG_LIMIT(header);
+			prev_used = MEMREG_PREV_USED;
+		}else {
+			if (MEMREG_FOOTER(header)->header != header) {
+				printf("heap_check: free region 0x%x has a bad footer\n",
+						header);
+				errors++;
+			}
+			if (!prev_used) {
+				printf("heap_check: free region 0x%x was not coalesced\n",
+						header);
+				errors++;
+			}
+			free_regions++;
+			free_bytes += MEMREG_LIMIT(header);
+			prev_used = 0;
+		}
+
+		header = MEMREG_NEXT(header);
+	}
+
+	if ((unsigned int)header != heap->top ||
+			header->size != (MEMREG_USED | prev_used)) {
+		printf("heap_check: bad end of heap at 0x%x\n", header);
+		errors++;
+	}
+
+	/* Verificar las estructuras de regiones libres */
+	listed = 0;
+
+	if (heap->policy == HEAP_BEST_FIT) {
+		errors += check_memreg_tree(heap, &listed);
+	}else {
+		for (i = 0; i <= HEAP_SIZE_CLASSES; i++) {
+			it = (i < HEAP_SIZE_CLASSES) ? heap->classes[i].head :
+					heap->free->head;
+			for (; it != 0 && listed <= free_regions;
+					it = it->next_memreg_header, listed++) {
+				if (!check_free_memreg(heap, it)) {
+					errors++;
+					break;
+				}
+				if (memreg_class(MEMREG_LIMIT(it)) != i) {
+					printf("heap_check: free region 0x%x is in class %d\n",
+							it, i);
+					errors++;
+				}
+			}
+			if (i < HEAP_SIZE_CLASSES && ((heap->class_map >> i) & 1) !=
+					(heap->classes[i].head != 0)) {
+				printf("heap_check: class map is wrong for class %d\n", i);
+				errors++;
+			}
+		}
+	}
+
+	if (listed != free_regions || heap->free_count != (int)free_regions) {
+		printf("heap_check: %u free regions, %u listed, count %d\n",
+				free_regions, listed, heap->free_count);
+		errors++;
+	}
+
+	/* Las regiones de las quick-lists se encuentran marcadas como
+	 * asignadas y con MEMREG_CACHED */
+	quick_bytes = 0;
+	for (i = 0; i < HEAP_QUICK_LISTS; i++) {
+		for (it = heap->quick[i].head; it != 0 && quick_bytes <= used_bytes;
+				it = it->snext_memreg_quick) {
+			if (!memreg_is_valid(heap, it) || !(it->size & MEMREG_USED) ||
+					!(it->size & MEMREG_CACHED) ||
+					MEMREG_LIMIT(it) != MEMREG_MIN_LIMIT +
+					i * MEMREG_GRANULARITY) {
+				printf("heap_check: invalid region 0x%x in quick-list %d\n",
+						it, i);
+				errors++;
+				break;
+			}
+			quick_bytes += MEMREG_LIMIT(it);
+		}
+		if (((heap->quick_map >> i) & 1) != (heap->quick[i].head != 0)) {
+			printf("heap_check: quick map is wrong for list %d\n", i);
+			errors++;
+		}
+	}
+
+	if (heap->free_bytes != free_bytes || heap->quick_bytes != quick_bytes ||
+			heap->used_bytes + quick_bytes != used_bytes) {
+		printf("heap_check: counters free %u/%u used %u/%u quick %u/%u\n",
+				heap->free_bytes, free_bytes, heap->used_bytes,
+				used_bytes - quick_bytes, heap->quick_bytes, quick_bytes);
+		errors++;
+	}
+
+	return errors;
+}
+
+/**
+ * @brief Obtiene las estadisticas de un heap. Los contadores se mantienen
+ * durante la operacion del heap; el tamao de la mayor region libre y el
+ * histograma se calculan recorriendo las regiones libres.
+ * @param heap Heap
+ * @param stats Estructura en la cual se almacenan las estadisticas
+ */
+void heap_stats(heap_t * heap, struct heap_stats * stats) {
+	memreg_header_t * it;
+	unsigned int free_bytes;
+	unsigned int fragmented;
+	int i;
+
+	stats->size = heap->top - heap->base;
+	stats->limit = heap->limit;
+	stats->used_bytes = heap->used_bytes;
+	stats->free_bytes = heap->free_bytes;
+	stats->free_regions = heap->free_count;
+	stats->allocs = heap->allocs;
+	stats->frees = heap->frees;
+	stats->splits = heap->splits;
+	stats->coalesces = heap->coalesces;
+	stats->expands = heap->expands;
+	stats->contracts = heap->contracts;
+	stats->failures = heap->failures;
+	stats->quick_bytes = heap->quick_bytes;
+	stats->quick_flushes = heap->quick_flushes;
+	stats->largest_free = 0;
+
+	for (i = 0; i <= HEAP_SIZE_CLASSES; i++) {
+		stats->histogram[i] = 0;
+	}
+
+	if (heap->policy == HEAP_BEST_FIT) {
+		/* La mayor region libre es el extremo derecho del arbol */
+		it = tree_max_memreg_tree(&heap->tree);
+		if (it != 0) {
+			stats->largest_free = MEMREG_LIMIT(it);
+		}
+		for (it = tree_min_memreg_tree(&heap->tree); it != 0;
+				it = tree_next_memreg_tree(it)) {
+			stats->histogram[memreg_class(MEMREG_LIMIT(it))]++;
+		}
+	}else {
+		for (i = 0; i < HEAP_SIZE_CLASSES; i++) {
+			stats->histogram[i] = heap->classes[i].count;
+		}
+		for (it = heap->free->head; it != 0; it = it->next_memreg_header) {
+			stats->histogram[HEAP_SIZE_CLASSES]++;
+			if (MEMREG_LIMIT(it) > stats->largest_free) {
+				stats->largest_free = MEMREG_LIMIT(it);
+			}
+		}
+		/* Sin regiones grandes, la mayor region libre se encuentra en la
+		 * mayor clase de tamao no vacia */
+		if (stats->largest_free == 0 && heap->class_map != 0) {
+			i = 31 - __builtin_clz(heap->class_map);
+			for (it = heap->classes[i].head; it != 0;
+					it = it->next_memreg_header) {
+				if (MEMREG_LIMIT(it) > stats->largest_free) {
+					stats->largest_free = MEMREG_LIMIT(it);
+				}
+			}
+		}
+	}
+
+	/* Reducir la escala para evitar desbordamiento al calcular el
+	 * porcentaje */
+	free_bytes = stats->free_bytes;
+	fragmented = stats->free_bytes - stats->largest_free;
+	while (free_bytes > 0x1000000) {
+		free_bytes >>= 4;
+		fragmented >>= 4;
+	}
+
+	stats->fragmentation = (free_bytes == 0) ? 0 :
+			fragmented * 100 / free_bytes;
+}
+
+/**
+ * @brief Imprime la informacion de una region de memoria
+ * @param header Apuntador al encabezado de la regin de memoria
+ */
+void print_memory_region(memreg_header_t * header) {
+
 	/*
-	printf("[%u]: (%u, %u, %u, %u, %u) {%u}: (-->%u, %u)\n",
+	printf("[%u]: (%u, %u, %u, %u)\n",
 			header,
-			(unsigned int)header->base,
-			header->limit,
-			header->used,
-			(unsigned int)header->next,
-			(unsigned int)header->prev,
-			(header->base + header->limit),
-			footer->header,
-			footer->base);
+			MEMREG_DATA(header),
+			MEMREG_LIMIT(header),
+			header->size & MEMREG_USED,
+			header->size & MEMREG_PREV_USED);
 	*/
 }
 
@@ -572,12 +1269,24 @@ void print_memory_region(memreg_header_t * header) {
 void print_heap(heap_t *heap) {
 
 	memreg_header_t * it;
+	int i;
 
 	/*
 	printf("Heap at: %u top=%u limit=%u \n", heap, heap->top, heap->limit);
 	printf("Free regions:\n");
-printf("[head]: (base, limit, used, next, previous) {foot}: (->header, base)\n");
+printf("[head]: (base, limit, used, prev used)\n");
 */
+	for (it = tree_min_memreg_tree(&heap->tree); it != 0;
+			it = tree_next_memreg_tree(it)) {
+		print_memory_region(it);
+	}
+
+	for (i = 0; i < HEAP_SIZE_CLASSES; i++) {
+		for (it = heap->classes[i].head; it != 0;
+	    it=(memreg_header_t *)it->next_memreg_header) {
+			print_memory_region(it);
+		}
+	}
 	for (it = heap->free->head; it != 0;
     it=(memreg_header_t *)it->next_memreg_header) {
 		print_memory_region(it);
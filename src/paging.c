@@ -0,0 +1,760 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ *
+ * @brief Este archivo implementa el subsistema de paginacion: el mapeo por
+ * identidad del kernel, las primitivas para mapear paginas, la asignacion
+ * bajo demanda y la copia en escritura (copy-on-write).
+ */
+
+#include <paging.h>
+#include <physmem.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <asm.h>
+#include <exception.h>
+
+/** @brief Directorio de paginas del kernel */
+page_directory_t * kernel_directory;
+
+/** @brief Indicadores adicionales de las paginas del kernel. Contiene
+ * PAGE_GLOBAL si el procesador soporta paginas globales. */
+static unsigned int kernel_page_flags;
+
+/** @brief Regiones del kernel cuyas paginas se asignan bajo demanda */
+static demand_region_t demand_regions[DEMAND_REGIONS];
+
+/** @brief Numero de regiones bajo demanda */
+static int demand_region_count;
+
+/** @brief Pagina compartida, llena de ceros, que se mapea en modo de solo
+ * lectura al leer una pagina bajo demanda que no se ha escrito */
+static unsigned int zero_page;
+
+/** @brief Numero de mapeos que comparten cada unidad de memoria, indexado
+ * por unidad - base_unit. 0 indica que la unidad tiene un solo dueo. */
+static unsigned short * page_refs;
+
+static void page_fault_handler(interrupt_state * state);
+
+/**
+ * @brief Invalida la entrada de la TLB de una direccion, si el directorio
+ * de paginas es el directorio actual o el directorio del kernel (cuyas
+ * tablas de paginas comparten todos los directorios).
+ * @param dir Directorio de paginas modificado
+ * @param virt Direccion lineal
+ */
+static __inline__ void flush_page(page_directory_t * dir, unsigned int virt) {
+	if ((read_cr0() & CR0_PG) && (read_cr3() == (unsigned int)dir ||
+			dir == kernel_directory)) {
+		invlpg(virt);
+	}
+}
+
+/**
+ * @brief Obtiene el contador de mapeos compartidos de una unidad.
+ * @param phys Direccion fisica de la unidad
+ * @return Apuntador al contador, 0 si la direccion no corresponde a una
+ * unidad gestionada por el asignador o si es la pagina de ceros.
+ */
+static __inline__ unsigned short * page_ref(unsigned int phys) {
+	extern unsigned int base_unit;
+	extern unsigned int end_unit;
+	unsigned int unit;
+
+	unit = phys / MEMORY_UNIT_SIZE;
+
+	if (page_refs == 0 || phys == zero_page || unit < base_unit ||
+			unit >= end_unit) {
+		return 0;
+	}
+
+	return &page_refs[unit - base_unit];
+}
+
+/**
+ * @brief Registra un nuevo mapeo de una unidad compartida.
+ * @param phys Direccion fisica de la unidad
+ */
+static void share_frame(unsigned int phys) {
+	unsigned short * ref;
+
+	ref = page_ref(phys);
+
+	if (ref != 0) {
+		*ref = (*ref == 0) ? 2 : *ref + 1;
+	}
+}
+
+/**
+ * @brief Elimina un mapeo de una unidad. La unidad se devuelve al asignador
+ * cuando se elimina su ultimo mapeo.
+ * @param phys Direccion fisica de la unidad
+ * @return 1 si la unidad se libero, 0 si aun tiene otros mapeos o no es una
+ * unidad gestionada por el asignador.
+ */
+static int release_frame(unsigned int phys) {
+	unsigned short * ref;
+
+	ref = page_ref(phys);
+
+	if (ref == 0) {
+		return 0;
+	}
+
+	if (*ref >= 2) {
+		/* Con un solo mapeo restante la unidad vuelve a tener un dueo */
+		*ref = (*ref == 2) ? 0 : *ref - 1;
+		return 0;
+	}
+
+	free_unit((char *)phys);
+
+	return 1;
+}
+
+/**
+ * @brief Asigna una unidad de memoria para una tabla de paginas, y la
+ * inicializa con entradas no presentes.
+ * @return Apuntador a la tabla, 0 si no existen unidades disponibles.
+ */
+static pte_t * allocate_page_table(void) {
+	pte_t * table;
+
+	table = (pte_t *)allocate_unit();
+
+	if (table != 0) {
+		memset(table, 0, PAGE_SIZE);
+	}
+
+	return table;
+}
+
+/**
+ * @brief Divide una pagina de 4 MB en una tabla de 1024 paginas de 4 KB con
+ * los mismos indicadores, de forma que se puedan modificar paginas
+ * individuales dentro de ella.
+ * @param dir Directorio de paginas
+ * @param virt Direccion lineal dentro de la pagina de 4 MB
+ * @return 0 si la pagina se dividio, -1 si no existe memoria para la tabla.
+ */
+static int split_large_page(page_directory_t * dir, unsigned int virt) {
+	pde_t * pde;
+	pte_t * table;
+	unsigned int base;
+	unsigned int flags;
+	int i;
+
+	pde = &dir->entries[PDE_INDEX(virt)];
+
+	table = allocate_page_table();
+
+	if (table == 0) {
+		return -1;
+	}
+
+	base = *pde & ~(PAGE_LARGE_SIZE - 1);
+	flags = *pde & PAGE_FLAGS & ~PAGE_LARGE;
+
+	for (i = 0; i < PAGE_ENTRIES; i++) {
+		table[i] = (base + i * PAGE_SIZE) | flags;
+	}
+
+	*pde = (unsigned int)table | PAGE_PRESENT | PAGE_WRITABLE |
+			(*pde & PAGE_USER);
+
+	flush_page(dir, virt);
+
+	return 0;
+}
+
+/**
+ * @brief Obtiene la entrada de la tabla de paginas que corresponde a una
+ * direccion lineal.
+ * @param dir Directorio de paginas
+ * @param virt Direccion lineal
+ * @param create Si es 1, se crea la tabla de paginas si no existe y se
+ * divide la pagina de 4 MB que contiene la direccion.
+ * @return Apuntador a la entrada, 0 si la tabla no existe (o no se pudo
+ * crear) o si la direccion se encuentra en una pagina de 4 MB.
+ */
+static pte_t * get_page_entry(page_directory_t * dir, unsigned int virt,
+		int create) {
+	pde_t * pde;
+	pte_t * table;
+
+	pde = &dir->entries[PDE_INDEX(virt)];
+
+	if (!(*pde & PAGE_PRESENT)) {
+		if (!create) {
+			return 0;
+		}
+		table = allocate_page_table();
+		if (table == 0) {
+			return 0;
+		}
+		*pde = (unsigned int)table | PAGE_PRESENT | PAGE_WRITABLE;
+	}else if (*pde & PAGE_LARGE) {
+		if (!create || split_large_page(dir, virt) < 0) {
+			return 0;
+		}
+	}
+
+	table = (pte_t *)(*pde & PAGE_FRAME);
+
+	return &table[PTE_INDEX(virt)];
+}
+
+/**
+ * @brief Mapea una pagina de 4 KB. Si la tabla de paginas no existe, se
+ * asigna una unidad para ella; si la direccion se encuentra dentro de una
+ * pagina de 4 MB, esta se divide en una tabla de paginas de 4 KB.
+ * @param dir Directorio de paginas
+ * @param virt Direccion lineal, alineada a PAGE_SIZE
+ * @param phys Direccion fisica, alineada a PAGE_SIZE
+ * @param flags Indicadores de la pagina (PAGE_WRITABLE, PAGE_USER, ...).
+ * PAGE_PRESENT se agrega siempre.
+ * @return 0 si la pagina se mapeo, -1 si no existe memoria para la tabla de
+ * paginas.
+ */
+int map_page(page_directory_t * dir, unsigned int virt, unsigned int phys,
+		unsigned int flags) {
+	pte_t * pte;
+
+	pte = get_page_entry(dir, virt, 1);
+
+	if (pte == 0) {
+		return -1;
+	}
+
+	/* Las paginas de usuario requieren el indicador en la entrada del
+	 * directorio */
+	if (flags & PAGE_USER) {
+		dir->entries[PDE_INDEX(virt)] |= PAGE_USER;
+	}
+
+	*pte = (phys & PAGE_FRAME) | (flags & PAGE_FLAGS) | PAGE_PRESENT;
+
+	flush_page(dir, virt);
+
+	return 0;
+}
+
+/**
+ * @brief Elimina el mapeo de una pagina de 4 KB. Si la direccion se
+ * encuentra dentro de una pagina de 4 MB, esta se divide primero.
+ * @param dir Directorio de paginas
+ * @param virt Direccion lineal
+ * @return Direccion fisica que estaba mapeada, PAGE_NOT_MAPPED si la
+ * pagina no estaba mapeada o no fue posible dividir la pagina de 4 MB.
+ */
+unsigned int unmap_page(page_directory_t * dir, unsigned int virt) {
+	pte_t * pte;
+	unsigned int phys;
+
+	if (!(dir->entries[PDE_INDEX(virt)] & PAGE_PRESENT)) {
+		return PAGE_NOT_MAPPED;
+	}
+
+	pte = get_page_entry(dir, virt, 1);
+
+	if (pte == 0 || !(*pte & PAGE_PRESENT)) {
+		return PAGE_NOT_MAPPED;
+	}
+
+	phys = *pte & PAGE_FRAME;
+	*pte = 0;
+
+	flush_page(dir, virt);
+
+	return phys;
+}
+
+/**
+ * @brief Traduce una direccion lineal a la direccion fisica a la cual se
+ * encuentra mapeada.
+ * @param dir Directorio de paginas
+ * @param virt Direccion lineal
+ * @return Direccion fisica, PAGE_NOT_MAPPED si la direccion no se
+ * encuentra mapeada.
+ */
+unsigned int virt_to_phys(page_directory_t * dir, unsigned int virt) {
+	pde_t pde;
+	pte_t * pte;
+
+	pde = dir->entries[PDE_INDEX(virt)];
+
+	if (!(pde & PAGE_PRESENT)) {
+		return PAGE_NOT_MAPPED;
+	}
+
+	if (pde & PAGE_LARGE) {
+		return (pde & ~(PAGE_LARGE_SIZE - 1)) |
+				(virt & (PAGE_LARGE_SIZE - 1));
+	}
+
+	pte = get_page_entry(dir, virt, 0);
+
+	if (!(*pte & PAGE_PRESENT)) {
+		return PAGE_NOT_MAPPED;
+	}
+
+	return (*pte & PAGE_FRAME) | (virt & (PAGE_SIZE - 1));
+}
+
+/**
+ * @brief Crea el directorio de paginas del kernel, mapea por identidad la
+ * memoria fisica y habilita la paginacion. Se debe invocar luego de
+ * setup_memory().
+ */
+void setup_paging(void) {
+	/* Region de memoria disponible, configurada en setup_memory() */
+	extern unsigned int memory_start;
+	extern unsigned int memory_length;
+	extern unsigned int base_unit;
+	extern unsigned int end_unit;
+
+	unsigned int regs[4];
+	unsigned int tables;
+	unsigned int addr;
+	unsigned int end;
+	unsigned int cr4;
+	int pse;
+	int i;
+
+	kernel_directory = (page_directory_t *)allocate_page_table();
+
+	if (kernel_directory == 0) {
+		printf("Unable to allocate the kernel page directory\n");
+		return;
+	}
+
+	/* Crear la pagina de ceros y los contadores de mapeos compartidos */
+	zero_page = (unsigned int)allocate_page_table();
+	page_refs = (unsigned short *)allocate_unit_region(
+			(end_unit - base_unit) * sizeof(unsigned short));
+	if (page_refs != 0) {
+		memset(page_refs, 0, (end_unit - base_unit) * sizeof(unsigned short));
+	}
+
+	/* CPUID.1:EDX bit 3 = PSE, bit 13 = PGE */
+	cpuid(1, regs);
+	pse = (regs[3] & (1 << 3)) != 0;
+
+	cr4 = read_cr4();
+	if (pse) {
+		cr4 |= CR4_PSE;
+	}
+	if (regs[3] & (1 << 13)) {
+		cr4 |= CR4_PGE;
+		kernel_page_flags = PAGE_GLOBAL;
+	}
+	write_cr4(cr4);
+
+	/* Mapear por identidad desde 0 hasta el final de la memoria disponible,
+	 * que incluye el kernel, la memoria de video y las estructuras del
+	 * asignador de unidades */
+	end = memory_start + memory_length;
+	tables = (end == 0) ? 1 : PDE_INDEX(end - 1) + 1;
+
+	for (i = 0; i < tables; i++) {
+		addr = i * PAGE_LARGE_SIZE;
+		if (pse) {
+			kernel_directory->entries[i] = addr | PAGE_PRESENT |
+					PAGE_WRITABLE | PAGE_LARGE | kernel_page_flags;
+			continue;
+		}
+		for (; addr < (i + 1) * PAGE_LARGE_SIZE && addr < end;
+				addr += PAGE_SIZE) {
+			if (map_page(kernel_directory, addr, addr,
+					PAGE_WRITABLE | kernel_page_flags) < 0) {
+				printf("Unable to map the kernel at 0x%x\n", addr);
+				return;
+			}
+		}
+	}
+
+	install_exception_handler(14, page_fault_handler);
+
+	write_cr3((unsigned int)kernel_directory);
+
+	/* Con CR0.WP el kernel tambien respeta las paginas de solo lectura */
+	write_cr0(read_cr0() | CR0_PG | CR0_WP);
+
+	printf("Paging enabled: %u MB mapped with %s pages\n",
+			(tables * PAGE_LARGE_SIZE) >> 20, pse ? "4 MB" : "4 KB");
+}
+
+/**
+ * @brief Busca la region bajo demanda que contiene una direccion lineal.
+ * @param addr Direccion lineal
+ * @return Region que contiene la direccion, 0 si no existe.
+ */
+static demand_region_t * find_demand_region(unsigned int addr) {
+	int i;
+
+	for (i = 0; i < demand_region_count; i++) {
+		if (addr >= demand_regions[i].start && addr < demand_regions[i].end) {
+			return &demand_regions[i];
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Resuelve una escritura sobre una pagina copy-on-write. Si el mapeo
+ * es el ultimo de la unidad, la pagina solo se vuelve a habilitar para
+ * escritura; en caso contrario se copia en una nueva unidad (la pagina de
+ * ceros no se copia, la nueva unidad solo se llena de ceros).
+ * @param dir Directorio de paginas
+ * @param page Direccion lineal de la pagina
+ * @param pte Entrada de la tabla de paginas
+ * @return 0 si la escritura se puede repetir, -1 si no existe memoria.
+ */
+static int break_cow(page_directory_t * dir, unsigned int page, pte_t * pte) {
+	demand_region_t * region;
+	unsigned short * ref;
+	unsigned int flags;
+	unsigned int phys;
+	char * unit;
+
+	phys = *pte & PAGE_FRAME;
+	flags = (*pte & PAGE_FLAGS & ~PAGE_COW) | PAGE_WRITABLE;
+	ref = page_ref(phys);
+
+	if (ref != 0 && *ref < 2) {
+		*pte = phys | flags;
+		flush_page(dir, page);
+		return 0;
+	}
+
+	unit = allocate_unit();
+
+	if (unit == 0) {
+		return -1;
+	}
+
+	if (phys == zero_page) {
+		memset(unit, 0, PAGE_SIZE);
+	}else {
+		memcpy(unit, (void *)page, PAGE_SIZE);
+	}
+
+	region = find_demand_region(page);
+	if (region != 0) {
+		region->committed++;
+	}
+
+	*pte = (unsigned int)unit | flags;
+	flush_page(dir, page);
+
+	release_frame(phys);
+
+	return 0;
+}
+
+/**
+ * @brief Manejador de la excepcion 14 (Page Fault). Obtiene la direccion
+ * que causo el fallo (CR2) y el codigo de error, y resuelve:
+ * - El acceso a una tabla de paginas del kernel creada despues de clonar
+ *   el directorio actual, copiando la entrada del directorio del kernel.
+ * - La escritura sobre una pagina copy-on-write (ver break_cow()).
+ * - La lectura de una pagina no presente de una region bajo demanda,
+ *   mapeando la pagina de ceros en modo de solo lectura.
+ * - La escritura sobre una pagina no presente de una region bajo demanda,
+ *   mapeando una nueva unidad llena de ceros.
+ * Al retornar el procesador repite la instruccion. Cualquier otro fallo
+ * detiene el sistema.
+ * @param state Estado del procesador al ocurrir la excepcion
+ */
+static void page_fault_handler(interrupt_state * state) {
+	page_directory_t * dir;
+	demand_region_t * region;
+	pde_t kernel_pde;
+	pte_t * pte;
+	unsigned int error;
+	unsigned int addr;
+	unsigned int page;
+	char * unit;
+
+	addr = read_cr2();
+	page = addr & PAGE_FRAME;
+	error = state->error_code;
+	dir = (page_directory_t *)read_cr3();
+
+	kernel_pde = kernel_directory->entries[PDE_INDEX(addr)];
+
+	if (dir != kernel_directory &&
+			!(dir->entries[PDE_INDEX(addr)] & PAGE_PRESENT) &&
+			(kernel_pde & PAGE_PRESENT) && !(kernel_pde & PAGE_USER)) {
+		dir->entries[PDE_INDEX(addr)] = kernel_pde;
+		return;
+	}
+
+	region = find_demand_region(addr);
+
+	/* Las paginas de las regiones del kernel se mapean en el directorio del
+	 * kernel, cuyas tablas comparten todos los directorios */
+	if (region != 0 && !(region->flags & PAGE_USER)) {
+		dir = kernel_directory;
+	}
+
+	pte = get_page_entry(dir, addr, 0);
+
+	if (pte != 0 && (*pte & PAGE_PRESENT)) {
+		if ((error & PAGE_FAULT_WRITE) && (*pte & PAGE_COW)) {
+			if (break_cow(dir, page, pte) == 0) {
+				return;
+			}
+			printf("Page Fault at 0x%x: out of memory. System Halted!\n",
+					addr);
+			for (;;)
+				;
+		}
+
+		/* Entrada obsoleta de la TLB: la pagina ya permite el acceso */
+		if ((!(error & PAGE_FAULT_WRITE) || (*pte & PAGE_WRITABLE)) &&
+				(!(error & PAGE_FAULT_USER) || (*pte & PAGE_USER))) {
+			invlpg(page);
+			return;
+		}
+	}else if (region != 0) {
+		if (!(error & PAGE_FAULT_WRITE) && zero_page != 0) {
+			if (map_page(dir, page, zero_page,
+					(region->flags & ~PAGE_WRITABLE) | PAGE_COW) == 0) {
+				return;
+			}
+		}else {
+			unit = allocate_unit();
+			if (unit != 0 &&
+					map_page(dir, page, (unsigned int)unit, region->flags) == 0) {
+				/* La unidad se encuentra mapeada por identidad */
+				memset(unit, 0, PAGE_SIZE);
+				region->committed++;
+				return;
+			}
+			if (unit != 0) {
+				free_unit(unit);
+			}
+		}
+		printf("Page Fault at 0x%x: out of memory. System Halted!\n", addr);
+		for (;;)
+			;
+	}
+
+	printf("Page Fault at 0x%x, eip 0x%x, error %x. System Halted!\n",
+			addr, state->old_eip, state->error_code);
+
+	/* Las interrupciones se encuentran deshabilitadas */
+	for (;;)
+		;
+}
+
+/**
+ * @brief Reserva en el directorio del kernel una region de direcciones
+ * lineales cuyas paginas se asignan al accederlas por primera vez.
+ * @param start Direccion de inicio, alineada a PAGE_SIZE
+ * @param length Tamao de la region, multiplo de PAGE_SIZE
+ * @param flags Indicadores de las paginas (PAGE_WRITABLE, ...)
+ * @return 0 si la region se reservo, -1 si la paginacion no se encuentra
+ * habilitada, no existe espacio para la region o parte de ella ya se
+ * encuentra mapeada.
+ */
+int reserve_demand_region(unsigned int start, unsigned int length,
+		unsigned int flags) {
+	demand_region_t * region;
+	unsigned int addr;
+
+	if (kernel_directory == 0 || length == 0 ||
+			demand_region_count == DEMAND_REGIONS ||
+			start + length <= start) {
+		return -1;
+	}
+
+	/* La region no debe contener paginas mapeadas ni solaparse con otra
+	 * region bajo demanda */
+	for (addr = start; addr - start < length; addr += PAGE_SIZE) {
+		if (virt_to_phys(kernel_directory, addr) != PAGE_NOT_MAPPED ||
+				find_demand_region(addr) != 0) {
+			return -1;
+		}
+	}
+
+	region = &demand_regions[demand_region_count++];
+	region->start = start;
+	region->end = start + length;
+	region->flags = (flags & PAGE_FLAGS & ~PAGE_LARGE) |
+			((flags & PAGE_USER) ? 0 : kernel_page_flags);
+	region->committed = 0;
+
+	return 0;
+}
+
+/**
+ * @brief Elimina el mapeo de las paginas asignadas dentro de un rango de
+ * una region bajo demanda y devuelve sus unidades al asignador. Las
+ * paginas se volveran a asignar si se accede de nuevo a ellas.
+ * @param start Direccion de inicio del rango, alineada a PAGE_SIZE
+ * @param length Tamao del rango
+ * @return Numero de paginas liberadas.
+ */
+unsigned int release_demand_pages(unsigned int start, unsigned int length) {
+	page_directory_t * dir;
+	demand_region_t * region;
+	unsigned int released;
+	unsigned int addr;
+	unsigned int end;
+	unsigned int phys;
+	pde_t pde;
+
+	region = find_demand_region(start);
+
+	if (region == 0 || length == 0) {
+		return 0;
+	}
+
+	/* El rango no puede exceder la region */
+	end = start + length;
+	if (end > region->end || end < start) {
+		end = region->end;
+	}
+
+	/* Las paginas de las regiones de usuario pertenecen al directorio
+	 * actual */
+	if (region->flags & PAGE_USER) {
+		dir = (page_directory_t *)read_cr3();
+	}else {
+		dir = kernel_directory;
+	}
+
+	released = 0;
+
+	for (addr = start; addr < end && addr >= start;) {
+		pde = dir->entries[PDE_INDEX(addr)];
+		/* Saltar las tablas de paginas que no existen */
+		if (!(pde & PAGE_PRESENT) || (pde & PAGE_LARGE)) {
+			addr = (addr & ~(PAGE_LARGE_SIZE - 1)) + PAGE_LARGE_SIZE;
+			continue;
+		}
+		phys = unmap_page(dir, addr);
+		if (phys != PAGE_NOT_MAPPED && release_frame(phys)) {
+			region->committed--;
+			released++;
+		}
+		addr += PAGE_SIZE;
+	}
+
+	return released;
+}
+
+/**
+ * @brief Crea una copia de un directorio de paginas. Las entradas del
+ * kernel (sin PAGE_USER) se comparten, por lo cual la copia usa las mismas
+ * tablas de paginas del kernel. Las paginas de usuario se comparten en modo
+ * copy-on-write: ambas copias las mapean en modo de solo lectura, y la
+ * primera escritura de cada copia obtiene su propia unidad.
+ * @param dir Directorio a copiar
+ * @return Nuevo directorio, 0 si no existe memoria.
+ */
+page_directory_t * clone_directory(page_directory_t * dir) {
+	page_directory_t * clone;
+	pte_t * table;
+	pte_t * copy;
+	int i;
+	int j;
+
+	clone = (page_directory_t *)allocate_page_table();
+
+	if (clone == 0) {
+		return 0;
+	}
+
+	for (i = 0; i < PAGE_ENTRIES; i++) {
+		if (!(dir->entries[i] & PAGE_PRESENT) ||
+				!(dir->entries[i] & PAGE_USER) ||
+				(dir->entries[i] & PAGE_LARGE)) {
+			clone->entries[i] = dir->entries[i];
+			continue;
+		}
+
+		copy = allocate_page_table();
+
+		if (copy == 0) {
+			free_directory(clone);
+			return 0;
+		}
+
+		table = (pte_t *)(dir->entries[i] & PAGE_FRAME);
+
+		for (j = 0; j < PAGE_ENTRIES; j++) {
+			if (!(table[j] & PAGE_PRESENT)) {
+				continue;
+			}
+			if (table[j] & PAGE_WRITABLE) {
+				table[j] = (table[j] & ~PAGE_WRITABLE) | PAGE_COW;
+			}
+			share_frame(table[j] & PAGE_FRAME);
+			copy[j] = table[j];
+		}
+
+		clone->entries[i] = (unsigned int)copy | (dir->entries[i] & PAGE_FLAGS);
+	}
+
+	/* Las paginas de usuario del directorio actual ahora son de solo
+	 * lectura */
+	if (read_cr3() == (unsigned int)dir) {
+		write_cr3((unsigned int)dir);
+	}
+
+	return clone;
+}
+
+/**
+ * @brief Libera un directorio de paginas creado con clone_directory(): sus
+ * tablas de paginas de usuario y las unidades que ya no comparte con otro
+ * directorio. Las tablas del kernel no se modifican.
+ * @param dir Directorio a liberar. No puede ser el directorio actual ni el
+ * directorio del kernel.
+ */
+void free_directory(page_directory_t * dir) {
+	demand_region_t * region;
+	pte_t * table;
+	unsigned int addr;
+	int i;
+	int j;
+
+	if (dir == 0 || dir == kernel_directory ||
+			read_cr3() == (unsigned int)dir) {
+		return;
+	}
+
+	for (i = 0; i < PAGE_ENTRIES; i++) {
+		if (!(dir->entries[i] & PAGE_PRESENT) ||
+				!(dir->entries[i] & PAGE_USER) ||
+				(dir->entries[i] & PAGE_LARGE)) {
+			continue;
+		}
+
+		table = (pte_t *)(dir->entries[i] & PAGE_FRAME);
+
+		for (j = 0; j < PAGE_ENTRIES; j++) {
+			if (!(table[j] & PAGE_PRESENT)) {
+				continue;
+			}
+			addr = (i * PAGE_ENTRIES + j) * PAGE_SIZE;
+			if (release_frame(table[j] & PAGE_FRAME)) {
+				region = find_demand_region(addr);
+				if (region != 0) {
+					region->committed--;
+				}
+			}
+		}
+
+		free_unit((char *)table);
+	}
+
+	free_unit((char *)dir);
+}
@@ -13,15 +13,87 @@
 #include <multiboot.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <slab.h>
+#include <paging.h>
+#include <asm.h>
 
 /* Referencia a la variable global kernel_keap */
-/** @brief Variable global para el heap. Sobre este heap actua kmalloc. */
+/** @brief Variable global para el heap. Sobre este heap actua kmalloc. Sus
+ * paginas se asignan bajo demanda (ver setup_kernel_heap()). */
 static heap_t * kernel_heap;
 
+/** @brief Heaps (arenas) del kernel. El primero es kernel_heap; los demas
+ * se crean en regiones de unidades cuando kernel_heap no tiene espacio (o
+ * no existe) y ningun heap puede crecer con unidades contiguas. */
+static heap_t * kernel_heaps[KERNEL_HEAPS];
+
+/** @brief Numero de heaps del kernel */
+static int kernel_heap_count;
+
 /** @brief Variable global del kernel que almacena el inicio del
  * heap del kernel */
 unsigned int kernel_heap_start;
 
+/** @brief Tabla hash de las regiones de unidades asignadas por kmalloc,
+ * indexada por la direccion de inicio de la region */
+static hash_kmalloc_region kmalloc_regions;
+
+/** @brief Cache de los descriptores de las regiones de unidades asignadas
+ * por kmalloc */
+static kmem_cache_t * kmalloc_region_cache;
+
+#if KMALLOC_MAGAZINES
+/** @brief Magazines de cada CPU */
+static kmalloc_cpu_cache_t kmalloc_cpu_caches[KERNEL_CPUS];
+#endif
+
+#if KMALLOC_TRACK_CALLERS
+/** @brief Tabla de regiones rastreadas (direccionamiento abierto con sondeo
+ * lineal), indexada por la direccion de la region */
+static kmalloc_track_t kmalloc_tracks[KMALLOC_TRACK_ENTRIES];
+
+/** @brief Numero de regiones rastreadas */
+static unsigned int kmalloc_tracked;
+
+/** @brief Numero de regiones que no se rastrearon por falta de espacio en la
+ * tabla */
+static unsigned int kmalloc_untracked;
+
+static void kmalloc_track(void * ptr, unsigned int size, void * caller);
+static void kmalloc_untrack(void * ptr);
+
+/** @brief Registra la region asignada y el sitio que la solicito */
+#define KMALLOC_TRACK(ptr, size) \
+	kmalloc_track(ptr, size, __builtin_return_address(0))
+/** @brief Elimina el registro de una region */
+#define KMALLOC_UNTRACK(ptr) kmalloc_untrack(ptr)
+#else
+#define KMALLOC_TRACK(ptr, size)
+#define KMALLOC_UNTRACK(ptr)
+#endif
+
+/** @brief Funcin para comparar una region asignada por kmalloc con una
+ * direccion */
+int equals_key_kmalloc_region(kmalloc_region_t * a, void *b) {
+    return (unsigned int)b - a->base;
+}
+
+/** @brief Funcin que obtiene la clave de una region asignada por kmalloc:
+ * su direccion de inicio */
+void * key_kmalloc_region(kmalloc_region_t * a) {
+    return (void *)a->base;
+}
+
+/** @brief Funcin hash de la direccion de inicio de una region asignada
+ * por kmalloc (hash multiplicativo sobre el numero de unidad) */
+unsigned int hash_key_kmalloc_region(void * key) {
+    return GENERIC_HASH_MIX((unsigned int)key / MEMORY_UNIT_SIZE);
+}
+
+/** @brief Implementacin de las primitivas para gestionar tablas hash de
+ * tipo kmalloc_region_t*/
+IMPLEMENT_GENERIC_HASH_TYPE(kmalloc_region_t, kmalloc_region);
+
  /** @brief Siguiente unidad disponible en el mapa de bits */
  unsigned int next_free_unit;
 
@@ -34,6 +106,9 @@ unsigned int kernel_heap_start;
  /** @brief Marco inicial de las unidades  disponibles en memoria */
  unsigned int base_unit;
 
+ /** @brief Unidad siguiente a la ultima unidad disponible en memoria */
+ unsigned int end_unit;
+
 /** @brief Variable global del kernel que almacena el inicio de la regin
  * de memoria disponible */
 unsigned int memory_start;
@@ -44,6 +119,38 @@ unsigned int memory_length;
 /** @brief Mnima direccin de memoria permitida para liberar */
 unsigned int allowed_free_start;
 
+/**
+ * @brief Reserva al inicio de la memoria disponible las estructuras de datos
+ * del asignador de unidades, y establece el rango de unidades gestionado.
+ * @param start Inicio de la memoria disponible, alineado a una unidad
+ * @param end Fin de la memoria disponible, alineado a una unidad
+ * @return Direccin de la primera unidad disponible luego de reservar las
+ * estructuras de datos.
+ */
+static unsigned int setup_unit_allocator(unsigned int start, unsigned int end);
+
+/**
+ * @brief Extiende un heap del kernel con unidades contiguas a su final.
+ * @param heap Heap del kernel
+ * @param size Numero minimo de bytes en el cual se debe extender el heap
+ * @return 1 si el heap se extendio, 0 en caso contrario.
+ */
+static int grow_kernel_heap(heap_t * heap, unsigned int size);
+
+/**
+ * @brief Devuelve al asignador de unidades las unidades de un heap del
+ * kernel que se encuentran por encima de su tope.
+ * @param heap Heap del kernel
+ */
+static void shrink_kernel_heap(heap_t * heap);
+
+/**
+ * @brief Libera las paginas del heap del kernel que se encuentran por
+ * encima de su tope.
+ * @param heap Heap del kernel
+ */
+static void shrink_demand_heap(heap_t * heap);
+
 /**
  * @brief Esta rutina inicializa el mapa de bits de memoria,
  * a partir de la informacion obtenida del GRUB.
@@ -201,35 +308,13 @@ void setup_memory(void){
 
 	/* Inicializar en cero el heap del kernel */
 	kernel_heap = 0;
+	kernel_heap_count = 0;
 
 	printf("Memory start at %u = %x\n", memory_start, memory_start);
 
 	/* Existe una regin de memoria disponible? */
 	if (memory_start > 0 && memory_length > 0) {
 
-		/* Se encontro memoria disponible? configurar el heap del kernel
-		 * justo al inicio de la memoria disponible!
-		 */
-		kernel_heap_start = memory_start;
-
-		/* Avanzar la direccion de memoria disponible, tanto como
-		 * ocupa el heap del kernel */
-		memory_start = memory_start + KERNEL_HEAP_SIZE;
-
-		/* Restar el tamanio del heap a la cantidad de memoria disponible */
-		memory_length = memory_length - KERNEL_HEAP_SIZE;
-
-		/* Configurar el heap del kernel */
-		kernel_heap = setup_heap((void*)kernel_heap_start, KERNEL_HEAP_SIZE);
-
-		printf("Kernel heap at: 0x%x Size: %d KB\n", kernel_heap->base,
-					kernel_heap->limit / 1024);
-
-		/* Antes de retornar, establecer la minima direccin de memoria
-		 * permitida para liberar*/
-
-		//printf("Free units before setting up memory: %d\n", free_units);
-
 		tmp_start = memory_start;
 		/* Calcular la direccin en la cual finaliza la memoria disponible */
 		tmp_end = tmp_start + memory_length;
@@ -240,13 +325,16 @@ void setup_memory(void){
 		tmp_start = round_up_to_memory_unit(tmp_start);
 		tmp_end = round_down_to_memory_unit(tmp_end);
 
-		/* Calcular el tamao de la regin de memoria disponible, redondeada
-		 * a lmites de unidades de memoria */
-		tmp_length = tmp_end - tmp_start;
+		/* Reservar al inicio de la memoria disponible las estructuras de
+		 * datos del asignador de unidades */
+		tmp_start = setup_unit_allocator(tmp_start, tmp_end);
+
+		/* El heap del kernel no ocupa memoria fisica: se crea en
+		 * setup_kernel_heap(), luego de habilitar la paginacion */
 
 		/* Actualizar las variables globales del kernel */
 		memory_start = tmp_start;
-		memory_length = tmp_length;
+		memory_length = tmp_end - memory_start;
 
 		printf("Memory start at %u = %x\n", memory_start, memory_start);
 
@@ -259,22 +347,550 @@ void setup_memory(void){
 		next_free_unit = allowed_free_start / MEMORY_UNIT_SIZE;
 
 		total_units = free_units;
-		base_unit = next_free_unit;
+
+		/* Inicializar la tabla de regiones de unidades de kmalloc */
+		init_hash_kmalloc_region(&kmalloc_regions);
+		kmalloc_region_cache = kmem_cache_create("kmalloc_region",
+				sizeof(kmalloc_region_t), 0, 0);
 
 		 printf("Available memory at: 0x%x units: %d Total memory: %d\n",
 				memory_start, total_units, memory_length);
 	}
  }
 
+#if PHYSMEM_ALLOCATOR == PHYSMEM_BUDDY
+
+/** @brief Bit de unit_info que indica que la unidad es el inicio de un
+ * bloque libre */
+#define UNIT_FREE 0x80
+
+/** @brief Mascara para obtener el orden del bloque a partir de unit_info */
+#define UNIT_ORDER_MASK 0x1F
+
+/** @brief Informacion de cada unidad dentro del buddy system. Si la unidad
+ * es el inicio de un bloque libre, contiene UNIT_FREE | orden del bloque, en
+ * caso contrario contiene 0. */
+unsigned char * unit_info;
+
+/** @brief Listas de bloques libres del buddy system, una por cada orden */
+list_buddy_block buddy_free[BUDDY_ORDERS];
+
+/** @brief Funcin para comparar dos bloques libres */
+int compare_buddy_block_t(buddy_block_t * a, buddy_block_t *b) {
+    return (unsigned int)b - (unsigned int)a;
+}
+
+/** @brief Funcin para comparar un bloque libre con un escalar */
+int equals_buddy_block_t(buddy_block_t * a, void *b) {
+    return (unsigned int)b - (unsigned int)a;
+}
+
+/** @brief Implementacin de las primitivas para gestionar listas de tipo
+ * buddy_block_t*/
+IMPLEMENT_GENERIC_LIST_TYPE(buddy_block_t, buddy_block);
+
+/**
+ * @brief Marca una unidad como el inicio de un bloque libre de un orden
+ * dado, y lo inserta en la lista de bloques libres de ese orden.
+ * @param unit Numero de la unidad de inicio del bloque
+ * @param order Orden del bloque
+ */
+static __inline__ void push_buddy_block(unsigned int unit, int order) {
+	unit_info[unit - base_unit] = UNIT_FREE | order;
+	push_front_buddy_block(&buddy_free[order],
+			(buddy_block_t *)(unit * MEMORY_UNIT_SIZE));
+}
+
+/**
+ * @brief Extrae un bloque libre de la lista de bloques de su orden.
+ * @param unit Numero de la unidad de inicio del bloque
+ * @param order Orden del bloque
+ */
+static __inline__ void remove_buddy_block_unit(unsigned int unit, int order) {
+	unit_info[unit - base_unit] = 0;
+	remove_buddy_block(&buddy_free[order],
+			(buddy_block_t *)(unit * MEMORY_UNIT_SIZE));
+}
+
+/**
+ * @brief Reserva al inicio de la memoria disponible el arreglo unit_info
+ * (un byte por unidad) e inicializa las listas de bloques libres.
+ * @param start Inicio de la memoria disponible, alineado a una unidad
+ * @param end Fin de la memoria disponible, alineado a una unidad
+ * @return Direccin de la primera unidad disponible luego de reservar las
+ * estructuras de datos.
+ */
+static unsigned int setup_unit_allocator(unsigned int start, unsigned int end) {
+	unsigned int i;
+
+	unit_info = (unsigned char *)start;
+	start += round_up_to_memory_unit((end - start) / MEMORY_UNIT_SIZE);
+
+	base_unit = start / MEMORY_UNIT_SIZE;
+	end_unit = end / MEMORY_UNIT_SIZE;
+
+	/* Inicialmente ninguna unidad es el inicio de un bloque libre */
+	for (i = 0; i < end_unit - base_unit; i++) {
+		unit_info[i] = 0;
+	}
+
+	for (i = 0; i < BUDDY_ORDERS; i++) {
+		init_list_buddy_block(&buddy_free[i]);
+	}
+
+	return start;
+}
+
+/**
+ * @brief Busca el bloque libre que contiene a una unidad. Para cada orden k
+ * se verifica si el bloque alineado a 2^k que contiene a la unidad es un
+ * bloque libre de orden mayor o igual a k.
+ * @param unit Numero de la unidad
+ * @param head Apuntador en el cual se almacena la unidad de inicio del
+ * bloque
+ * @return Orden del bloque libre que contiene a la unidad, -1 si la unidad
+ * no se encuentra libre.
+ */
+static int find_free_block(unsigned int unit, unsigned int * head) {
+	int order;
+	unsigned char info;
+
+	for (order = 0; order < BUDDY_ORDERS; order++) {
+		*head = unit & ~((1 << order) - 1);
+		if (*head < base_unit) {
+			break;
+		}
+		info = unit_info[*head - base_unit];
+		if ((info & UNIT_FREE) && (info & UNIT_ORDER_MASK) >= order) {
+			return info & UNIT_ORDER_MASK;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief Determina si una unidad se encuentra dentro de un bloque libre.
+ * @param unit Numero de la unidad
+ * @return 1 si la unidad esta libre, 0 en caso contrario
+ */
+static int unit_is_free(unsigned int unit) {
+	unsigned int head;
+
+	return find_free_block(unit, &head) >= 0;
+}
+
+/**
+ * @brief Inserta un bloque libre en el buddy system, fusionandolo con su
+ * bloque compaero mientras este se encuentre libre y tenga el mismo orden.
+ * @param unit Numero de la unidad de inicio del bloque
+ * @param order Orden del bloque
+ */
+static void free_buddy_block(unsigned int unit, int order) {
+	unsigned int buddy;
+
+	while (order < BUDDY_ORDERS - 1) {
+		/* El compaero difiere del bloque solo en el bit 'order' */
+		buddy = unit ^ (1 << order);
+
+		/* El compaero debe estar completamente dentro de la memoria
+		 * gestionada, y ser un bloque libre del mismo orden */
+		if (buddy < base_unit || buddy + (1 << order) > end_unit ||
+				unit_info[buddy - base_unit] != (UNIT_FREE | order)) {
+			break;
+		}
+
+		remove_buddy_block_unit(buddy, order);
+
+		/* El bloque fusionado inicia en el menor de los dos */
+		unit &= ~(1 << order);
+		order++;
+	}
+
+	push_buddy_block(unit, order);
+}
+
+/**
+ * @brief Obtiene un bloque libre de un orden dado. Si no existen bloques
+ * libres de ese orden, se divide el bloque libre de menor orden superior.
+ * Las mitades superiores que resultan de la division quedan libres.
+ * @param order Orden del bloque solicitado
+ * @return Numero de la unidad de inicio del bloque, 0 si no existe un
+ * bloque disponible.
+ */
+static unsigned int allocate_buddy_block(int order) {
+	int k;
+	unsigned int unit;
+
+	for (k = order; k < BUDDY_ORDERS && buddy_free[k].head == 0; k++);
+
+	if (k == BUDDY_ORDERS) {
+		return 0;
+	}
+
+	unit = (unsigned int)pop_front_buddy_block(&buddy_free[k])
+			/ MEMORY_UNIT_SIZE;
+	unit_info[unit - base_unit] = 0;
+
+	while (k > order) {
+		k--;
+		push_buddy_block(unit + (1 << k), k);
+	}
+
+	return unit;
+}
+
+/**
+ * @brief Libera un rango de unidades, descomponiendolo en los bloques
+ * alineados mas grandes que caben dentro del rango.
+ * @param unit Primera unidad del rango
+ * @param count Numero de unidades del rango
+ */
+static void release_units(unsigned int unit, unsigned int count) {
+	int order;
+
+	while (count > 0) {
+		/* Mayor orden al cual la unidad se encuentra alineada */
+		order = BUDDY_ORDERS - 1;
+		if (unit != 0 && __builtin_ctz(unit) < order) {
+			order = __builtin_ctz(unit);
+		}
+		/* Y que no exceda el numero de unidades restantes */
+		while ((1 << order) > count) {
+			order--;
+		}
+
+		free_buddy_block(unit, order);
+
+		unit += 1 << order;
+		count -= 1 << order;
+	}
+}
+
+/**
+ * @brief Asigna un rango de unidades contiguas. Se toma un bloque del menor
+ * orden que contiene el numero de unidades solicitado, y las unidades
+ * sobrantes al final del bloque se devuelven a las listas de bloques libres.
+ * @param count Numero de unidades a asignar
+ * @return Numero de la primera unidad del rango, 0 si no existe un rango
+ * contiguo del tamao solicitado.
+ */
+static unsigned int take_units(unsigned int count) {
+	unsigned int unit;
+	int order;
+
+	/* Menor orden cuyo bloque contiene el numero de unidades solicitado */
+	for (order = 0; order < BUDDY_ORDERS && (1 << order) < count; order++);
+
+	if (order == BUDDY_ORDERS) {
+		return 0;
+	}
+
+	unit = allocate_buddy_block(order);
+
+	if (unit != 0) {
+		release_units(unit + count, (1 << order) - count);
+	}
+
+	return unit;
+}
+
+/**
+ * @brief Asigna un rango especifico de unidades libres. El bloque libre que
+ * contiene cada unidad se divide por mitades, y las mitades que no
+ * contienen a la unidad quedan libres.
+ * @param unit Primera unidad del rango
+ * @param count Numero de unidades del rango, todas libres
+ */
+static void claim_units(unsigned int unit, unsigned int count) {
+	unsigned int head;
+	int order;
+
+	for (; count > 0; unit++, count--) {
+		order = find_free_block(unit, &head);
+		if (order < 0) {
+			continue;
+		}
+
+		remove_buddy_block_unit(head, order);
+
+		while (order > 0) {
+			order--;
+			if (unit & (1 << order)) {
+				push_buddy_block(head, order);
+				head += 1 << order;
+			}else {
+				push_buddy_block(head + (1 << order), order);
+			}
+		}
+	}
+}
+
+#else /* PHYSMEM_ALLOCATOR == PHYSMEM_BITMAP */
+
+/** @brief Mapa de bits de memoria. Cada bit referencia una unidad: 1 = unidad
+ * disponible, 0 = unidad asignada o no disponible. El bit 0 de la palabra 0
+ * corresponde a base_unit. */
+unsigned int * memory_bitmap;
+
+/** @brief Nivel de resumen del mapa de bits. Cada bit corresponde a una
+ * palabra de 32 bits de memory_bitmap, y vale 1 si esa palabra contiene al
+ * menos una unidad disponible. */
+unsigned int * memory_summary;
+
+/** @brief Numero de palabras de 32 bits en memory_bitmap */
+unsigned int bitmap_words;
+
+/** @brief Numero de palabras de 32 bits en memory_summary */
+unsigned int summary_words;
+
+/**
+ * @brief Reserva al inicio de la memoria disponible el mapa de bits y su
+ * nivel de resumen, y los marca como no disponibles.
+ * @param start Inicio de la memoria disponible, alineado a una unidad
+ * @param end Fin de la memoria disponible, alineado a una unidad
+ * @return Direccin de la primera unidad disponible luego de reservar las
+ * estructuras de datos.
+ */
+static unsigned int setup_unit_allocator(unsigned int start, unsigned int end) {
+	unsigned int i;
+
+	bitmap_words = ((end - start) / MEMORY_UNIT_SIZE + 31) / 32;
+	summary_words = (bitmap_words + 31) / 32;
+
+	memory_bitmap = (unsigned int *)start;
+	memory_summary = memory_bitmap + bitmap_words;
+
+	start += round_up_to_memory_unit((bitmap_words + summary_words) *
+			sizeof(unsigned int));
+
+	base_unit = start / MEMORY_UNIT_SIZE;
+	end_unit = end / MEMORY_UNIT_SIZE;
+
+	for (i = 0; i < bitmap_words; i++) {
+		memory_bitmap[i] = 0;
+	}
+
+	for (i = 0; i < summary_words; i++) {
+		memory_summary[i] = 0;
+	}
+
+	return start;
+}
+
+/**
+ * @brief Marca un rango de unidades como disponibles o asignadas dentro del
+ * mapa de bits, modificando palabras completas. El nivel de resumen se
+ * actualiza para cada palabra modificada.
+ * @param unit Primera unidad del rango
+ * @param count Numero de unidades del rango
+ * @param available 1 = marcar como disponibles, 0 = marcar como asignadas
+ */
+static void mark_units(unsigned int unit, unsigned int count, int available) {
+	unsigned int index;
+	unsigned int word;
+	unsigned int bits;
+	unsigned int mask;
+
+	index = unit - base_unit;
+
+	while (count > 0) {
+		word = index / 32;
+
+		/* Bits del rango que se encuentran dentro de esta palabra */
+		bits = 32 - (index % 32);
+		if (bits > count) {
+			bits = count;
+		}
+
+		if (bits == 32) {
+			mask = 0xFFFFFFFF;
+		}else {
+			mask = ((1U << bits) - 1) << (index % 32);
+		}
+
+		if (available) {
+			memory_bitmap[word] |= mask;
+			memory_summary[word / 32] |= 1U << (word % 32);
+		}else {
+			memory_bitmap[word] &= ~mask;
+			if (memory_bitmap[word] == 0) {
+				memory_summary[word / 32] &= ~(1U << (word % 32));
+			}
+		}
+
+		index += bits;
+		count -= bits;
+	}
+}
+
+/**
+ * @brief Determina si una unidad se encuentra disponible.
+ * @param unit Numero de la unidad
+ * @return 1 si la unidad esta libre, 0 en caso contrario
+ */
+static int unit_is_free(unsigned int unit) {
+	unsigned int index;
+
+	index = unit - base_unit;
+
+	return (memory_bitmap[index / 32] & (1U << (index % 32))) != 0;
+}
+
+/**
+ * @brief Libera un rango de unidades.
+ * @param unit Primera unidad del rango
+ * @param count Numero de unidades del rango
+ */
+static void release_units(unsigned int unit, unsigned int count) {
+	mark_units(unit, count, 1);
+}
+
+/**
+ * @brief Asigna un rango especifico de unidades libres.
+ * @param unit Primera unidad del rango
+ * @param count Numero de unidades del rango, todas libres
+ */
+static void claim_units(unsigned int unit, unsigned int count) {
+	mark_units(unit, count, 0);
+}
+
+/**
+ * @brief Busca una unidad disponible. La busqueda inicia en la palabra de
+ * resumen que contiene a next_free_unit, y con bsf (__builtin_ctz) se obtiene
+ * la primera palabra con unidades disponibles y dentro de ella la primera
+ * unidad disponible. En el caso comun se requieren solo dos lecturas.
+ * @return Numero de la unidad, 0 si no existen unidades disponibles.
+ */
+static unsigned int take_unit(void) {
+	unsigned int first;
+	unsigned int summary;
+	unsigned int word;
+	unsigned int index;
+	unsigned int i;
+
+	first = 0;
+	if (next_free_unit >= base_unit && next_free_unit < end_unit) {
+		first = (next_free_unit - base_unit) / 32 / 32;
+	}
+
+	for (i = 0; i < summary_words; i++) {
+		summary = first + i;
+		if (summary >= summary_words) {
+			summary -= summary_words;
+		}
+
+		if (memory_summary[summary] != 0) {
+			word = summary * 32 + __builtin_ctz(memory_summary[summary]);
+			index = word * 32 + __builtin_ctz(memory_bitmap[word]);
+
+			mark_units(base_unit + index, 1, 0);
+			next_free_unit = base_unit + index;
+
+			return base_unit + index;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Asigna un rango de unidades contiguas. El mapa de bits se recorre
+ * por palabras: las palabras sin unidades disponibles se omiten usando el
+ * nivel de resumen, las palabras completas extienden el rango actual, y los
+ * rangos dentro de una palabra se buscan con operaciones de mascara.
+ * @param count Numero de unidades a asignar
+ * @return Numero de la primera unidad del rango, 0 si no existe un rango
+ * contiguo del tamao solicitado.
+ */
+static unsigned int take_units(unsigned int count) {
+	unsigned int summary;
+	unsigned int word;
+	unsigned int bits;
+	unsigned int mask;
+	unsigned int shift;
+	unsigned int run;
+	unsigned int run_start;
+	unsigned int k;
+
+	if (count == 1) {
+		return take_unit();
+	}
+
+	/* Longitud e inicio del rango de unidades disponibles que termina al
+	 * final de la palabra anterior */
+	run = 0;
+	run_start = 0;
+
+	for (summary = 0; summary < summary_words; summary++) {
+		/* Ninguna palabra de este grupo tiene unidades disponibles */
+		if (memory_summary[summary] == 0) {
+			run = 0;
+			continue;
+		}
+
+		for (word = summary * 32;
+				word < summary * 32 + 32 && word < bitmap_words; word++) {
+			bits = memory_bitmap[word];
+
+			/* Palabra completa: extender el rango actual */
+			if (bits == 0xFFFFFFFF) {
+				if (run == 0) {
+					run_start = word * 32;
+				}
+				run += 32;
+				if (run >= count) {
+					goto found;
+				}
+				continue;
+			}
+
+			/* Continuar el rango con los bits menos significativos */
+			if (run == 0) {
+				run_start = word * 32;
+			}
+			if (run + __builtin_ctz(~bits) >= count) {
+				goto found;
+			}
+
+			/* Buscar un rango completo dentro de la palabra: luego de
+			 * combinar la mascara con sus desplazamientos, un bit en 1
+			 * indica el inicio de 'count' bits consecutivos en 1 */
+			if (count < 32) {
+				mask = bits;
+				for (k = 1; k < count; k += shift) {
+					shift = (k < count - k) ? k : count - k;
+					mask &= mask >> shift;
+				}
+				if (mask != 0) {
+					run_start = word * 32 + __builtin_ctz(mask);
+					goto found;
+				}
+			}
+
+			/* El nuevo rango lo forman los bits mas significativos en 1 */
+			run = __builtin_clz(~bits);
+			run_start = word * 32 + 32 - run;
+		}
+	}
+
+	return 0;
+
+found:
+	mark_units(base_unit + run_start, count, 0);
+
+	return base_unit + run_start;
+}
+
+#endif
+
 /**
- @brief Busca una unidad libre dentro del mapa de bits de memoria.
- * @return Direccin de inicio de la unidad en memoria.
+ @brief Obtiene una unidad libre dentro de la memoria disponible.
+ * @return Direccin de inicio de la unidad en memoria, 0 si no existen
+ * unidades disponibles.
  */
   char * allocate_unit(void) {
 	 unsigned int unit;
-	 unsigned int entry;
-	 unsigned int offset;
-
+	 unsigned int flags;
 
 	// printf ("%d ", free_units);
 	 /* Si no existen unidades libres, retornar*/
@@ -283,26 +899,30 @@ void setup_memory(void){
 		 return 0;
 	 }
 
-	/* TODO: Implementar la logica para recorrer la lista de
-	 * unidades de memoria y buscar un espacio libre.
-	 * Es posible que se deba partir un nodo libre en dos.
-	 * Se debe retornar un apuntador char * al inicio de la
-	 * region libre. */
+	 flags = save_interrupts();
+
+	 unit = take_units(1);
+
+	 if (unit != 0) {
+		 free_units--;
+	 }
+
+	 restore_interrupts(flags);
 
- 	 return 0;
+ 	 return (char *)(unit * MEMORY_UNIT_SIZE);
   }
 
 
-  /** @brief Busca una regin de memoria contigua libre dentro del mapa de bits
-   * de memoria.
+  /** @brief Busca una regin de memoria contigua libre dentro de la memoria
+   * disponible.
    * @param length Tamao de la regin de memoria a asignar.
-   * @return Direccin de inicio de la regin en memoria.
+   * @return Direccin de inicio de la regin en memoria, 0 si no existe una
+   * regin contigua del tamao solicitado.
    */
   char * allocate_unit_region(unsigned int length) {
 	unsigned int unit;
 	unsigned int unit_count;
-	unsigned int i;
-	int result;
+	unsigned int flags;
 
 	unit_count = (length / MEMORY_UNIT_SIZE);
 
@@ -312,28 +932,76 @@ void setup_memory(void){
 
 	//printf("\tAllocating %d units\n", unit_count);
 
-	if (free_units < unit_count) {
+	if (unit_count == 0 || free_units < unit_count) {
 		 //printf("Warning! out of memory!\n");
 		 return 0;
 	}
 
-	/* TODO: Iterar por la lista para encontra un nodo
-	 * que tenga al menos el numero de unidades solicitados.
-	 * Marcar el nodo como usado, y crear un nuevo nodo en
-	 * el cual queda el resto de unidades disponibles. */
+	flags = save_interrupts();
 
-	  return 0;
+	unit = take_units(unit_count);
+
+	if (unit != 0) {
+		free_units -= unit_count;
+	}
+
+	restore_interrupts(flags);
+
+	return (char *)(unit * MEMORY_UNIT_SIZE);
   }
 
+/**
+ * @brief Asigna una regin de memoria especifica, si todas sus unidades se
+ * encuentran libres.
+ * @param addr Direccin de inicio de la regin, alineada a una unidad
+ * @param length Tamao de la regin de memoria a asignar.
+ * @return Direccin de inicio de la regin, 0 si alguna de sus unidades no
+ * se encuentra libre.
+ */
+char * claim_unit_region(char * addr, unsigned int length) {
+	unsigned int unit;
+	unsigned int unit_count;
+	unsigned int flags;
+	unsigned int i;
+
+	if ((unsigned int)addr % MEMORY_UNIT_SIZE != 0) {
+		return 0;
+	}
+
+	unit = (unsigned int)addr / MEMORY_UNIT_SIZE;
+	unit_count = (length + MEMORY_UNIT_SIZE - 1) / MEMORY_UNIT_SIZE;
+
+	if (unit_count == 0 || unit < base_unit || unit >= end_unit ||
+			unit_count > end_unit - unit) {
+		return 0;
+	}
+
+	flags = save_interrupts();
+
+	for (i = 0; i < unit_count; i++) {
+		if (!unit_is_free(unit + i)) {
+			restore_interrupts(flags);
+			return 0;
+		}
+	}
+
+	claim_units(unit, unit_count);
+
+	free_units -= unit_count;
+
+	restore_interrupts(flags);
+
+	return addr;
+}
+
 /**
  * @brief Permite liberar una unidad de memoria.
  * @param addr Direccin de memoria dentro del rea a liberar.
  */
 void free_unit(char * addr) {
 	 unsigned int start;
-	 unsigned int entry;
-	 int offset;
 	 unsigned int unit;
+	 unsigned int flags;
 
 	 start = round_down_to_memory_unit((unsigned int)addr);
 
@@ -341,17 +1009,24 @@ void free_unit(char * addr) {
 
 	 unit = start / MEMORY_UNIT_SIZE;
 
-	 /* TODO: Buscar la unidad en la lista de unidades, y marcarla como
-	  * disponible.
-	  * Es posible que se requiera fusionar nodos en la lista!*/
+	 if (unit >= end_unit) {return;}
 
-	 /* Marcar la unidad recien liberada como la proxima unidad
-	  * para asignar */
-	 next_free_unit = unit;
+	 flags = save_interrupts();
 
-	 /* Aumentar en 1 el numero de unidades libres */
-	 free_units ++;
+	 /* Ignorar unidades fuera de la memoria gestionada, o que ya se
+	  * encuentran libres */
+	 if (!unit_is_free(unit)) {
+		 release_units(unit, 1);
 
+		 /* Marcar la unidad recien liberada como la proxima unidad
+		  * para asignar */
+		 next_free_unit = unit;
+
+		 /* Aumentar en 1 el numero de unidades libres */
+		 free_units ++;
+	 }
+
+	 restore_interrupts(flags);
  }
 
 /**
@@ -362,41 +1037,1062 @@ void free_unit(char * addr) {
 void free_region(char * start_addr, unsigned int length) {
 	 unsigned int start;
 	 unsigned int end;
+	 unsigned int unit;
+	 unsigned int unit_count;
+	 unsigned int flags;
+	 unsigned int first;
+	 unsigned int i;
 
 	 start = round_down_to_memory_unit((unsigned int)start_addr);
 
 	 if (start < allowed_free_start) {return;}
 
-	 end = start + length;
+	 end = (unsigned int)start_addr + length;
+
+	 unit = start / MEMORY_UNIT_SIZE;
+	 unit_count = (end - start) / MEMORY_UNIT_SIZE;
+	 if ((end - start) % MEMORY_UNIT_SIZE > 0) {
+		 unit_count++;
+	 }
+
+	 /* Ignorar las unidades fuera de la memoria gestionada */
+	 if (unit >= end_unit) {return;}
+	 if (unit + unit_count > end_unit) {
+		 unit_count = end_unit - unit;
+	 }
+
+	 flags = save_interrupts();
+
+	 /* Liberar solo los tramos de unidades asignadas. Las unidades que ya
+	  * se encuentran libres se ignoran, como en free_unit() */
+	 i = 0;
+	 while (i < unit_count) {
+		 if (unit_is_free(unit + i)) {
+			 i++;
+			 continue;
+		 }
 
-	 for (; start < end; start += MEMORY_UNIT_SIZE) {
-		 free_unit((char*)start);
+		 first = i;
+		 while (i < unit_count && !unit_is_free(unit + i)) {
+			 i++;
+		 }
+
+		 release_units(unit + first, i - first);
+		 free_units += i - first;
 	 }
 
 	 /* Almacenar el inicio de la regin liberada para una prxima asignacin */
 	 next_free_unit = (unsigned int)start_addr / MEMORY_UNIT_SIZE;
+
+	 restore_interrupts(flags);
  }
 
 
 
 /**
- * @brief Solicita asignacion de memoria dentro del heap.
- * @param size Tamao requerido
+ * @brief Calcula el fin de la memoria ocupada por un heap del kernel. Los
+ * heaps del kernel siempre ocupan unidades completas.
+ * @param heap Heap del kernel
+ * @return Direccion siguiente a la ultima unidad del heap
+ */
+static __inline__ unsigned int kernel_heap_end(heap_t * heap) {
+	return round_up_to_memory_unit(heap->base + heap->limit +
+			MEMREG_HEADER_SIZE);
+}
+
+/**
+ * @brief Extiende un heap del kernel con unidades contiguas a su final.
+ * Primero se intenta extender el heap en KERNEL_HEAP_GROW_SIZE bytes, para
+ * reducir el numero de extensiones, y luego solo en el tamao requerido.
+ * @param heap Heap del kernel
+ * @param size Numero minimo de bytes en el cual se debe extender el heap
+ * @return 1 si el heap se extendio, 0 en caso contrario.
+ */
+static int grow_kernel_heap(heap_t * heap, unsigned int size) {
+	unsigned int end;
+	unsigned int length;
+
+	end = kernel_heap_end(heap);
+	length = round_up_to_memory_unit(size);
+
+	if (length < KERNEL_HEAP_GROW_SIZE &&
+			claim_unit_region((char *)end, KERNEL_HEAP_GROW_SIZE) != 0) {
+		length = KERNEL_HEAP_GROW_SIZE;
+	}else if (claim_unit_region((char *)end, length) == 0) {
+		return 0;
+	}
+
+	heap->limit += length;
+
+	return 1;
+}
+
+/**
+ * @brief Devuelve al asignador de unidades las unidades de un heap del
+ * kernel que se encuentran por encima de su tope. Un heap nunca se contrae
+ * por debajo de su tamao inicial.
+ * @param heap Heap del kernel
+ */
+static void shrink_kernel_heap(heap_t * heap) {
+	unsigned int end;
+	unsigned int heap_end;
+	unsigned int min_end;
+
+	heap_end = kernel_heap_end(heap);
+
+	/* Fin del espacio usado por el heap, incluyendo su palabra final */
+	end = round_up_to_memory_unit(heap->top + MEMREG_HEADER_SIZE);
+
+	/* Los heaps conservan su primera extension */
+	min_end = (unsigned int)heap + KERNEL_HEAP_GROW_SIZE;
+
+	if (end < min_end) {
+		end = min_end;
+	}
+
+	if (end >= heap_end) {
+		return;
+	}
+
+	free_region((char *)end, heap_end - end);
+
+	heap->limit -= heap_end - end;
+}
+
+/**
+ * @brief Libera las paginas del heap del kernel que se encuentran por
+ * encima de su tope. Su rango de direcciones se conserva reservado, y las
+ * paginas se vuelven a asignar cuando el heap crece de nuevo.
+ * @param heap Heap del kernel
+ */
+static void shrink_demand_heap(heap_t * heap) {
+	unsigned int end;
+
+	/* Fin del espacio usado por el heap, incluyendo su palabra final */
+	end = round_up_to_memory_unit(heap->top + MEMREG_HEADER_SIZE);
+
+	release_demand_pages(end, kernel_heap_end(heap) - end);
+}
+
+/**
+ * @brief Crea el heap del kernel en el rango de direcciones
+ * KERNEL_HEAP_VIRTUAL_BASE, cuyas paginas se asignan bajo demanda. Se debe
+ * invocar luego de setup_paging(). Si el rango no se puede reservar,
+ * kmalloc crea heaps en regiones de unidades a medida que los requiere.
+ */
+void setup_kernel_heap(void) {
+	if (reserve_demand_region(KERNEL_HEAP_VIRTUAL_BASE,
+			KERNEL_HEAP_VIRTUAL_SIZE, PAGE_WRITABLE) < 0) {
+		printf("Unable to reserve the kernel heap at 0x%x\n",
+				KERNEL_HEAP_VIRTUAL_BASE);
+		return;
+	}
+
+	kernel_heap_start = KERNEL_HEAP_VIRTUAL_BASE;
+
+	/* El heap ocupa todo el rango: no requiere crecer, y solo las paginas
+	 * que se acceden ocupan memoria */
+	kernel_heap = setup_heap((void*)kernel_heap_start,
+			KERNEL_HEAP_VIRTUAL_SIZE);
+	kernel_heap->shrink = shrink_demand_heap;
+	kernel_heaps[kernel_heap_count++] = kernel_heap;
+
+	printf("Kernel heap at: 0x%x Reserved: %d KB\n", kernel_heap->base,
+				kernel_heap->limit / 1024);
+}
+
+/**
+ * @brief Asigna memoria dentro de los heaps del kernel. Si ningun heap puede
+ * crecer con unidades contiguas, se crea un nuevo heap en una region de
+ * unidades obtenida del asignador.
+ * @param size Tamao requerido
+ * @param align Alineacion requerida, potencia de 2
+ * @return Puntero a la memoria asignada, 0 si no es posible asignar memoria.
+ */
+static void * kmalloc_heap(unsigned int size, unsigned int align) {
+	heap_t * heap;
+	char * region;
+	void * ptr;
+	int i;
+
+	/* Intentar primero en el heap creado mas recientemente */
+	for (i = kernel_heap_count - 1; i >= 0; i--) {
+		ptr = alloc_aligned_from_heap(kernel_heaps[i], size, align);
+		if (ptr != 0) {
+			return ptr;
+		}
+	}
+
+	if (kernel_heap_count == KERNEL_HEAPS) {
+		return 0;
+	}
+
+	region = allocate_unit_region(KERNEL_HEAP_GROW_SIZE);
+
+	if (region == 0) {
+		return 0;
+	}
+
+	heap = create_heap((unsigned int)region, KERNEL_HEAP_GROW_SIZE,
+			HEAP_DEFAULT_POLICY);
+	heap->grow = grow_kernel_heap;
+	heap->shrink = shrink_kernel_heap;
+	kernel_heaps[kernel_heap_count++] = heap;
+
+	return alloc_aligned_from_heap(heap, size, align);
+}
+
+/**
+ * @brief Elimina un heap adicional del kernel y devuelve sus unidades al
+ * asignador.
+ * @param heap Heap a eliminar, sin regiones asignadas
+ */
+static void release_kernel_heap(heap_t * heap) {
+	int i;
+
+	for (i = 0; i < kernel_heap_count; i++) {
+		if (kernel_heaps[i] == heap) {
+			kernel_heaps[i] = kernel_heaps[--kernel_heap_count];
+			free_region((char *)heap, kernel_heap_end(heap) -
+					(unsigned int)heap);
+			return;
+		}
+	}
+}
+
+/**
+ * @brief Busca el heap del kernel que contiene una direccion.
+ * @param ptr Direccion
+ * @return Heap que contiene la direccion, 0 si no existe.
+ */
+static heap_t * find_kernel_heap(void * ptr) {
+	int i;
+
+	for (i = 0; i < kernel_heap_count; i++) {
+		if ((unsigned int)ptr >= kernel_heaps[i]->base &&
+				(unsigned int)ptr < kernel_heaps[i]->top) {
+			return kernel_heaps[i];
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Asigna una region de unidades propia para una solicitud de kmalloc,
+ * y la registra en la tabla hash de regiones.
+ * @param size Tamao requerido
+ * @param align Alineacion requerida, potencia de 2. Si es mayor que una
+ * unidad, se asigna una region con el espacio suficiente para alinearla y
+ * las unidades sobrantes al inicio y al final se devuelven al asignador.
+ * @return Puntero a la region asignada, 0 si no es posible asignar memoria.
+ */
+static void * kmalloc_units(unsigned int size, unsigned int align) {
+	kmalloc_region_t * region;
+	char * base;
+	unsigned int start;
+	unsigned int end;
+
+	region = (kmalloc_region_t *)kmem_cache_alloc(kmalloc_region_cache);
+
+	if (region == 0) {
+		return 0;
+	}
+
+	if (align <= MEMORY_UNIT_SIZE) {
+		base = allocate_unit_region(size);
+	}else {
+		base = allocate_unit_region(size + align - MEMORY_UNIT_SIZE);
+		if (base != 0) {
+			start = ((unsigned int)base + align - 1) & ~(align - 1);
+			end = round_up_to_memory_unit((unsigned int)base + size +
+					align - MEMORY_UNIT_SIZE);
+			if (start > (unsigned int)base) {
+				free_region(base, start - (unsigned int)base);
+			}
+			base = (char *)start;
+			start = round_up_to_memory_unit(start + size);
+			if (end > start) {
+				free_region((char *)start, end - start);
+			}
+		}
+	}
+
+	if (base == 0) {
+		kmem_cache_free(kmalloc_region_cache, region);
+		return 0;
+	}
+
+	region->base = (unsigned int)base;
+	region->length = size;
+
+	hash_insert_kmalloc_region(&kmalloc_regions, region);
+
+	return (void *)base;
+}
+
+/**
+ * @brief Busca en la tabla hash la region de unidades asignada por kmalloc
+ * que inicia en una direccion.
+ * @param ptr Direccion de inicio de la region
+ * @return Descriptor de la region, 0 si la direccion no corresponde a una
+ * region de unidades.
+ */
+static kmalloc_region_t * lookup_kmalloc_region(void * ptr) {
+	/* Las regiones de unidades siempre se encuentran alineadas */
+	if ((unsigned int)ptr % MEMORY_UNIT_SIZE != 0) {
+		return 0;
+	}
+
+	return hash_find_kmalloc_region(&kmalloc_regions, ptr);
+}
+
+/**
+ * @brief Devuelve al asignador de unidades un heap adicional del kernel que
+ * no tiene regiones asignadas. Las regiones de sus quick-lists se fusionan
+ * antes de verificarlo.
+ * @param heap Heap del kernel
+ */
+static void release_empty_kernel_heap(heap_t * heap) {
+	if (heap != kernel_heap && heap->used_bytes == 0) {
+		heap_flush_quick(heap);
+	}
+
+	if (heap != kernel_heap && (heap->top == heap->base ||
+			(heap->free_count == 1 &&
+			!(((memreg_header_t *)heap->base)->size & MEMREG_USED) &&
+			(unsigned int)MEMREG_NEXT((memreg_header_t *)heap->base)
+				== heap->top))) {
+		release_kernel_heap(heap);
+	}
+}
+
+/**
+ * @brief Libera un bloque dentro de un heap del kernel. Un heap adicional
+ * que queda sin regiones asignadas se devuelve al asignador de unidades.
+ * @param heap Heap que contiene el bloque
+ * @param ptr Puntero al bloque
+ */
+static void free_heap_block(heap_t * heap, void * ptr) {
+	free_from_heap(heap, MEMREG_HEADER(ptr));
+	release_empty_kernel_heap(heap);
+}
+
+#if KMALLOC_MAGAZINES
+
+/**
+ * @brief Obtiene la CPU actual. Mientras el kernel no inicialice las demas
+ * CPUs, siempre es la CPU 0.
+ * @return Numero de la CPU actual
+ */
+static __inline__ int kmalloc_cpu(void) {
+	return 0;
+}
+
+/**
+ * @brief Asigna un bloque pequeo desde el magazine de la CPU actual. Si el
+ * magazine esta vacio, se llena con un lote de bloques asignados en el heap.
+ * @param size Tamao requerido, maximo KMALLOC_MAGAZINE_MAX_SIZE
+ * @return Puntero al bloque, 0 si no es posible llenar el magazine.
+ */
+static void * kmalloc_magazine_get(unsigned int size) {
+	kmalloc_magazine_t * magazine;
+	void * ptr;
+	int class;
+
+	/* Menor clase cuyos bloques tienen al menos size bytes */
+	class = 0;
+	if (size > (1 << KMALLOC_MAGAZINE_SHIFT)) {
+		class = 32 - __builtin_clz(size - 1) - KMALLOC_MAGAZINE_SHIFT;
+	}
+
+	magazine = &kmalloc_cpu_caches[kmalloc_cpu()].magazines[class];
+
+	if (magazine->count == 0) {
+		while (magazine->count < KMALLOC_MAGAZINE_BATCH) {
+			ptr = kmalloc_heap(1 << (class + KMALLOC_MAGAZINE_SHIFT),
+					MEMREG_GRANULARITY);
+			if (ptr == 0) {
+				break;
+			}
+			MEMREG_HEADER(ptr)->size |= MEMREG_CACHED;
+			magazine->blocks[magazine->count++] = ptr;
+		}
+		if (magazine->count == 0) {
+			return 0;
+		}
+	}
+
+	ptr = magazine->blocks[--magazine->count];
+	MEMREG_HEADER(ptr)->size &= ~MEMREG_CACHED;
+
+	return ptr;
+}
+
+/**
+ * @brief Almacena un bloque liberado en el magazine de la CPU actual que
+ * corresponde a su tamao. Si el magazine esta lleno, primero se devuelve
+ * al heap un lote con sus bloques mas antiguos. El bloque permanece
+ * asignado en el heap y se marca con MEMREG_CACHED.
+ * @param ptr Bloque asignado dentro de un heap del kernel, ya validado
+ * @return 1 si el bloque se almaceno en un magazine, 0 si el bloque es muy
+ * grande para los magazines.
+ */
+static int kmalloc_magazine_put(void * ptr) {
+	kmalloc_magazine_t * magazine;
+	unsigned int limit;
+	unsigned int i;
+	int class;
+
+	limit = MEMREG_LIMIT(MEMREG_HEADER(ptr));
+
+	if (limit >= 2 * KMALLOC_MAGAZINE_MAX_SIZE) {
+		return 0;
+	}
+
+	/* Mayor clase cuyo tamao cabe en el bloque */
+	class = 31 - __builtin_clz(limit) - KMALLOC_MAGAZINE_SHIFT;
+	if (class < 0) {
+		return 0;
+	}
+
+	magazine = &kmalloc_cpu_caches[kmalloc_cpu()].magazines[class];
+
+	if (magazine->count == KMALLOC_MAGAZINE_SIZE) {
+		for (i = 0; i < KMALLOC_MAGAZINE_BATCH; i++) {
+			MEMREG_HEADER(magazine->blocks[i])->size &= ~MEMREG_CACHED;
+			free_heap_block(find_kernel_heap(magazine->blocks[i]),
+					magazine->blocks[i]);
+		}
+		for (i = KMALLOC_MAGAZINE_BATCH; i < KMALLOC_MAGAZINE_SIZE; i++) {
+			magazine->blocks[i - KMALLOC_MAGAZINE_BATCH] = magazine->blocks[i];
+		}
+		magazine->count -= KMALLOC_MAGAZINE_BATCH;
+	}
+
+	MEMREG_HEADER(ptr)->size |= MEMREG_CACHED;
+	magazine->blocks[magazine->count++] = ptr;
+
+	return 1;
+}
+
+#endif
+
+/**
+ * @brief Devuelve al heap todos los bloques de los magazines de kmalloc, y
+ * fusiona las quick-lists de los heaps del kernel. Se debe invocar cuando
+ * se requiere recuperar memoria.
+ */
+void kmalloc_drain(void) {
+#if KMALLOC_MAGAZINES
+	kmalloc_magazine_t * magazine;
+	void * ptr;
+	int cpu;
+	int class;
+#endif
+	unsigned int flags;
+	int i;
+
+	flags = save_interrupts();
+
+#if KMALLOC_MAGAZINES
+	for (cpu = 0; cpu < KERNEL_CPUS; cpu++) {
+		for (class = 0; class < KMALLOC_MAGAZINE_CLASSES; class++) {
+			magazine = &kmalloc_cpu_caches[cpu].magazines[class];
+			while (magazine->count > 0) {
+				ptr = magazine->blocks[--magazine->count];
+				MEMREG_HEADER(ptr)->size &= ~MEMREG_CACHED;
+				free_heap_block(find_kernel_heap(ptr), ptr);
+			}
+		}
+	}
+#endif
+
+	/* Al eliminar un heap su posicion se ocupa con el ultimo, que ya fue
+	 * procesado */
+	for (i = kernel_heap_count - 1; i >= 0; i--) {
+		heap_flush_quick(kernel_heaps[i]);
+		release_empty_kernel_heap(kernel_heaps[i]);
+	}
+
+	restore_interrupts(flags);
+}
+
+/**
+ * @brief Asigna un bloque para kmalloc. Los bloques pequeos sin
+ * alineacion especial se toman del magazine de la CPU actual. Las
+ * solicitudes de mas de KMALLOC_LARGE_SIZE bytes, o cuyo relleno de
+ * alineacion no cabe en ese tamao, reciben una region de unidades propia.
+ * @param size Tamao requerido
+ * @param align Alineacion requerida, potencia de 2
+ * @return Puntero al bloque asignado, 0 si no es posible asignar memoria.
+ */
+static void * kmalloc_block(unsigned int size, unsigned int align) {
+	void * ptr;
+	int units;
+
+	units = (align > KMALLOC_LARGE_SIZE ||
+			size > KMALLOC_LARGE_SIZE + MEMREG_GRANULARITY - align);
+
+#if KMALLOC_MAGAZINES
+	if (size <= KMALLOC_MAGAZINE_MAX_SIZE && align <= MEMREG_GRANULARITY) {
+		ptr = kmalloc_magazine_get(size);
+		if (ptr != 0) {
+			return ptr;
+		}
+	}
+#endif
+
+	ptr = units ? kmalloc_units(size, align) : kmalloc_heap(size, align);
+
+#if KMALLOC_MAGAZINES
+	/* Recuperar los bloques de los magazines antes de fallar */
+	if (ptr == 0) {
+		kmalloc_drain();
+		ptr = units ? kmalloc_units(size, align) : kmalloc_heap(size, align);
+	}
+#endif
+
+	return ptr;
+}
+
+/**
+ * @brief Libera un bloque asignado con kmalloc_block(). Si la direccion
+ * corresponde a una region de unidades registrada en la tabla hash, la
+ * region se devuelve al asignador de unidades. Los bloques pequeos del
+ * heap se almacenan en el magazine de la CPU actual.
+ * @param ptr Puntero al bloque
+ */
+static void kfree_block(void * ptr) {
+	kmalloc_region_t * region;
+#if KMALLOC_MAGAZINES
+	memreg_header_t * header;
+#endif
+	heap_t * heap;
+
+	region = lookup_kmalloc_region(ptr);
+
+	if (region != 0) {
+		hash_remove_kmalloc_region(&kmalloc_regions, region);
+		free_region((char *)region->base, region->length);
+		kmem_cache_free(kmalloc_region_cache, region);
+		return;
+	}
+
+	heap = find_kernel_heap(ptr);
+
+	if (heap == 0) {
+		printf("kfree: 0x%x was not allocated with kmalloc\n", ptr);
+		return;
+	}
+
+#if KMALLOC_MAGAZINES
+	/* Un bloque invalido o ya liberado no se debe almacenar en el magazine,
+	 * ya que se entregaria dos veces. free_from_heap() reporta el error. */
+	header = MEMREG_HEADER(ptr);
+	if (memreg_is_valid(heap, header) && (header->size & MEMREG_USED) &&
+			!(header->size & MEMREG_CACHED) && kmalloc_magazine_put(ptr)) {
+		return;
+	}
+#endif
+
+	free_heap_block(heap, ptr);
+}
+
+/**
+ * @brief Cambia el tamao de una region de unidades asignada por kmalloc
+ * sin moverla. Las unidades sobrantes se devuelven al asignador, y las
+ * unidades adicionales se reclaman a continuacion de la region.
+ * @param region Descriptor de la region
+ * @param size Nuevo tamao requerido
+ * @return 1 si la region tiene el nuevo tamao, 0 si no es posible cambiar
+ * el tamao sin mover la region.
+ */
+static int resize_kmalloc_region(kmalloc_region_t * region,
+		unsigned int size) {
+	unsigned int end;
+	unsigned int new_end;
+
+	end = round_up_to_memory_unit(region->base + region->length);
+	new_end = round_up_to_memory_unit(region->base + size);
+
+	if (new_end < end) {
+		free_region((char *)new_end, end - new_end);
+	}else if (new_end > end &&
+			claim_unit_region((char *)end, new_end - end) == 0) {
+		return 0;
+	}
+
+	region->length = size;
+
+	return 1;
+}
+
+/**
+ * @brief Cambia el tamao de un bloque asignado con kmalloc_block().
+ * Primero se intenta cambiar el tamao sin mover el bloque: dentro del
+ * heap la region se reduce liberando su final, o se aumenta fusionandola
+ * con la region libre siguiente; una region de unidades libera o reclama
+ * unidades a su final. Solo si esto no es posible se asigna un nuevo
+ * bloque, se copian los datos y se libera el bloque anterior.
+ * @param ptr Puntero al bloque
+ * @param size Nuevo tamao requerido, mayor que 0
+ * @return Puntero al bloque con el nuevo tamao, 0 si no es posible
+ * asignar memoria. En este caso el bloque original no se modifica.
+ */
+static void * krealloc_block(void * ptr, unsigned int size) {
+	kmalloc_region_t * region;
+	heap_t * heap;
+	unsigned int old_size;
+	void * new_ptr;
+
+	region = lookup_kmalloc_region(ptr);
+
+	if (region != 0) {
+		if (size > KMALLOC_LARGE_SIZE && resize_kmalloc_region(region, size)) {
+			return ptr;
+		}
+		old_size = region->length;
+	}else {
+		heap = find_kernel_heap(ptr);
+		if (heap == 0) {
+			return 0;
+		}
+		if (size <= KMALLOC_LARGE_SIZE && resize_in_heap(heap, ptr, size)) {
+			return ptr;
+		}
+		old_size = MEMREG_LIMIT(MEMREG_HEADER(ptr));
+	}
+
+	/* Mover el bloque */
+	new_ptr = kmalloc_block(size, MEMREG_GRANULARITY);
+
+	if (new_ptr == 0) {
+		return 0;
+	}
+
+	memcpy(new_ptr, ptr, (old_size < size) ? old_size : size);
+
+	kfree_block(ptr);
+
+	return new_ptr;
+}
+
+#if KMALLOC_REDZONE
+
+/**
+ * @brief Obtiene el encabezado de la zona de proteccion de una region.
+ */
+#define KMALLOC_REDZONE_HEADER(ptr) ((kmalloc_redzone_t *)(ptr) - 1)
+
+/**
+ * @brief Escribe las zonas de proteccion alrededor de los datos de un
+ * bloque.
+ * @param block Bloque asignado, 0 si la asignacion fallo
+ * @param lead Desplazamiento de los datos dentro del bloque
+ * @param size Tamao de los datos
+ * @return Puntero a los datos, 0 si block es 0.
+ */
+static void * kmalloc_redzone_set(void * block, unsigned int lead,
+		unsigned int size) {
+	kmalloc_redzone_t * header;
+	unsigned char * tail;
+	unsigned int i;
+
+	if (block == 0) {
+		return 0;
+	}
+
+	header = KMALLOC_REDZONE_HEADER((char *)block + lead);
+	header->lead = lead;
+	header->size = size;
+	header->canary = KMALLOC_REDZONE_MAGIC ^ lead ^ size;
+
+	tail = (unsigned char *)block + lead + size;
+	for (i = 0; i < KMALLOC_REDZONE_TAIL; i++) {
+		tail[i] = KMALLOC_REDZONE_BYTE;
+	}
+
+	return (char *)block + lead;
+}
+
+/**
+ * @brief Verifica las zonas de proteccion de una region. Los errores se
+ * reportan con printf.
+ * @param ptr Puntero a los datos
+ * @param op Nombre de la operacion, para el reporte
+ * @return Puntero al bloque que contiene la region, 0 si el encabezado esta
+ * corrupto o la region ya fue liberada. En ese caso el bloque no se puede
+ * liberar con seguridad.
+ */
+static void * kmalloc_redzone_check(void * ptr, char * op) {
+	kmalloc_redzone_t * header;
+	unsigned char * tail;
+	unsigned int i;
+
+	header = KMALLOC_REDZONE_HEADER(ptr);
+
+	if (header->canary == KMALLOC_REDZONE_FREED) {
+		printf("%s: 0x%x was already freed\n", op, ptr);
+		return 0;
+	}
+
+	if (header->canary != (KMALLOC_REDZONE_MAGIC ^ header->lead ^
+			header->size)) {
+		printf("%s: red zone before 0x%x is corrupted\n", op, ptr);
+		return 0;
+	}
+
+	tail = (unsigned char *)ptr + header->size;
+	for (i = 0; i < KMALLOC_REDZONE_TAIL; i++) {
+		if (tail[i] != KMALLOC_REDZONE_BYTE) {
+			printf("%s: red zone after 0x%x (%u bytes) is corrupted\n", op,
+					ptr, header->size);
+			break;
+		}
+	}
+
+	return (char *)ptr - header->lead;
+}
+
+#endif
+
+/**
+ * @brief Solicita asignacion de memoria dentro del heap. Las solicitudes de
+ * mas de KMALLOC_LARGE_SIZE bytes reciben una region de unidades propia,
+ * alineada a una unidad.
+ * @param size Tamao requerido
  * @return Puntero a la base de la region de memoria asignada, 0 si
  *  		 no es posible asignar memoria.
  */
 void * kmalloc(unsigned int size) {
-	return alloc_from_heap(kernel_heap, size);
+	unsigned int flags;
+	void * ptr;
+
+	flags = save_interrupts();
+
+#if KMALLOC_REDZONE
+	ptr = kmalloc_redzone_set(kmalloc_block(KMALLOC_REDZONE_LEAD + size +
+			KMALLOC_REDZONE_TAIL, MEMREG_GRANULARITY), KMALLOC_REDZONE_LEAD,
+			size);
+#else
+	ptr = kmalloc_block(size, MEMREG_GRANULARITY);
+#endif
+
+	KMALLOC_TRACK(ptr, size);
+
+	restore_interrupts(flags);
+
+	return ptr;
 }
 
 /**
- * @brief Solicita liberar una region de memoria dentro del heap
+ * @brief Solicita asignacion de memoria alineada. Dentro del heap, el
+ * relleno necesario para alinear la region se separa como una region libre;
+ * las solicitudes grandes o con una alineacion mayor reciben una region de
+ * unidades propia. La region se libera con kfree().
+ * @param size Tamao requerido
+ * @param align Alineacion requerida, potencia de 2
+ * @return Puntero a la region asignada, alineado a align. 0 si no es posible
+ * asignar memoria o si align no es potencia de 2.
+ */
+void * kmalloc_aligned(unsigned int size, unsigned int align) {
+	unsigned int flags;
+	void * ptr;
+#if KMALLOC_REDZONE
+	unsigned int lead;
+#endif
+
+	if (align == 0 || (align & (align - 1)) != 0) {
+		return 0;
+	}
+
+	flags = save_interrupts();
+
+#if KMALLOC_REDZONE
+	/* Los datos conservan la alineacion del bloque */
+	lead = (KMALLOC_REDZONE_LEAD + align - 1) & ~(align - 1);
+	ptr = kmalloc_redzone_set(kmalloc_block(lead + size +
+			KMALLOC_REDZONE_TAIL, align), lead, size);
+#else
+	ptr = kmalloc_block(size, align);
+#endif
+
+	KMALLOC_TRACK(ptr, size);
+
+	restore_interrupts(flags);
+
+	return ptr;
+}
+
+/**
+ * @brief Solicita liberar una region de memoria dentro del heap. Si la
+ * direccion corresponde a una region de unidades registrada en la tabla
+ * hash, la region se devuelve al asignador de unidades.
  * @param ptr Puntero a la base de la region de memoria a liberar
  */
 void  kfree(void * ptr) {
-	memreg_header_t * header;
+	unsigned int flags;
+#if KMALLOC_REDZONE
+	void * block;
+#endif
 
-	header = (memreg_header_t *)((unsigned int) ptr - MEMREG_HEADER_SIZE);
+	if (ptr == 0) {
+		return;
+	}
+
+	flags = save_interrupts();
+
+	KMALLOC_UNTRACK(ptr);
+
+#if KMALLOC_REDZONE
+	block = kmalloc_redzone_check(ptr, "kfree");
+	if (block != 0) {
+		KMALLOC_REDZONE_HEADER(ptr)->canary = KMALLOC_REDZONE_FREED;
+		kfree_block(block);
+	}
+#else
+	kfree_block(ptr);
+#endif
+
+	restore_interrupts(flags);
+}
+
+/**
+ * @brief Cambia el tamao de una region de memoria asignada con kmalloc.
+ * Primero se intenta cambiar el tamao sin mover la region: dentro del
+ * heap la region se reduce liberando su final, o se aumenta fusionandola
+ * con la region libre siguiente; una region de unidades libera o reclama
+ * unidades a su final. Solo si esto no es posible se asigna una nueva
+ * region, se copian los datos y se libera la region anterior.
+ * @param ptr Puntero a la region, 0 para asignar una nueva region
+ * @param size Nuevo tamao requerido. Si es 0, la region se libera.
+ * @return Puntero a la region con el nuevo tamao, 0 si no es posible
+ * asignar memoria. En este caso la region original no se modifica.
+ */
+void * krealloc(void * ptr, unsigned int size) {
+	unsigned int flags;
+	void * new_ptr;
+#if KMALLOC_REDZONE
+	void * block;
+	unsigned int lead;
+#endif
+
+	if (ptr == 0) {
+		new_ptr = kmalloc(size);
+		KMALLOC_TRACK(new_ptr, size);
+		return new_ptr;
+	}
+
+	if (size == 0) {
+		kfree(ptr);
+		return 0;
+	}
+
+	flags = save_interrupts();
+
+#if KMALLOC_REDZONE
+	new_ptr = 0;
+	block = kmalloc_redzone_check(ptr, "krealloc");
+	if (block != 0) {
+		lead = (char *)ptr - (char *)block;
+		new_ptr = kmalloc_redzone_set(krealloc_block(block, lead + size +
+				KMALLOC_REDZONE_TAIL), lead, size);
+	}
+#else
+	new_ptr = krealloc_block(ptr, size);
+#endif
+
+	if (new_ptr != 0) {
+		if (new_ptr != ptr) {
+			KMALLOC_UNTRACK(ptr);
+		}
+		/* El sitio que cambia el tamao de la region es quien la conserva */
+		KMALLOC_TRACK(new_ptr, size);
+	}
+
+	restore_interrupts(flags);
+
+	return new_ptr;
+}
+
+/**
+ * @brief Verifica la consistencia de todos los heaps del kernel con
+ * heap_check().
+ * @return Numero de errores encontrados, 0 si los heaps son consistentes.
+ */
+int kmalloc_check(void) {
+	int errors;
+	int i;
+
+	errors = 0;
 
-	free_from_heap(kernel_heap, header);
+	for (i = 0; i < kernel_heap_count; i++) {
+		errors += heap_check(kernel_heaps[i]);
+	}
+
+	return errors;
 }
+
+#if KMALLOC_TRACK_CALLERS
+
+/**
+ * @brief Calcula la posicion inicial de una region en la tabla de regiones
+ * rastreadas (hash multiplicativo sobre la direccion).
+ * @param ptr Region
+ * @return Posicion en la tabla
+ */
+static __inline__ unsigned int kmalloc_track_slot(void * ptr) {
+	return ((unsigned int)ptr * 2654435761U) >> (32 - KMALLOC_TRACK_BITS);
+}
+
+/**
+ * @brief Registra una region asignada con kmalloc y el sitio que la
+ * solicito. Si la region ya se encuentra registrada, se actualiza.
+ * @param ptr Region asignada, 0 si la asignacion fallo
+ * @param size Tamao solicitado
+ * @param caller Direccion de retorno de quien solicito la region
+ */
+static void kmalloc_track(void * ptr, unsigned int size, void * caller) {
+	unsigned int i;
+	unsigned int n;
+
+	if (ptr == 0) {
+		return;
+	}
+
+	i = kmalloc_track_slot(ptr);
+
+	for (n = 0; n < KMALLOC_TRACK_ENTRIES; n++) {
+		if (kmalloc_tracks[i].ptr == 0 || kmalloc_tracks[i].ptr == ptr) {
+			if (kmalloc_tracks[i].ptr == 0) {
+				kmalloc_tracked++;
+			}
+			kmalloc_tracks[i].ptr = ptr;
+			kmalloc_tracks[i].size = size;
+			kmalloc_tracks[i].caller = caller;
+			return;
+		}
+		i = (i + 1) & (KMALLOC_TRACK_ENTRIES - 1);
+	}
+
+	kmalloc_untracked++;
+}
+
+/**
+ * @brief Elimina el registro de una region. Las entradas siguientes se
+ * desplazan hacia atras para que la secuencia de sondeo de cada region no
+ * quede interrumpida.
+ * @param ptr Region liberada
+ */
+static void kmalloc_untrack(void * ptr) {
+	unsigned int i;
+	unsigned int j;
+	unsigned int k;
+	unsigned int n;
+
+	i = kmalloc_track_slot(ptr);
+
+	for (n = 0; kmalloc_tracks[i].ptr != ptr; n++) {
+		if (kmalloc_tracks[i].ptr == 0 || n == KMALLOC_TRACK_ENTRIES) {
+			return;
+		}
+		i = (i + 1) & (KMALLOC_TRACK_ENTRIES - 1);
+	}
+
+	kmalloc_tracked--;
+
+	/* Con la tabla llena no existe una entrada libre que termine el
+	 * desplazamiento, por lo cual se limita a una vuelta */
+	j = i;
+	for (n = 1; n < KMALLOC_TRACK_ENTRIES; n++) {
+		j = (j + 1) & (KMALLOC_TRACK_ENTRIES - 1);
+		if (kmalloc_tracks[j].ptr == 0) {
+			break;
+		}
+		/* La entrada j puede ocupar la posicion i solo si su posicion
+		 * inicial no se encuentra en el intervalo circular (i, j] */
+		k = kmalloc_track_slot(kmalloc_tracks[j].ptr);
+		if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j)) {
+			continue;
+		}
+		kmalloc_tracks[i] = kmalloc_tracks[j];
+		i = j;
+	}
+
+	kmalloc_tracks[i].ptr = 0;
+}
+
+/**
+ * @brief Imprime los sitios que tienen mas bytes asignados con kmalloc,
+ * agrupando las regiones rastreadas por direccion de retorno.
+ * @param top Numero de sitios a imprimir
+ */
+void kmem_dump_leaks(int top) {
+	static kmalloc_site_t sites[KMALLOC_TRACK_SITES];
+	kmalloc_site_t tmp;
+	unsigned int total;
+	unsigned int other_bytes;
+	unsigned int other_count;
+	int count;
+	int max;
+	int i;
+	int j;
+
+	count = 0;
+	total = 0;
+	other_bytes = 0;
+	other_count = 0;
+
+	for (i = 0; i < KMALLOC_TRACK_ENTRIES; i++) {
+		if (kmalloc_tracks[i].ptr == 0) {
+			continue;
+		}
+		total += kmalloc_tracks[i].size;
+		for (j = 0; j < count &&
+				sites[j].caller != kmalloc_tracks[i].caller; j++);
+		if (j == count) {
+			if (count == KMALLOC_TRACK_SITES) {
+				other_bytes += kmalloc_tracks[i].size;
+				other_count++;
+				continue;
+			}
+			sites[j].caller = kmalloc_tracks[i].caller;
+			sites[j].bytes = 0;
+			sites[j].count = 0;
+			count++;
+		}
+		sites[j].bytes += kmalloc_tracks[i].size;
+		sites[j].count++;
+	}
+
+	printf("kmalloc: %u bytes in %u regions, %u sites\n", total,
+			kmalloc_tracked, count);
+
+	/* Seleccionar los sitios con mas bytes asignados */
+	for (i = 0; i < top && i < count; i++) {
+		max = i;
+		for (j = i + 1; j < count; j++) {
+			if (sites[j].bytes > sites[max].bytes) {
+				max = j;
+			}
+		}
+		tmp = sites[i];
+		sites[i] = sites[max];
+		sites[max] = tmp;
+		printf("  0x%x: %u bytes in %u regions\n", sites[i].caller,
+				sites[i].bytes, sites[i].count);
+	}
+
+	if (other_count > 0) {
+		printf("  other sites: %u bytes in %u regions\n", other_bytes,
+				other_count);
+	}
+
+	if (kmalloc_untracked > 0) {
+		printf("  %u regions were not tracked (table full)\n",
+				kmalloc_untracked);
+	}
+}
+
+#endif
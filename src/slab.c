@@ -0,0 +1,337 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ *
+ * @brief Este archivo implementa los caches de objetos (slab allocator) sobre
+ * las unidades de memoria obtenidas con allocate_unit().
+ */
+
+#include <slab.h>
+#include <physmem.h>
+#include <stdio.h>
+#include <asm.h>
+
+/** @brief Cache de los descriptores de cache (kmem_cache_t). Se inicializa
+ * al crear el primer cache. */
+static kmem_cache_t cache_cache;
+
+/** @brief Funcin para comparar dos slabs */
+int compare_slab_t(slab_t * a, slab_t *b) {
+    return (unsigned int)b - (unsigned int)a;
+}
+
+/** @brief Funcin para comparar un slab con un escalar */
+int equals_slab_t(slab_t * a, void *b) {
+    return (unsigned int)b - (unsigned int)a;
+}
+
+/** @brief Implementacin de las primitivas para gestionar listas de tipo
+ * slab_t*/
+IMPLEMENT_GENERIC_LIST_TYPE(slab_t, slab);
+
+/**
+ * @brief Obtiene el siguiente objeto libre, almacenado dentro de un objeto
+ * libre.
+ * @param cache Cache al cual pertenece el objeto
+ * @param obj Objeto libre
+ * @return Siguiente objeto libre dentro del slab, 0 si no existe.
+ */
+static __inline__ void * next_free_object(kmem_cache_t * cache, void * obj) {
+	return *(void **)((unsigned int)obj + cache->free_offset);
+}
+
+/**
+ * @brief Almacena dentro de un objeto libre el apuntador al siguiente objeto
+ * libre.
+ * @param cache Cache al cual pertenece el objeto
+ * @param obj Objeto libre
+ * @param next Siguiente objeto libre dentro del slab
+ */
+static __inline__ void set_next_free_object(kmem_cache_t * cache, void * obj,
+		void * next) {
+	*(void **)((unsigned int)obj + cache->free_offset) = next;
+}
+
+/**
+ * @brief Inicializa un descriptor de cache.
+ * @return 0 si el cache se inicializo, -1 si los parametros no son validos.
+ */
+static int init_kmem_cache(kmem_cache_t * cache, char * name,
+		unsigned int size, unsigned int align, kmem_ctor ctor) {
+	int i;
+
+	if (size == 0 || size > KMEM_CACHE_MAX_SIZE) {
+		return -1;
+	}
+
+	/* La alineacion minima permite almacenar el apuntador al siguiente
+	 * objeto libre */
+	if (align < sizeof(void *)) {
+		align = sizeof(void *);
+	}
+
+	/* La alineacion debe ser potencia de 2 */
+	if ((align & (align - 1)) != 0) {
+		return -1;
+	}
+
+	for (i = 0; i < KMEM_CACHE_NAME_LENGTH - 1 && name != 0 && name[i] != 0;
+			i++) {
+		cache->name[i] = name[i];
+	}
+	cache->name[i] = 0;
+
+	cache->object_size = size;
+	cache->align = align;
+	cache->ctor = ctor;
+
+	/* Sin constructor, el apuntador al siguiente objeto libre ocupa el inicio
+	 * del objeto. Con constructor se ubica luego del objeto. */
+	if (ctor == 0) {
+		cache->free_offset = 0;
+	}else {
+		size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+		cache->free_offset = size;
+		size += sizeof(void *);
+	}
+
+	cache->size = (size + align - 1) & ~(align - 1);
+	cache->offset = (sizeof(slab_t) + align - 1) & ~(align - 1);
+
+	if (cache->offset + cache->size > MEMORY_UNIT_SIZE) {
+		return -1;
+	}
+
+	cache->objects = (MEMORY_UNIT_SIZE - cache->offset) / cache->size;
+
+	init_list_slab(&cache->partial);
+	init_list_slab(&cache->full);
+	init_list_slab(&cache->empty);
+
+	return 0;
+}
+
+/**
+ * @brief Crea un nuevo slab para un cache, a partir de una unidad de memoria.
+ * Todos los objetos del slab se insertan en su lista de objetos libres y se
+ * inicializan con el constructor del cache.
+ * @param cache Cache al cual pertenece el slab
+ * @return Apuntador al nuevo slab, 0 si no existen unidades disponibles.
+ */
+static slab_t * create_slab(kmem_cache_t * cache) {
+	slab_t * slab;
+	unsigned int obj;
+	unsigned int i;
+
+	slab = (slab_t *)allocate_unit();
+
+	if (slab == 0) {
+		return 0;
+	}
+
+	slab->cache = cache;
+	slab->inuse = 0;
+	slab->free = 0;
+
+	/* Construir la lista de objetos libres desde el ultimo objeto, para
+	 * que los objetos se asignen en orden ascendente */
+	for (i = cache->objects; i > 0; i--) {
+		obj = (unsigned int)slab + cache->offset + (i - 1) * cache->size;
+		if (cache->ctor != 0) {
+			cache->ctor((void *)obj);
+		}
+		set_next_free_object(cache, (void *)obj, slab->free);
+		slab->free = (void *)obj;
+	}
+
+	return slab;
+}
+
+/**
+ * @brief Crea un cache de objetos.
+ * @param name Nombre del cache
+ * @param size Tamao de los objetos, maximo KMEM_CACHE_MAX_SIZE
+ * @param align Alineacion de los objetos (potencia de 2), 0 para usar la
+ * alineacion minima (tamao de un apuntador)
+ * @param ctor Rutina que inicializa cada objeto cuando se crea un slab, 0 si
+ * los objetos no requieren inicializacion.
+ * @return Apuntador al cache creado, 0 si no es posible crear el cache.
+ */
+kmem_cache_t * kmem_cache_create(char * name, unsigned int size,
+		unsigned int align, kmem_ctor ctor) {
+	kmem_cache_t * cache;
+	unsigned int flags;
+
+	/* El cache de descriptores se inicializa al crear el primer cache */
+	flags = save_interrupts();
+	if (cache_cache.objects == 0) {
+		init_kmem_cache(&cache_cache, "kmem_cache", sizeof(kmem_cache_t),
+				0, 0);
+	}
+	restore_interrupts(flags);
+
+	cache = (kmem_cache_t *)kmem_cache_alloc(&cache_cache);
+
+	if (cache == 0) {
+		return 0;
+	}
+
+	if (init_kmem_cache(cache, name, size, align, ctor) < 0) {
+		kmem_cache_free(&cache_cache, cache);
+		return 0;
+	}
+
+	return cache;
+}
+
+/**
+ * @brief Asigna un objeto de un cache. El objeto se toma de un slab
+ * parcialmente lleno; si no existe, de un slab vacio, y si tampoco existe
+ * se crea un nuevo slab.
+ * @param cache Cache del cual se asigna el objeto
+ * @return Apuntador al objeto, 0 si no es posible asignar memoria.
+ */
+void * kmem_cache_alloc(kmem_cache_t * cache) {
+	unsigned int flags;
+	slab_t * slab;
+	void * obj;
+
+	if (cache == 0) {
+		return 0;
+	}
+
+	flags = save_interrupts();
+
+	slab = front_slab(&cache->partial);
+
+	if (slab == 0) {
+		slab = pop_front_slab(&cache->empty);
+		if (slab == 0) {
+			slab = create_slab(cache);
+		}
+		if (slab == 0) {
+			restore_interrupts(flags);
+			return 0;
+		}
+		push_front_slab(&cache->partial, slab);
+	}
+
+	/* Tomar el primer objeto libre del slab */
+	obj = slab->free;
+	slab->free = next_free_object(cache, obj);
+	slab->inuse++;
+
+	/* Si el slab quedo lleno, moverlo a la lista de slabs llenos */
+	if (slab->free == 0) {
+		remove_slab(&cache->partial, slab);
+		push_front_slab(&cache->full, slab);
+	}
+
+	restore_interrupts(flags);
+
+	return obj;
+}
+
+/**
+ * @brief Libera un objeto de un cache. Un objeto que no pertenece al cache,
+ * o que ya se encuentra libre, se reporta y no se libera.
+ * @param cache Cache al cual pertenece el objeto
+ * @param obj Apuntador al objeto a liberar
+ */
+void kmem_cache_free(kmem_cache_t * cache, void * obj) {
+	unsigned int flags;
+	slab_t * slab;
+	void * it;
+
+	if (cache == 0 || obj == 0) {
+		return;
+	}
+
+	/* El encabezado del slab se encuentra al inicio de la unidad que
+	 * contiene al objeto */
+	slab = (slab_t *)((unsigned int)obj & ~(MEMORY_UNIT_SIZE - 1));
+
+	flags = save_interrupts();
+
+	/* Validacion: el objeto debe pertenecer a un slab de este cache */
+	if (slab->cache != cache || slab->inuse == 0 ||
+			((unsigned int)obj - (unsigned int)slab - cache->offset)
+			% cache->size != 0) {
+		printf("kmem_cache_free: 0x%x does not belong to cache %s\n", obj,
+				cache->name);
+		restore_interrupts(flags);
+		return;
+	}
+
+	/* Un objeto que se encuentra en la lista de objetos libres del slab ya
+	 * fue liberado. Insertarlo de nuevo formaria un ciclo en la lista. */
+	for (it = slab->free; it != 0; it = next_free_object(cache, it)) {
+		if (it == obj) {
+			printf("kmem_cache_free: 0x%x in cache %s is already free\n",
+					obj, cache->name);
+			restore_interrupts(flags);
+			return;
+		}
+	}
+
+	/* Un slab lleno pasa a la lista de slabs parcialmente llenos */
+	if (slab->free == 0) {
+		remove_slab(&cache->full, slab);
+		push_front_slab(&cache->partial, slab);
+	}
+
+	set_next_free_object(cache, obj, slab->free);
+	slab->free = obj;
+	slab->inuse--;
+
+	/* Un slab sin objetos asignados pasa a la lista de slabs vacios, o se
+	 * libera si el cache ya tiene suficientes slabs vacios */
+	if (slab->inuse == 0) {
+		remove_slab(&cache->partial, slab);
+		if (cache->empty.count < KMEM_CACHE_EMPTY_SLABS) {
+			push_front_slab(&cache->empty, slab);
+		}else {
+			slab->cache = 0;
+			free_unit((char *)slab);
+		}
+	}
+
+	restore_interrupts(flags);
+}
+
+/**
+ * @brief Destruye un cache de objetos. El cache no debe tener objetos
+ * asignados; todas sus unidades de memoria se liberan.
+ * @param cache Cache a destruir
+ * @return 0 si el cache se destruyo, -1 si aun tiene objetos asignados.
+ */
+int kmem_cache_destroy(kmem_cache_t * cache) {
+	unsigned int flags;
+	slab_t * slab;
+
+	if (cache == 0 || cache == &cache_cache) {
+		return -1;
+	}
+
+	flags = save_interrupts();
+
+	if (cache->partial.head != 0 || cache->full.head != 0) {
+		restore_interrupts(flags);
+		return -1;
+	}
+
+	while ((slab = pop_front_slab(&cache->empty)) != 0) {
+		slab->cache = 0;
+		free_unit((char *)slab);
+	}
+
+	cache->objects = 0;
+
+	restore_interrupts(flags);
+
+	kmem_cache_free(&cache_cache, cache);
+
+	return 0;
+}
@@ -259,3 +259,70 @@ int atoi(char *buf, int base) {
 	}
 	return result;
 }
+
+/**
+ * @brief Copia un bloque de memoria. Los bloques no se deben solapar.
+ * Si ambos bloques se encuentran alineados a 4 bytes, se copian palabras
+ * de 32 bits.
+ * @param dest Direccion de destino
+ * @param src Direccion de origen
+ * @param n Numero de bytes a copiar
+ * @return Direccion de destino
+ */
+void * memcpy(void * dest, const void * src, unsigned int n) {
+	unsigned char * d;
+	const unsigned char * s;
+
+	d = (unsigned char *)dest;
+	s = (const unsigned char *)src;
+
+	if ((((unsigned int)d | (unsigned int)s) & 3) == 0) {
+		while (n >= 4) {
+			*(unsigned int *)d = *(const unsigned int *)s;
+			d += 4;
+			s += 4;
+			n -= 4;
+		}
+	}
+
+	while (n > 0) {
+		*d++ = *s++;
+		n--;
+	}
+
+	return dest;
+}
+
+/**
+ * @brief Llena un bloque de memoria con un valor.
+ * @param dest Direccion del bloque
+ * @param c Valor con el cual se llena el bloque (se toma el byte menos
+ * significativo)
+ * @param n Numero de bytes a llenar
+ * @return Direccion del bloque
+ */
+void * memset(void * dest, int c, unsigned int n) {
+	unsigned char * d;
+	unsigned int word;
+
+	d = (unsigned char *)dest;
+	word = (c & 0xFF) * 0x01010101;
+
+	while (n > 0 && ((unsigned int)d & 3) != 0) {
+		*d++ = (unsigned char)c;
+		n--;
+	}
+
+	while (n >= 4) {
+		*(unsigned int *)d = word;
+		d += 4;
+		n -= 4;
+	}
+
+	while (n > 0) {
+		*d++ = (unsigned char)c;
+		n--;
+	}
+
+	return dest;
+}
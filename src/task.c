@@ -0,0 +1,566 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ *
+ * @brief Este archivo implementa las tareas del kernel y el planificador
+ * expropiativo por prioridades.
+ */
+
+#include <task.h>
+#include <timer.h>
+#include <pm.h>
+#include <physmem.h>
+#include <slab.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <asm.h>
+
+/** @brief Tarea en ejecucion */
+task_t * current_task;
+
+/** @brief Numero de ticks del timer desde que se inicializaron las tareas */
+unsigned int scheduler_ticks;
+
+/** @brief Bloque de control de la tarea inicial, que ejecuta cmain() */
+static task_t main_task;
+
+/** @brief Tarea que se ejecuta cuando no existen tareas listas */
+static task_t * idle_task;
+
+/** @brief Colas de tareas listas, una por cada nivel de prioridad */
+static list_task ready_queues[TASK_PRIORITIES];
+
+/** @brief Mapa de bits de las colas de tareas listas que no se encuentran
+ * vacias. El bit i corresponde a la cola de prioridad i. */
+static unsigned int ready_map;
+
+/** @brief Tareas que terminaron y cuyos recursos no se han liberado */
+static list_task finished_tasks;
+
+/** @brief Cache de los bloques de control de las tareas */
+static kmem_cache_t * task_cache;
+
+/** @brief Identificador de la siguiente tarea */
+static unsigned int next_task_id;
+
+/** @brief Ticks que le restan a la tarea actual antes de ser expropiada */
+static unsigned int quantum;
+
+/** @brief Ticks transcurridos desde la ultima restauracion de las
+ * prioridades base */
+static unsigned int aging_ticks;
+
+/** @brief Funcin para comparar dos tareas */
+int compare_task_t(task_t * a, task_t * b) {
+	return (int)b->id - (int)a->id;
+}
+
+/** @brief Funcin para comparar una tarea con un escalar (su id) */
+int equals_task_t(task_t * a, void * b) {
+	return (unsigned int)b - a->id;
+}
+
+/** @brief Implementacin de las primitivas para gestionar listas de tipo
+ * task_t*/
+IMPLEMENT_GENERIC_LIST_TYPE(task_t, task);
+
+/**
+ * @brief Retorna la mayor prioridad de las tareas listas.
+ * @return Prioridad, -1 si no existen tareas listas.
+ */
+static __inline__ int highest_ready_priority(void) {
+	if (ready_map == 0) {
+		return -1;
+	}
+	/* Posicion del bit mas significativo (bsr) */
+	return 31 - __builtin_clz(ready_map);
+}
+
+/**
+ * @brief Inserta una tarea al final de la cola de su prioridad.
+ * @param task Tarea lista
+ */
+static void enqueue_task(task_t * task) {
+	push_back_task(&ready_queues[task->priority], task);
+	ready_map |= 1 << task->priority;
+}
+
+/**
+ * @brief Retira una tarea de la cola de su prioridad.
+ * @param task Tarea lista
+ */
+static void dequeue_task(task_t * task) {
+	remove_task(&ready_queues[task->priority], task);
+	if (ready_queues[task->priority].count == 0) {
+		ready_map &= ~(1 << task->priority);
+	}
+}
+
+/**
+ * @brief Retira la primera tarea de la cola de mayor prioridad.
+ * @return Tarea, 0 si no existen tareas listas.
+ */
+static task_t * pop_ready_task(void) {
+	task_t * task;
+	int priority;
+
+	priority = highest_ready_priority();
+
+	if (priority < 0) {
+		return 0;
+	}
+
+	task = pop_front_task(&ready_queues[priority]);
+	if (ready_queues[priority].count == 0) {
+		ready_map &= ~(1 << priority);
+	}
+
+	return task;
+}
+
+/**
+ * @brief Libera la pila y el bloque de control de las tareas que
+ * terminaron. Una tarea terminada ya no se ejecuta, por lo cual su pila se
+ * puede liberar desde cualquier otra tarea.
+ */
+static void reap_tasks(void) {
+	task_t * task;
+	unsigned int flags;
+
+	flags = save_interrupts();
+
+	while ((task = pop_front_task(&finished_tasks)) != 0) {
+		free_region(task->stack, TASK_STACK_SIZE);
+		kmem_cache_free(task_cache, task);
+	}
+
+	restore_interrupts(flags);
+}
+
+/**
+ * @brief Rutina de la tarea ociosa: libera las tareas terminadas y detiene
+ * el procesador hasta la siguiente interrupcion. Mientras no existan
+ * tareas listas, el timer no genera una IRQ0 en cada tick.
+ * @param arg No se usa
+ */
+static void idle_loop(void * arg) {
+	for (;;) {
+		reap_tasks();
+		/* Programar el one-shot con las interrupciones deshabilitadas. sti
+		 * solo las habilita a partir de la siguiente instruccion (hlt), por
+		 * lo cual una interrupcion que despierta una tarea no puede ocurrir
+		 * entre timer_enter_idle() y hlt y dejar el procesador detenido */
+		inline_assembly("cli");
+		timer_enter_idle();
+		inline_assembly("sti; hlt");
+	}
+}
+
+/**
+ * @brief Restaura la prioridad base de las tareas listas y de la tarea
+ * actual que se encuentran por debajo de ella. Sin esta restauracion, una
+ * tarea que usa intensivamente el procesador y cuya prioridad minima es
+ * mayor que la prioridad de otra tarea lista nunca le cede el procesador.
+ */
+static void age_tasks(void) {
+	task_t * task;
+	task_t * next;
+	int priority;
+
+	/* Las tareas se mueven a colas de mayor prioridad, en las cuales ya se
+	 * encuentran en su prioridad base */
+	for (priority = 0; priority < TASK_PRIORITIES; priority++) {
+		for (task = ready_queues[priority].head; task != 0; task = next) {
+			next = task->next_task;
+			if (task->priority < task->base_priority) {
+				dequeue_task(task);
+				task->priority = task->base_priority;
+				enqueue_task(task);
+			}
+		}
+	}
+
+	if (current_task->priority < current_task->base_priority) {
+		current_task->priority = current_task->base_priority;
+	}
+}
+
+/**
+ * @brief Manejador del tick del timer. Cuenta los ticks y expropia la tarea
+ * actual cuando termina su quantum, o de inmediato si existe una tarea
+ * lista de mayor prioridad. Cada TASK_AGING_TICKS ticks restaura la
+ * prioridad base de las tareas.
+ * @param ticks Ticks transcurridos desde el tick anterior
+ */
+static void scheduler_tick(unsigned int ticks) {
+	scheduler_ticks += ticks;
+	current_task->ticks += ticks;
+
+	aging_ticks += ticks;
+	if (aging_ticks >= TASK_AGING_TICKS) {
+		aging_ticks = 0;
+		age_tasks();
+	}
+
+	if (quantum <= ticks) {
+		/* La tarea consumio su quantum completo: pierde un nivel de
+		 * prioridad, sin bajar mas de TASK_PRIORITY_BONUS niveles de su
+		 * prioridad base. Si continua en ejecucion recibe un nuevo
+		 * quantum. */
+		if (current_task->priority > 0 && current_task->priority >
+				current_task->base_priority - TASK_PRIORITY_BONUS) {
+			current_task->priority--;
+		}
+		quantum = TASK_QUANTUM;
+		schedule();
+	}else {
+		quantum -= ticks;
+		if (highest_ready_priority() > current_task->priority) {
+			schedule();
+		}
+	}
+}
+
+/**
+ * @brief Manejador de la interrupcion TASK_YIELD_INTERRUPT.
+ * @param state Estado del procesador al ocurrir la interrupcion
+ */
+static void yield_handler(interrupt_state * state) {
+	/* La tarea cedio el procesador antes de terminar su quantum: recupera
+	 * un nivel de prioridad si se encontraba por debajo de su base */
+	if (current_task->priority < current_task->base_priority) {
+		current_task->priority++;
+	}
+	schedule();
+}
+
+/**
+ * @brief Selecciona la siguiente tarea a ejecutar. Se invoca desde un
+ * manejador de interrupcion: almacena el contexto de la tarea actual y
+ * establece current_esp al contexto de la nueva tarea.
+ */
+void schedule(void) {
+	/* Esta variable definida en isr.S contiene el apuntador al marco de
+	 * interrupcion de la tarea interrumpida */
+	extern unsigned int current_esp;
+
+	task_t * next;
+
+	/* La tarea actual continua si no existen tareas listas de igual o mayor
+	 * prioridad */
+	if (current_task->state == TASK_RUNNING && (ready_map == 0 ||
+			highest_ready_priority() < current_task->priority)) {
+		return;
+	}
+
+	current_task->context = (interrupt_state *)current_esp;
+
+	/* La tarea actual se inserta al final de su cola antes de seleccionar la
+	 * siguiente, para alternar las tareas de igual prioridad. La tarea
+	 * ociosa nunca se inserta en las colas de tareas listas. */
+	if (current_task->state == TASK_RUNNING) {
+		current_task->state = TASK_READY;
+		if (current_task != idle_task) {
+			enqueue_task(current_task);
+		}
+	}
+
+	next = pop_ready_task();
+
+	/* Sin tareas listas se ejecuta la tarea ociosa */
+	if (next == 0) {
+		next = idle_task;
+	}
+
+	/* La tarea ociosa pudo dejar el timer en modo one-shot: los ticks
+	 * periodicos se requieren para medir el quantum */
+	if (current_task == idle_task && next != idle_task) {
+		timer_exit_idle();
+	}
+
+	if (next->directory != 0 &&
+			(unsigned int)next->directory != read_cr3()) {
+		write_cr3((unsigned int)next->directory);
+	}
+
+	next->state = TASK_RUNNING;
+	next->switches++;
+	current_task = next;
+	quantum = TASK_QUANTUM;
+	current_esp = (unsigned int)next->context;
+}
+
+/**
+ * @brief Crea el bloque de control y la pila de una tarea, sin insertarla
+ * en las colas de tareas listas.
+ * @param name Nombre de la tarea
+ * @param entry Rutina que ejecuta la tarea
+ * @param arg Parametro que recibe la rutina
+ * @return Bloque de control de la tarea, 0 si no existe memoria.
+ */
+static task_t * new_task(char * name, task_entry entry, void * arg) {
+	interrupt_state * context;
+	unsigned int flags;
+	task_t * task;
+	int i;
+
+	reap_tasks();
+
+	task = (task_t *)kmem_cache_alloc(task_cache);
+
+	if (task == 0) {
+		return 0;
+	}
+
+	task->stack = allocate_unit_region(TASK_STACK_SIZE);
+
+	if (task->stack == 0) {
+		kmem_cache_free(task_cache, task);
+		return 0;
+	}
+
+	for (i = 0; i < TASK_NAME_LENGTH - 1 && name != 0 && name[i] != 0; i++) {
+		task->name[i] = name[i];
+	}
+	task->name[i] = 0;
+
+	/* Crear el marco de interrupcion inicial en el tope de la pila, como si
+	 * la tarea hubiera sido interrumpida al inicio de entry */
+	context = (interrupt_state *)(task->stack + TASK_STACK_SIZE -
+			sizeof(interrupt_state));
+	memset(context, 0, sizeof(interrupt_state));
+
+	context->gs = KERNEL_DATA_SELECTOR;
+	context->fs = KERNEL_DATA_SELECTOR;
+	context->es = KERNEL_DATA_SELECTOR;
+	context->ds = KERNEL_DATA_SELECTOR;
+	context->old_eip = (unsigned int)entry;
+	context->old_cs = KERNEL_CODE_SELECTOR;
+	/* El bit 1 de EFLAGS siempre se encuentra en 1 */
+	context->old_eflags = EFLAGS_IF | 0x2;
+
+	/* iret sin cambio de privilegio no recupera old_esp ni old_ss: estas
+	 * posiciones son la pila inicial de la tarea, con la direccion de
+	 * retorno de entry (task_exit) y su parametro */
+	context->old_esp = (unsigned int)task_exit;
+	context->old_ss = (unsigned int)arg;
+
+	task->context = context;
+	task->directory = current_task->directory;
+	task->ticks = 0;
+	task->switches = 0;
+	task->state = TASK_READY;
+	task->priority = TASK_PRIORITY_DEFAULT;
+	task->base_priority = TASK_PRIORITY_DEFAULT;
+	task->wakeup_pending = 0;
+
+	flags = save_interrupts();
+	task->id = next_task_id++;
+	restore_interrupts(flags);
+
+	return task;
+}
+
+/**
+ * @brief Crea una tarea con prioridad TASK_PRIORITY_DEFAULT y la inserta al
+ * final de la cola de su prioridad.
+ * @param name Nombre de la tarea
+ * @param entry Rutina que ejecuta la tarea. Cuando retorna, la tarea
+ * termina.
+ * @param arg Parametro que recibe la rutina
+ * @return Bloque de control de la tarea, 0 si no existe memoria.
+ */
+task_t * create_task(char * name, task_entry entry, void * arg) {
+	unsigned int flags;
+	task_t * task;
+
+	task = new_task(name, entry, arg);
+
+	if (task == 0) {
+		return 0;
+	}
+
+	flags = save_interrupts();
+	enqueue_task(task);
+	restore_interrupts(flags);
+
+	return task;
+}
+
+/**
+ * @brief Establece la prioridad base de una tarea. Su prioridad actual se
+ * reinicia a la prioridad base.
+ * @param task Tarea
+ * @param priority Prioridad, entre 0 y TASK_PRIORITIES - 1
+ */
+void task_set_priority(task_t * task, int priority) {
+	unsigned int flags;
+
+	if (task == 0 || task == idle_task || priority < 0 ||
+			priority >= TASK_PRIORITIES) {
+		return;
+	}
+
+	flags = save_interrupts();
+
+	/* Una tarea lista se mueve a la cola de su nueva prioridad */
+	if (task->state == TASK_READY) {
+		dequeue_task(task);
+	}
+
+	task->base_priority = priority;
+	task->priority = priority;
+
+	if (task->state == TASK_READY) {
+		enqueue_task(task);
+	}
+
+	restore_interrupts(flags);
+}
+
+/**
+ * @brief Cede el procesador a la siguiente tarea lista de igual o mayor
+ * prioridad.
+ */
+void task_yield(void) {
+	if (current_task != 0) {
+		inline_assembly("int %0" : : "i" (TASK_YIELD_INTERRUPT));
+	}
+}
+
+/**
+ * @brief Bloquea la tarea actual hasta que otra tarea o un manejador de
+ * interrupcion la despierte con task_wakeup(). Si la tarea ya fue
+ * despertada, retorna de inmediato.
+ */
+void task_block(void) {
+	unsigned int flags;
+
+	flags = save_interrupts();
+
+	if (current_task->wakeup_pending) {
+		current_task->wakeup_pending = 0;
+	}else {
+		/* La interrupcion de software se atiende aun con las interrupciones
+		 * deshabilitadas. La tarea continua aqui cuando se despierta. */
+		current_task->state = TASK_BLOCKED;
+		task_yield();
+	}
+
+	restore_interrupts(flags);
+}
+
+/**
+ * @brief Despierta una tarea bloqueada y eleva su prioridad. Se puede
+ * invocar desde un manejador de interrupcion: si la tarea despertada tiene
+ * mayor prioridad que la actual, se ejecuta al retornar de la interrupcion.
+ * @param task Tarea a despertar
+ */
+void task_wakeup(task_t * task) {
+	unsigned int flags;
+	int preempt;
+
+	if (task == 0) {
+		return;
+	}
+
+	preempt = 0;
+
+	flags = save_interrupts();
+
+	if (task->state == TASK_BLOCKED) {
+		/* Las tareas que esperan un evento (interactivas o que atienden una
+		 * IRQ) se ejecutan antes que las que usan intensivamente el
+		 * procesador */
+		task->priority = task->base_priority + TASK_PRIORITY_BONUS;
+		if (task->priority >= TASK_PRIORITIES) {
+			task->priority = TASK_PRIORITIES - 1;
+		}
+		task->state = TASK_READY;
+		enqueue_task(task);
+		preempt = (task->priority > current_task->priority);
+	}else if (task->state != TASK_FINISHED) {
+		task->wakeup_pending = 1;
+	}
+
+	if (preempt && interrupt_nesting == 1) {
+		/* Desde un manejador de interrupcion current_esp contiene el
+		 * contexto de la tarea actual: el cambio ocurre al retornar */
+		schedule();
+		preempt = 0;
+	}
+
+	restore_interrupts(flags);
+
+	/* Desde una tarea con las interrupciones habilitadas se cede el
+	 * procesador. En otro caso el siguiente tick del timer expropia a la
+	 * tarea actual. */
+	if (preempt && interrupt_nesting == 0 && (flags & EFLAGS_IF)) {
+		task_yield();
+	}
+}
+
+/**
+ * @brief Termina la tarea actual. Esta rutina no retorna.
+ */
+void task_exit(void) {
+	inline_assembly("cli");
+
+	current_task->state = TASK_FINISHED;
+
+	/* La tarea inicial no tiene pila propia */
+	if (current_task != &main_task) {
+		push_back_task(&finished_tasks, current_task);
+	}
+
+	for (;;) {
+		task_yield();
+	}
+}
+
+/**
+ * @brief Inicializa el subsistema de tareas. El codigo que invoca esta
+ * rutina se convierte en la tarea inicial ("main"). Tambien crea la tarea
+ * ociosa e instala los manejadores del tick del timer y de task_yield().
+ * Se debe invocar luego de setup_timer().
+ */
+void setup_tasks(void) {
+	int i;
+
+	for (i = 0; i < TASK_PRIORITIES; i++) {
+		init_list_task(&ready_queues[i]);
+	}
+	ready_map = 0;
+	init_list_task(&finished_tasks);
+
+	task_cache = kmem_cache_create("task", sizeof(task_t), 0, 0);
+
+	main_task.id = next_task_id++;
+	memcpy(main_task.name, "main", 5);
+	main_task.state = TASK_RUNNING;
+	main_task.priority = TASK_PRIORITY_DEFAULT;
+	main_task.base_priority = TASK_PRIORITY_DEFAULT;
+	main_task.stack = 0;
+	main_task.directory = kernel_directory;
+	current_task = &main_task;
+
+	/* La tarea ociosa no se inserta en las colas de tareas listas. Su
+	 * prioridad es menor que la de cualquier otra tarea. */
+	idle_task = new_task("idle", idle_loop, 0);
+	if (idle_task != 0) {
+		idle_task->priority = -1;
+		idle_task->base_priority = -1;
+	}else {
+		idle_task = &main_task;
+	}
+
+	quantum = TASK_QUANTUM;
+
+	install_interrupt_handler(TASK_YIELD_INTERRUPT, yield_handler);
+	install_tick_handler(scheduler_tick);
+
+	printf("Tasks enabled: %d priority levels, quantum %d ticks\n",
+			TASK_PRIORITIES, TASK_QUANTUM);
+}
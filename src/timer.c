@@ -0,0 +1,489 @@
+/**
+ * @file
+ * @ingroup kernel_code
+ * @author Erwin Meza <emezav@gmail.com>
+ * @copyright GNU Public License.
+ *
+ * @brief Este archivo implementa el timer del sistema (PIT 8254), la rueda
+ * jerarquica de temporizadores y el modo one-shot del procesador ocioso.
+ */
+
+#include <timer.h>
+#include <idt.h>
+#include <irq.h>
+#include <stdio.h>
+#include <asm.h>
+
+/** @brief Numero de ticks desde que se programo el PIT, acreditados por la
+ * IRQ0 */
+unsigned int timer_ticks;
+
+/** @brief Frecuencia de los ticks, en Hz */
+unsigned int timer_hz;
+
+/** @brief Cuenta del PIT que corresponde a un tick, 0 si el PIT no se ha
+ * programado */
+static unsigned int timer_divisor;
+
+/** @brief Cuenta programada en el one-shot en curso, 0 si el PIT se
+ * encuentra en modo periodico */
+static unsigned int oneshot_counts;
+
+/** @brief Cuenta desde el inicio del one-shot hasta el primer limite de
+ * tick. Los ticks siguientes ocupan timer_divisor cada uno. */
+static unsigned int oneshot_phase;
+
+/** @brief Ticks completos que transcurrieron antes de acortar el one-shot,
+ * que se acreditan al terminar */
+static unsigned int oneshot_extra;
+
+/** @brief Rueda raiz: una ranura por cada uno de los siguientes
+ * TIMER_ROOT_SLOTS ticks */
+static list_timer root_slots[TIMER_ROOT_SLOTS];
+
+/** @brief Ruedas de los niveles superiores. Cada ranura del nivel i cubre
+ * 2^(TIMER_ROOT_BITS + i * TIMER_LEVEL_BITS) ticks. */
+static list_timer level_slots[TIMER_LEVELS][TIMER_LEVEL_SLOTS];
+
+/** @brief Numero de temporizadores pendientes */
+static unsigned int pending_timers;
+
+/** @brief Rutina que se invoca en cada IRQ0 */
+static timer_tick_handler tick_handler;
+
+/** @brief Funcin para comparar dos temporizadores */
+int compare_timer_t(timer_t * a, timer_t * b) {
+	return (int)(b->expires - a->expires);
+}
+
+/** @brief Funcin para comparar un temporizador con un escalar (su
+ * expiracion) */
+int equals_timer_t(timer_t * a, void * b) {
+	return (unsigned int)b - a->expires;
+}
+
+/** @brief Implementacin de las primitivas para gestionar listas de tipo
+ * timer_t*/
+IMPLEMENT_GENERIC_LIST_TYPE(timer_t, timer);
+
+/**
+ * @brief Programa el canal 0 del PIT.
+ * @param mode PIT_MODE_ONESHOT o PIT_MODE_PERIODIC
+ * @param count Cuenta, entre 1 y PIT_MAX_COUNT
+ */
+static void pit_program(unsigned char mode, unsigned int count) {
+	outb(PIT_COMMAND_PORT, mode);
+	outb(PIT_CHANNEL0_PORT, count & 0xFF);
+	outb(PIT_CHANNEL0_PORT, (count >> 8) & 0xFF);
+}
+
+/**
+ * @brief Lee la cuenta actual del canal 0 del PIT.
+ * @return Cuenta restante
+ */
+static unsigned int pit_read(void) {
+	unsigned int low;
+
+	outb(PIT_COMMAND_PORT, PIT_LATCH);
+	low = inb(PIT_CHANNEL0_PORT);
+
+	return low | (inb(PIT_CHANNEL0_PORT) << 8);
+}
+
+/**
+ * @brief Inserta un temporizador en la ranura que corresponde a su
+ * expiracion: la rueda raiz si expira en los siguientes TIMER_ROOT_SLOTS
+ * ticks, o el primer nivel cuyo rango contiene la expiracion.
+ * @param timer Temporizador
+ */
+static void enqueue_timer(timer_t * timer) {
+	unsigned int delta;
+	list_timer * list;
+	int shift;
+	int level;
+
+	delta = timer->expires - timer_ticks;
+
+	if (delta < TIMER_ROOT_SLOTS) {
+		list = &root_slots[timer->expires & (TIMER_ROOT_SLOTS - 1)];
+	}else {
+		level = 0;
+		shift = TIMER_ROOT_BITS;
+		while (level < TIMER_LEVELS - 1 &&
+				delta >= (1u << (shift + TIMER_LEVEL_BITS))) {
+			level++;
+			shift += TIMER_LEVEL_BITS;
+		}
+		list = &level_slots[level][(timer->expires >> shift) &
+				(TIMER_LEVEL_SLOTS - 1)];
+	}
+
+	push_back_timer(list, timer);
+	timer->list = list;
+}
+
+/**
+ * @brief Avanza la rueda un tick y ejecuta los temporizadores que
+ * expiran.
+ */
+static void run_timer_tick(void) {
+	list_timer cascade;
+	timer_t * timer;
+	unsigned int index;
+	int shift;
+	int level;
+
+	timer_ticks++;
+
+	/* Cuando una rueda completa una vuelta, la siguiente ranura del nivel
+	 * superior se redistribuye en los niveles inferiores */
+	index = timer_ticks & (TIMER_ROOT_SLOTS - 1);
+	shift = TIMER_ROOT_BITS;
+	for (level = 0; index == 0 && level < TIMER_LEVELS; level++) {
+		index = (timer_ticks >> shift) & (TIMER_LEVEL_SLOTS - 1);
+		shift += TIMER_LEVEL_BITS;
+
+		cascade = level_slots[level][index];
+		init_list_timer(&level_slots[level][index]);
+		while ((timer = pop_front_timer(&cascade)) != 0) {
+			enqueue_timer(timer);
+		}
+	}
+
+	/* La rutina puede volver a programar el temporizador */
+	index = timer_ticks & (TIMER_ROOT_SLOTS - 1);
+	while ((timer = pop_front_timer(&root_slots[index])) != 0) {
+		timer->list = 0;
+		pending_timers--;
+		timer->callback(timer->arg);
+	}
+}
+
+/**
+ * @brief Calcula cuantos ticks puede durar un one-shot: hasta el siguiente
+ * temporizador de la rueda raiz, o hasta la siguiente vuelta de la rueda si
+ * existen temporizadores en los niveles superiores.
+ * @param max Numero maximo de ticks
+ * @return Numero de ticks, entre 1 y max.
+ */
+static unsigned int next_timer_ticks(unsigned int max) {
+	unsigned int ticks;
+	unsigned int index;
+
+	for (ticks = 1; ticks < max; ticks++) {
+		index = (timer_ticks + ticks) & (TIMER_ROOT_SLOTS - 1);
+		if (root_slots[index].count != 0 ||
+				(index == 0 && pending_timers != 0)) {
+			break;
+		}
+	}
+
+	return ticks;
+}
+
+/**
+ * @brief Calcula el numero de ticks que acredita la IRQ0 al terminar el
+ * one-shot en curso.
+ * @return Numero de ticks
+ */
+static unsigned int oneshot_ticks(void) {
+	return oneshot_extra + 1 + (oneshot_counts - oneshot_phase) / timer_divisor;
+}
+
+/**
+ * @brief Acorta el one-shot en curso para que termine en el siguiente
+ * limite de tick. Los ticks completos que ya transcurrieron se acreditan
+ * en la IRQ0, para que los temporizadores solo se ejecuten desde ella.
+ * @return 0 si el one-shot se acorto, -1 si la IRQ0 ya ocurrio o esta por
+ * ocurrir.
+ */
+static int shorten_oneshot(void) {
+	unsigned int remaining;
+	unsigned int elapsed;
+	unsigned int whole;
+
+	remaining = pit_read();
+
+	/* La IRQ0 ya ocurrio o esta por ocurrir */
+	if (remaining < PIT_ONESHOT_MARGIN || remaining > oneshot_counts) {
+		return -1;
+	}
+
+	elapsed = oneshot_counts - remaining;
+
+	if (elapsed < oneshot_phase) {
+		remaining = oneshot_phase - elapsed;
+	}else {
+		whole = 1 + (elapsed - oneshot_phase) / timer_divisor;
+		oneshot_extra += whole;
+		remaining = oneshot_phase + whole * timer_divisor - elapsed;
+	}
+
+	oneshot_counts = remaining;
+	oneshot_phase = remaining;
+	pit_program(PIT_MODE_ONESHOT, remaining);
+
+	return 0;
+}
+
+/**
+ * @brief Calcula el tick actual. Durante un one-shot timer_ticks no cuenta
+ * los ticks transcurridos desde la ultima IRQ0, por lo cual el one-shot se
+ * acorta y se suman los ticks que este acredita. Se debe invocar con las
+ * interrupciones deshabilitadas.
+ * @return Tick actual
+ */
+static unsigned int current_ticks(void) {
+	if (oneshot_counts == 0) {
+		return timer_ticks;
+	}
+
+	if (shorten_oneshot() == 0) {
+		return timer_ticks + oneshot_extra;
+	}
+
+	/* El one-shot ya termino, y la IRQ0 pendiente acredita todos sus
+	 * ticks */
+	return timer_ticks + oneshot_ticks();
+}
+
+/**
+ * @brief Manejador de la IRQ0. Acredita los ticks transcurridos desde la
+ * IRQ0 anterior (uno en modo periodico), invoca el manejador del tick y
+ * ejecuta los temporizadores que expiran. El manejador del tick se invoca
+ * primero, para que los ticks se acrediten a la tarea que se encontraba en
+ * ejecucion y no a una tarea que despierta un temporizador.
+ * @param state Estado del procesador al ocurrir la interrupcion
+ */
+static void timer_irq_handler(interrupt_state * state) {
+	unsigned int ticks;
+	unsigned int i;
+
+	ticks = 1;
+
+	/* Al terminar un one-shot el PIT vuelve al modo periodico */
+	if (oneshot_counts != 0) {
+		ticks = oneshot_ticks();
+		oneshot_counts = 0;
+		oneshot_extra = 0;
+		pit_program(PIT_MODE_PERIODIC, timer_divisor);
+	}
+
+	if (tick_handler != 0) {
+		tick_handler(ticks);
+	}
+
+	for (i = 0; i < ticks; i++) {
+		run_timer_tick();
+	}
+}
+
+/**
+ * @brief Programa el canal 0 del PIT e instala el manejador de la IRQ0.
+ * @param hz Frecuencia de los ticks, entre 19 Hz y PIT_FREQUENCY. Los
+ * valores por fuera del rango se ajustan.
+ */
+void setup_timer(unsigned int hz) {
+	int level;
+	int i;
+
+	for (i = 0; i < TIMER_ROOT_SLOTS; i++) {
+		init_list_timer(&root_slots[i]);
+	}
+
+	for (level = 0; level < TIMER_LEVELS; level++) {
+		for (i = 0; i < TIMER_LEVEL_SLOTS; i++) {
+			init_list_timer(&level_slots[level][i]);
+		}
+	}
+
+	/* La cuenta de un tick debe caber en los 16 bits del PIT */
+	if (hz < PIT_FREQUENCY / PIT_MAX_COUNT + 1) {
+		hz = PIT_FREQUENCY / PIT_MAX_COUNT + 1;
+	}
+	if (hz > PIT_FREQUENCY) {
+		hz = PIT_FREQUENCY;
+	}
+
+	timer_hz = hz;
+	timer_divisor = PIT_FREQUENCY / hz;
+	timer_ticks = 0;
+	pending_timers = 0;
+	oneshot_counts = 0;
+	oneshot_extra = 0;
+
+	pit_program(PIT_MODE_PERIODIC, timer_divisor);
+
+	install_irq_handler(0, timer_irq_handler);
+
+	printf("Timer enabled: %d Hz\n", timer_hz);
+}
+
+/**
+ * @brief Inicializa un temporizador que no se encuentra pendiente.
+ * @param timer Temporizador
+ */
+void init_timer(timer_t * timer) {
+	timer->list = 0;
+	timer->next_timer = 0;
+	timer->prev_timer = 0;
+}
+
+/**
+ * @brief Programa un temporizador. Si ya se encontraba pendiente, se
+ * reprograma.
+ * @param timer Temporizador, inicializado con init_timer()
+ * @param ticks Numero de ticks hasta la expiracion, entre 1 y
+ * TIMER_MAX_TICKS. Los valores por fuera del rango se ajustan.
+ * @param callback Rutina que se ejecuta al expirar
+ * @param arg Parametro de la rutina
+ * @return 0 si el temporizador se programo, -1 si los parametros no son
+ * validos.
+ */
+int timer_add(timer_t * timer, unsigned int ticks, timer_callback callback,
+		void * arg) {
+	unsigned int flags;
+
+	if (timer == 0 || callback == 0) {
+		return -1;
+	}
+
+	if (ticks == 0) {
+		ticks = 1;
+	}
+	if (ticks > TIMER_MAX_TICKS) {
+		ticks = TIMER_MAX_TICKS;
+	}
+
+	flags = save_interrupts();
+
+	if (timer->list != 0) {
+		remove_timer(timer->list, timer);
+		pending_timers--;
+	}
+
+	/* La expiracion se cuenta desde el tick actual, y enqueue_timer ubica
+	 * el temporizador respecto a la posicion de la rueda (timer_ticks) */
+	timer->expires = current_ticks() + ticks;
+	timer->callback = callback;
+	timer->arg = arg;
+	enqueue_timer(timer);
+	pending_timers++;
+
+	restore_interrupts(flags);
+
+	return 0;
+}
+
+/**
+ * @brief Obtiene el numero de ticks desde que se programo el PIT, incluidos
+ * los que aun no ha acreditado un one-shot en curso.
+ * @return Numero de ticks
+ */
+unsigned int timer_now(void) {
+	unsigned int flags;
+	unsigned int ticks;
+
+	flags = save_interrupts();
+	ticks = current_ticks();
+	restore_interrupts(flags);
+
+	return ticks;
+}
+
+/**
+ * @brief Cancela un temporizador pendiente.
+ * @param timer Temporizador
+ * @return 0 si el temporizador se cancelo, -1 si no se encontraba
+ * pendiente.
+ */
+int timer_cancel(timer_t * timer) {
+	unsigned int flags;
+	int result;
+
+	if (timer == 0) {
+		return -1;
+	}
+
+	result = -1;
+
+	flags = save_interrupts();
+
+	if (timer->list != 0) {
+		remove_timer(timer->list, timer);
+		timer->list = 0;
+		pending_timers--;
+		result = 0;
+	}
+
+	restore_interrupts(flags);
+
+	return result;
+}
+
+/**
+ * @brief Instala la rutina que se invoca en cada IRQ0, antes de ejecutar
+ * los temporizadores que expiran.
+ * @param handler Rutina, 0 para desinstalarla
+ */
+void install_tick_handler(timer_tick_handler handler) {
+	tick_handler = handler;
+}
+
+/**
+ * @brief Programa el PIT en modo one-shot hasta el siguiente temporizador
+ * (o la cuenta maxima del PIT). Se invoca cuando el procesador no tiene
+ * tareas listas, antes de detenerlo con hlt.
+ */
+void timer_enter_idle(void) {
+	unsigned int remaining;
+	unsigned int flags;
+	unsigned int ticks;
+
+	if (timer_divisor == 0) {
+		return;
+	}
+
+	flags = save_interrupts();
+
+	if (oneshot_counts != 0) {
+		/* Una interrupcion diferente de la IRQ0 desperto al procesador y
+		 * pudo programar un temporizador antes del fin del one-shot: este
+		 * termina en el siguiente tick, y luego se calcula uno nuevo */
+		shorten_oneshot();
+	}else {
+		/* En modo periodico la cuenta del PIT es la fraccion que falta del
+		 * tick actual */
+		remaining = pit_read();
+
+		if (remaining >= PIT_ONESHOT_MARGIN && remaining <= timer_divisor) {
+			ticks = next_timer_ticks(1 +
+					(PIT_MAX_COUNT - remaining) / timer_divisor);
+
+			if (ticks > 1) {
+				oneshot_phase = remaining;
+				oneshot_counts = remaining + (ticks - 1) * timer_divisor;
+				pit_program(PIT_MODE_ONESHOT, oneshot_counts);
+			}
+		}
+	}
+
+	restore_interrupts(flags);
+}
+
+/**
+ * @brief Acorta el one-shot en curso para que termine en el siguiente
+ * tick, luego del cual el PIT vuelve al modo periodico. Se invoca cuando
+ * una tarea se encuentra lista.
+ */
+void timer_exit_idle(void) {
+	unsigned int flags;
+
+	flags = save_interrupts();
+
+	if (oneshot_counts != 0) {
+		shorten_oneshot();
+	}
+
+	restore_interrupts(flags);
+}